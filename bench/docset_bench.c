@@ -0,0 +1,334 @@
+/**
+ * @brief Microbenchmark for the set operation kernels of docset.h.
+ *
+ * @details
+ * Runs intersection, union and difference with every kernel the cpu supports, on synthetic posting lists of
+ * similar sizes (where the merge kernels are used rather than galloping), and optionally on the posting lists
+ * of the most frequent terms of a directory of documents. Throughput is reported as millions of input ids per
+ * second, and results are checked against the scalar kernel.
+ *
+ * Usage: `docset_bench [dir]`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "docset.h"
+#include "findfiles.h"
+#include "tokenize.h"
+#include "list.h"
+#include "map.h"
+
+/* run each measurement for at least this many seconds */
+#define MIN_SECONDS 0.2
+
+/* number of most frequent terms paired up for the benchmark on real posting lists */
+#define N_REAL_TERMS 16
+
+typedef enum op {
+    OP_INTERSECT,
+    OP_UNION,
+    OP_DIFFERENCE,
+    N_OPS,
+} op_t;
+
+static const char *op_names[N_OPS] = {"intersect", "union", "difference"};
+
+/* a pair of sorted lists to run the operations on */
+typedef struct pair {
+    uint32_t *a;
+    size_t a_len;
+    uint32_t *b;
+    size_t b_len;
+} pair_t;
+
+/* growable posting list of a term, while reading documents */
+typedef struct doc_list {
+    uint32_t *doc_ids;
+    size_t length;
+    size_t capacity;
+} doc_list_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static size_t run_op(op_t op, const pair_t *pair, uint32_t *out) {
+    switch (op) {
+    case OP_INTERSECT:
+        return docset_intersect(pair->a, pair->a_len, pair->b, pair->b_len, out);
+    case OP_UNION:
+        return docset_union(pair->a, pair->a_len, pair->b, pair->b_len, out);
+    default:
+        return docset_difference(pair->a, pair->a_len, pair->b, pair->b_len, out);
+    }
+}
+
+/**
+ * @brief Time `op` over all pairs with the current kernel
+ * @returns millions of input ids processed per second
+ */
+static double measure(op_t op, const pair_t *pairs, size_t n_pairs, uint32_t *out) {
+    size_t ids_per_round = 0;
+    for (size_t p = 0; p < n_pairs; p++) {
+        ids_per_round += pairs[p].a_len + pairs[p].b_len;
+    }
+
+    size_t rounds = 0;
+    double start = now_seconds(), elapsed;
+
+    do {
+        for (size_t p = 0; p < n_pairs; p++) {
+            run_op(op, &pairs[p], out);
+        }
+        rounds++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    return (double) (ids_per_round * rounds) / elapsed / 1e6;
+}
+
+/**
+ * @brief Check that `kernel` produces the same ids as the scalar kernel for `op` on every pair
+ * @note panics on the first pair where the output differs. Leaves the scalar kernel selected.
+ */
+static void verify(op_t op, docset_kernel_t kernel, const pair_t *pairs, size_t n_pairs, uint32_t *out,
+                   uint32_t *expected) {
+    for (size_t p = 0; p < n_pairs; p++) {
+        docset_use_kernel(DOCSET_KERNEL_SCALAR);
+        size_t expected_len = run_op(op, &pairs[p], expected);
+        docset_use_kernel(kernel);
+        size_t len = run_op(op, &pairs[p], out);
+
+        if (len != expected_len || memcmp(out, expected, len * sizeof(uint32_t)) != 0) {
+            PANIC("%s kernel produced a different %s than scalar for pair %zu (%zu ids, expected %zu)\n",
+                  docset_kernel_name(kernel), op_names[op], p, len, expected_len);
+        }
+    }
+    docset_use_kernel(DOCSET_KERNEL_SCALAR);
+}
+
+/* run and print every operation with every supported kernel */
+static void bench_case(const char *name, const pair_t *pairs, size_t n_pairs) {
+    size_t out_capacity = 0;
+    for (size_t p = 0; p < n_pairs; p++) {
+        size_t len = pairs[p].a_len + pairs[p].b_len;
+        out_capacity = (len > out_capacity) ? len : out_capacity;
+    }
+
+    uint32_t *out = malloc((out_capacity + 1) * sizeof(uint32_t));
+    uint32_t *expected = malloc((out_capacity + 1) * sizeof(uint32_t));
+    if (out == NULL || expected == NULL) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (op_t op = 0; op < N_OPS; op++) {
+        double scalar_rate = 0.0;
+
+        printf("%-30s %-10s", name, op_names[op]);
+
+        for (docset_kernel_t kernel = 0; kernel < DOCSET_N_KERNELS; kernel++) {
+            if (docset_use_kernel(kernel) < 0) {
+                printf(" %18s", "-");
+                continue;
+            }
+
+            double rate = measure(op, pairs, n_pairs, out);
+
+            if (kernel == DOCSET_KERNEL_SCALAR) {
+                scalar_rate = rate;
+            } else {
+                verify(op, kernel, pairs, n_pairs, out, expected);
+            }
+            printf(" %9.1f (%5.2fx)", rate, rate / scalar_rate);
+        }
+        printf("\n");
+    }
+
+    free(out);
+    free(expected);
+}
+
+/* sorted list of about `length` ids, drawn uniformly from [0, universe) */
+static uint32_t *random_list(size_t length, uint32_t universe, size_t *out_len) {
+    uint32_t *ids = malloc((length + 1) * sizeof(uint32_t));
+    if (ids == NULL) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    size_t n = 0;
+    double p = (double) length / (double) universe;
+    for (uint32_t id = 0; id < universe && n < length; id++) {
+        if ((double) rand() / RAND_MAX < p) {
+            ids[n++] = id;
+        }
+    }
+
+    *out_len = n;
+    return ids;
+}
+
+static void bench_synthetic(void) {
+    static const struct {
+        const char *name;
+        size_t a_len;
+        size_t b_len;
+        uint32_t universe;
+    } cases[] = {
+        {"synthetic 1M x 1M, dense", 1000000, 1000000, 4000000},
+        {"synthetic 100k x 100k, sparse", 100000, 100000, 10000000},
+        {"synthetic 400k x 100k", 400000, 100000, 4000000},
+        {"synthetic 800k x 100k", 800000, 100000, 4000000},
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        pair_t pair;
+        pair.a = random_list(cases[c].a_len, cases[c].universe, &pair.a_len);
+        pair.b = random_list(cases[c].b_len, cases[c].universe, &pair.b_len);
+
+        bench_case(cases[c].name, &pair, 1);
+
+        free(pair.a);
+        free(pair.b);
+    }
+}
+
+static void add_doc_id(map_t *lists, char *term, uint32_t doc_id) {
+    entry_t *entry = map_get(lists, term);
+    doc_list_t *list;
+
+    if (entry == NULL) {
+        list = calloc(1, sizeof(doc_list_t));
+        if (list == NULL) {
+            PANIC("Failed to allocate memory\n");
+        }
+        map_insert(lists, term, list);
+    } else {
+        list = entry->val;
+        free(term);
+        if (list->doc_ids[list->length - 1] == doc_id) {
+            return;
+        }
+    }
+
+    if (list->length == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 4;
+        list->doc_ids = realloc(list->doc_ids, list->capacity * sizeof(uint32_t));
+        if (list->doc_ids == NULL) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+    list->doc_ids[list->length++] = doc_id;
+}
+
+static void free_doc_list(void *list) {
+    free(((doc_list_t *) list)->doc_ids);
+    free(list);
+}
+
+static int compare_by_length_desc(const void *a, const void *b) {
+    size_t a_len = (*(doc_list_t **) a)->length;
+    size_t b_len = (*(doc_list_t **) b)->length;
+    return (a_len < b_len) - (a_len > b_len);
+}
+
+/* posting lists of the most frequent terms in `dir`, paired up with each other */
+static void bench_real(const char *dir) {
+    list_t *paths = list_create((cmp_fn) strcmp);
+    map_t *lists = map_create((cmp_fn) strcmp, (hash64_fn) hash_string_fnv1a64);
+    if (paths == NULL || lists == NULL || find_files(dir, paths, NULL, 0) < 0) {
+        PANIC("Failed to find files in %s\n", dir);
+    }
+
+    uint32_t doc_id = 0;
+    while (list_length(paths) > 0) {
+        char *path = list_popfirst(paths);
+        FILE *f = fopen(path, "r");
+        list_t *terms = list_create((cmp_fn) strcmp);
+
+        if (f != NULL && terms != NULL && tokenize_file(f, terms, 1, isspace, is_ascii_alnum, tolower) == 0) {
+            while (list_length(terms) > 0) {
+                add_doc_id(lists, list_popfirst(terms), doc_id);
+            }
+            doc_id++;
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        list_destroy(terms, free);
+        free(path);
+    }
+
+    size_t n_terms = map_length(lists);
+    doc_list_t **by_length = malloc((n_terms + 1) * sizeof(doc_list_t *));
+    if (by_length == NULL) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    map_iter_t *iter = map_createiter(lists);
+    for (size_t t = 0; map_hasnext(iter); t++) {
+        by_length[t] = map_next(iter)->val;
+    }
+    map_destroyiter(iter);
+    qsort(by_length, n_terms, sizeof(doc_list_t *), compare_by_length_desc);
+
+    size_t n_top = (n_terms < N_REAL_TERMS) ? n_terms : N_REAL_TERMS;
+    pair_t *pairs = malloc((n_top * n_top + 1) * sizeof(pair_t));
+    size_t n_pairs = 0;
+    if (pairs == NULL) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (size_t i = 0; i < n_top; i++) {
+        for (size_t j = i + 1; j < n_top; j++) {
+            pairs[n_pairs++] = (pair_t) {
+                by_length[i]->doc_ids,
+                by_length[i]->length,
+                by_length[j]->doc_ids,
+                by_length[j]->length,
+            };
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%u docs, top %zu term pairs", doc_id, n_top);
+    bench_case(name, pairs, n_pairs);
+
+    free(pairs);
+    free(by_length);
+    map_destroy(lists, free, free_doc_list);
+    list_destroy(paths, free);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [dir]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+
+    printf("Millions of input ids per second (speedup over scalar)\n");
+    printf("%-30s %-10s", "Lists", "Operation");
+    for (docset_kernel_t kernel = 0; kernel < DOCSET_N_KERNELS; kernel++) {
+        printf(" %18s", docset_kernel_name(kernel));
+    }
+    printf("\n");
+
+    bench_synthetic();
+
+    if (argc == 2) {
+        bench_real(argv[1]);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,278 @@
+/**
+ * @brief Microbenchmark for the string hash functions of common.h.
+ *
+ * @details
+ * Hashes a vocabulary of distinct words with every hash function, and reports the throughput, the time to insert
+ * every word into a map (with the map implementation selected in the Makefile), the number of full 64-bit
+ * collisions, and how evenly the hashes spread over a table with one bucket per word. The spread is measured for
+ * the low bits (used by hashmap.c) and the high bits (used by swisstable.c) of the hash, as the ratio of the
+ * expected probe length to the one of a perfectly random hash; 1.00 is ideal, and higher is worse.
+ *
+ * The vocabulary is the distinct words of the documents in `dir` if given (e.g. `data/enwiki`), and otherwise a
+ * synthetic one of sequential and random words.
+ *
+ * Usage: `hash_bench [dir]`
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "findfiles.h"
+#include "tokenize.h"
+#include "list.h"
+#include "map.h"
+
+/* run each measurement for at least this many seconds */
+#define MIN_SECONDS 0.2
+
+/* number of words in the synthetic vocabulary, half of them sequential and half random */
+#define N_SYNTHETIC_WORDS 1000000
+
+typedef struct hash_case {
+    const char *name;
+    hash64_fn hashfn;
+} hash_case_t;
+
+static const hash_case_t hashes[] = {
+    {"fnv1a64", (hash64_fn) hash_string_fnv1a64},
+    {"wyhash64", (hash64_fn) hash_string_wyhash64},
+};
+
+typedef struct vocab {
+    char **words;
+    size_t length;
+    size_t n_bytes;
+} vocab_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* nanoseconds per word to hash the whole vocabulary */
+static double measure_hash(hash64_fn hashfn, const vocab_t *vocab, uint64_t *checksum) {
+    size_t rounds = 0;
+    double start = now_seconds(), elapsed;
+
+    do {
+        *checksum = 0;
+        for (size_t i = 0; i < vocab->length; i++) {
+            *checksum += hashfn(vocab->words[i]);
+        }
+        rounds++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    return elapsed * 1e9 / (double) (vocab->length * rounds);
+}
+
+/* nanoseconds per word to insert every word into a new map, and look each of them up once */
+static double measure_map(hash64_fn hashfn, const vocab_t *vocab) {
+    size_t rounds = 0;
+    double start = now_seconds(), elapsed;
+
+    do {
+        map_t *map = map_create((cmp_fn) strcmp, hashfn);
+        if (map == NULL) {
+            PANIC("Failed to create map\n");
+        }
+        for (size_t i = 0; i < vocab->length; i++) {
+            map_insert(map, vocab->words[i], NULL);
+        }
+        for (size_t i = 0; i < vocab->length; i++) {
+            if (map_get(map, vocab->words[i]) == NULL) {
+                PANIC("Word %s is missing from the map\n", vocab->words[i]);
+            }
+        }
+        map_destroy(map, NULL, NULL);
+        rounds++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    return elapsed * 1e9 / (double) (vocab->length * rounds);
+}
+
+/**
+ * @brief Spread of `n` hashes over a table of the next power of two >= `n` buckets, selected by the bits of the
+ * hash from `shift` and up
+ * @returns the expected probe length relative to a random hash, sum(b_j (b_j + 1) / 2) / ((n / 2m) (n + 2m - 1))
+ */
+static double bucket_quality(const uint64_t *hashes, size_t n, unsigned shift) {
+    size_t m = 1;
+    while (m < n) {
+        m *= 2;
+    }
+
+    uint32_t *buckets = calloc(m, sizeof(uint32_t));
+    if (buckets == NULL) {
+        PANIC("Failed to allocate memory\n");
+    }
+    for (size_t i = 0; i < n; i++) {
+        buckets[(hashes[i] >> shift) & (m - 1)]++;
+    }
+
+    double sum = 0.0;
+    for (size_t j = 0; j < m; j++) {
+        sum += (double) buckets[j] * (buckets[j] + 1) / 2.0;
+    }
+    free(buckets);
+
+    return sum / (((double) n / (2.0 * m)) * ((double) n + 2.0 * m - 1.0));
+}
+
+static void bench_vocab(const char *name, const vocab_t *vocab) {
+    printf("%s: %zu words, %.1f bytes on average\n", name, vocab->length, (double) vocab->n_bytes / vocab->length);
+    printf("%-10s %10s %10s %12s %12s %12s %12s\n", "Hash", "ns/word", "MB/s", "map ns/word", "collisions",
+           "low bits", "high bits");
+
+    uint64_t *values = malloc((vocab->length + 1) * sizeof(uint64_t));
+    if (values == NULL) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++) {
+        uint64_t checksum;
+        double ns = measure_hash(hashes[h].hashfn, vocab, &checksum);
+        double map_ns = measure_map(hashes[h].hashfn, vocab);
+
+        for (size_t i = 0; i < vocab->length; i++) {
+            values[i] = hashes[h].hashfn(vocab->words[i]);
+        }
+        double low = bucket_quality(values, vocab->length, 0);
+        double high = bucket_quality(values, vocab->length, 7);
+
+        qsort(values, vocab->length, sizeof(uint64_t), compare_u64);
+        size_t collisions = 0;
+        for (size_t i = 1; i < vocab->length; i++) {
+            collisions += (values[i] == values[i - 1]);
+        }
+
+        double mb_per_s = (double) vocab->n_bytes / (ns * (double) vocab->length) * 1e3;
+        printf("%-10s %10.2f %10.1f %12.1f %12zu %12.3f %12.3f\n", hashes[h].name, ns, mb_per_s, map_ns, collisions,
+               low, high);
+    }
+    printf("\n");
+
+    free(values);
+}
+
+static void vocab_add(vocab_t *vocab, char *word, size_t *capacity) {
+    if (vocab->length == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        vocab->words = realloc(vocab->words, *capacity * sizeof(char *));
+        if (vocab->words == NULL) {
+            PANIC("Failed to allocate memory\n");
+        }
+    }
+    vocab->words[vocab->length++] = word;
+    vocab->n_bytes += strlen(word);
+}
+
+static void vocab_destroy(vocab_t *vocab) {
+    for (size_t i = 0; i < vocab->length; i++) {
+        free(vocab->words[i]);
+    }
+    free(vocab->words);
+}
+
+/* "w0", "w1", ... like the terms of generated test corpora, and random lowercase words of 2..20 letters */
+static void bench_synthetic(void) {
+    vocab_t vocab = {NULL, 0, 0};
+    size_t capacity = 0;
+    char buf[32];
+
+    for (size_t i = 0; i < N_SYNTHETIC_WORDS / 2; i++) {
+        snprintf(buf, sizeof(buf), "w%zu", i);
+        vocab_add(&vocab, strdup(buf), &capacity);
+    }
+
+    map_t *seen = map_create((cmp_fn) strcmp, (hash64_fn) hash_string_wyhash64);
+    while (vocab.length < N_SYNTHETIC_WORDS) {
+        size_t len = 2 + (size_t) rand() % 19;
+        for (size_t c = 0; c < len; c++) {
+            buf[c] = (char) ('a' + rand() % 26);
+        }
+        buf[len] = '\0';
+
+        if (map_get(seen, buf) == NULL) {
+            char *word = strdup(buf);
+            map_insert(seen, word, NULL);
+            vocab_add(&vocab, word, &capacity);
+        }
+    }
+    map_destroy(seen, NULL, NULL);
+
+    bench_vocab("synthetic", &vocab);
+    vocab_destroy(&vocab);
+}
+
+/* the distinct words of all documents in `dir`, tokenized as by the indexer */
+static void bench_real(const char *dir) {
+    list_t *paths = list_create((cmp_fn) strcmp);
+    map_t *seen = map_create((cmp_fn) strcmp, (hash64_fn) hash_string_wyhash64);
+    if (paths == NULL || seen == NULL || find_files(dir, paths, NULL, 0) < 0) {
+        PANIC("Failed to find files in %s\n", dir);
+    }
+
+    vocab_t vocab = {NULL, 0, 0};
+    size_t capacity = 0;
+
+    while (list_length(paths) > 0) {
+        char *path = list_popfirst(paths);
+        FILE *f = fopen(path, "r");
+        list_t *terms = list_create((cmp_fn) strcmp);
+
+        if (f != NULL && terms != NULL && tokenize_file(f, terms, 1, isspace, is_ascii_alnum, tolower) == 0) {
+            while (list_length(terms) > 0) {
+                char *term = list_popfirst(terms);
+                if (map_get(seen, term)) {
+                    free(term);
+                    continue;
+                }
+                map_insert(seen, term, NULL);
+                vocab_add(&vocab, term, &capacity);
+            }
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        list_destroy(terms, free);
+        free(path);
+    }
+    map_destroy(seen, NULL, NULL);
+    list_destroy(paths, free);
+
+    bench_vocab(dir, &vocab);
+    vocab_destroy(&vocab);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [dir]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+
+    if (argc == 2) {
+        bench_real(argv[1]);
+    } else {
+        bench_synthetic();
+    }
+
+    return EXIT_SUCCESS;
+}
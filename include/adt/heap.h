@@ -0,0 +1,75 @@
+/**
+ * @brief Binary min-heap (priority queue) of generic elements
+ *
+ * @details
+ * The element that compares lowest is always at the top. To keep the `k` largest elements of a stream, push
+ * until the heap holds `k` elements, then replace the top whenever a new element compares greater than it.
+ */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h> // for size_t
+
+#include "defs.h"
+
+/**
+ * Type of heap. `heap_t` is an alias for `struct heap`
+ */
+typedef struct heap heap_t;
+
+/**
+ * @brief Create a new, empty heap
+ * @param cmpfn: function for comparing elements. The lowest element is kept at the top.
+ * @returns A pointer to the newly created heap, or NULL on failure
+ */
+heap_t *heap_create(cmp_fn cmpfn);
+
+/**
+ * @brief Destroy a heap, and optionally its elements
+ * @param heap: pointer to heap
+ * @param elem_freefn: nullable. If present, called on all elements
+ * @note this is safe to call with `heap` == NULL, where it simply returns
+ */
+void heap_destroy(heap_t *heap, free_fn elem_freefn);
+
+/**
+ * @brief Get the number of elements in a heap
+ * @param heap: pointer to heap
+ */
+size_t heap_length(heap_t *heap);
+
+/**
+ * @brief Add an element to a heap
+ * @param heap: pointer to heap
+ * @param elem: pointer to element
+ * @returns 0 on success, otherwise a negative error code
+ */
+int heap_push(heap_t *heap, void *elem);
+
+/**
+ * @brief Get the lowest element of a heap without removing it
+ * @param heap: pointer to heap
+ * @returns the lowest element, or NULL if the heap is empty
+ */
+void *heap_peek(heap_t *heap);
+
+/**
+ * @brief Remove the lowest element of a heap
+ * @param heap: pointer to heap
+ * @returns the removed element
+ * @warning should panic if heap is empty
+ */
+void *heap_pop(heap_t *heap);
+
+/**
+ * @brief Remove the lowest element of a heap and add another, in one step
+ * @param heap: pointer to heap
+ * @param elem: pointer to element to add
+ * @returns the removed element
+ * @warning should panic if heap is empty
+ */
+void *heap_replace_top(heap_t *heap, void *elem);
+
+
+#endif /* HEAP_H */
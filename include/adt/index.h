@@ -10,6 +10,7 @@
 
 #include "defs.h"
 #include "list.h"
+#include "codec.h"
 
 /**
  * Type of index. `index_t` is an alias for `struct index_`
@@ -27,6 +28,9 @@ typedef enum
 /**
  * Type of query_result produced by a index query.
  * Higher score implies the document is more relevant.
+ *
+ * @note `doc_name` is borrowed from the document table of the index, and is valid until `index_destroy`. It
+ * should not be freed by the caller.
  */
 typedef struct query_result {
     char *doc_name;
@@ -34,11 +38,125 @@ typedef struct query_result {
 } query_result_t;
 
 /**
- * @brief Create a new index
+ * How boolean queries are evaluated
+ */
+typedef enum index_engine {
+    INDEX_ENGINE_ITERATORS, // document-at-a-time: a tree of iterators that yields one matching document at a time
+    INDEX_ENGINE_SETS,      // term-at-a-time: each operator produces the full set of documents it matches
+} index_engine_t;
+
+/**
+ * Dynamic pruning of ranked disjunctions (queries that are a single term, or terms joined by `||`). Only used when
+ * fewer than all results are asked for, see `index_query_topk`.
+ */
+typedef enum index_pruning {
+    INDEX_PRUNING_NONE,      // exhaustive: every matching document is scored
+    INDEX_PRUNING_WAND,      // skip documents whose terms' maximum scores cannot reach the current top-k
+    INDEX_PRUNING_BLOCK_MAX, // WAND, then also skip blocks of postings using the maximum score of each block
+} index_pruning_t;
+
+/**
+ * How much of a saved index `index_load` checks before using it
+ */
+typedef enum index_verify {
+    INDEX_VERIFY_NONE, // only the header and the layout of the file: the rest is read when queries need it
+    INDEX_VERIFY_FULL, // also the checksum of the whole file, and every string offset, slot and posting list
+} index_verify_t;
+
+/**
+ * Options for how an index is built and queried. Initialize with `index_config_default`, then change any options before
+ * passing it to `index_create_with_config`.
+ */
+typedef struct index_config {
+    codec_t codec;               // codec used to compress the blocks of each posting list
+    index_engine_t engine;       // how queries are evaluated
+    double bm25_k1;              // BM25 term frequency saturation. Higher values let repeated terms count for more.
+    double bm25_b;               // BM25 document length normalization, from 0 (none) to 1 (full)
+    index_pruning_t pruning;     // dynamic pruning of ranked disjunctions
+    size_t cache_bytes;          // memory budget of the query result cache. 0 disables the cache.
+    size_t subquery_cache_bytes; // memory budget of the cache of subquery results shared by queries. 0 disables it.
+    size_t program_cache_bytes;  // memory budget of the cache of compiled queries. 0 disables it.
+    index_verify_t verify;       // how much of a saved index is checked when it is loaded, see `index_load`
+} index_config_t;
+
+/**
+ * Number of term classes in `index_stats_t`
+ */
+#define INDEX_N_TERM_CLASSES 5
+
+/**
+ * Statistics for all terms that occur in a certain range of documents
+ */
+typedef struct index_term_class {
+    size_t min_docs;         // terms in this class occur in at least this many documents
+    size_t max_docs;         // ... and at most this many. 0 means no upper limit.
+    size_t n_terms;          // number of terms in this class
+    size_t n_postings;       // total number of (term, document) postings of these terms
+    size_t raw_bytes;        // size of the postings as plain 32-bit document ids and counts
+    size_t compressed_bytes; // actual size of the compressed postings, including block headers
+} index_term_class_t;
+
+/**
+ * Statistics of one of the caches of an index
+ */
+typedef struct index_cache_stats {
+    size_t hits;      // lookups answered from the cache
+    size_t misses;    // lookups that had to be evaluated, and were then cached if they fit
+    size_t n_entries; // number of cached entries
+    size_t n_bytes;   // memory used by the cached entries
+    size_t budget;    // memory budget of the cache, from the config
+} index_cache_stats_t;
+
+/**
+ * Detailed statistics of an index, see `index_stat_detail`
+ */
+typedef struct index_stats {
+    codec_t codec;
+    int compact; // 1 if the index has been frozen into its compact layout, see `index_freeze`
+    index_term_class_t term_classes[INDEX_N_TERM_CLASSES];
+    index_cache_stats_t cache;          // results of whole queries
+    index_cache_stats_t subquery_cache; // documents matched by subqueries, such as `a && b`
+    index_cache_stats_t program_cache;  // compiled queries, keyed on their tokens
+} index_stats_t;
+
+/**
+ * Statistics of a single query, see `index_query_topk`
+ */
+typedef struct index_query_stats {
+    size_t n_hits;    // number of documents that match the query
+    int n_hits_exact; // 0 if pruning skipped documents without scoring them. `n_hits` is then a lower bound.
+    size_t n_scored;  // number of documents that were scored
+} index_query_stats_t;
+
+/**
+ * A query of a batch, see `index_query_batch`
+ */
+typedef struct index_batch_query {
+    list_t *tokens;            // ordered list of strings representing individual query tokens. Owned by the caller.
+    list_t *results;           // set to the results as from `index_query_topk`, or NULL if the query failed
+    index_query_stats_t stats; // set to the statistics of the query
+    char *errmsg;              // set to an error message if the query failed, otherwise NULL. Freed by the caller.
+} index_batch_query_t;
+
+/**
+ * @brief Set all options of an index config to their default values
+ * @param config: pointer to config
+ */
+void index_config_default(index_config_t *config);
+
+/**
+ * @brief Create a new index with the default config
  * @returns a pointer to the newly allocated index, or NULL on failure
  */
 index_t *index_create();
 
+/**
+ * @brief Create a new index
+ * @param config: pointer to config. Copied by the index.
+ * @returns a pointer to the newly allocated index, or NULL on failure
+ */
+index_t *index_create_with_config(const index_config_t *config);
+
 /**
  * @brief Destroy the given index, freeing all related resources.
  * @param index: pointer to index
@@ -59,9 +177,125 @@ void index_destroy(index_t *index);
  *
  * The index may utilize these items further, or free them right away. They must be freed by the index at the
  * very latest during index_destroy.
+ *
+ * @note Each call assigns the next dense document id (0, 1, 2, ...). `doc_name` is stored once in the
+ * document table of the index, and postings refer to the document by its id.
+ *
+ * @note If the operation fails, the document is not added, and the index is left as it was.
  */
 int index_document(index_t *index, char *doc_name, list_t *words);
 
+/**
+ * @brief Index a document from its term frequencies, such as those kept by a build manifest (see `manifest.h`)
+ *
+ * @param index: pointer to index
+ * @param doc_name: distinct reference to a document or file. Owned by the index from this point.
+ * @param terms: the distinct terms of the document. Copied by the index where needed, and left to the caller.
+ * @param counts: number of occurrences of each term in the document
+ * @param n_terms: number of distinct terms
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note Equivalent to `index_document` with the same words, in any order, but without counting them again.
+ */
+int index_document_counts(index_t *index, char *doc_name, const char **terms, const uint32_t *counts, size_t n_terms);
+
+/**
+ * @brief Move all documents and terms from one index into another, destroying the source index.
+ *
+ * @param dst: pointer to index to merge into
+ * @param src: pointer to index to merge from. Freed by this call, regardless of status.
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note The documents of `src` keep their relative order, and are given the document ids following the ones
+ * already in `dst`. Building partial indexes over consecutive ranges of documents and merging them in order
+ * thus gives the same index as indexing all documents one by one.
+ */
+int index_merge(index_t *dst, index_t *src);
+
+/**
+ * @brief Make room for the given number of documents and unique terms in total, so that the index does not have to
+ * grow while they are added.
+ *
+ * @param index: pointer to index
+ * @param n_docs: expected number of documents
+ * @param n_terms: expected number of unique terms
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note this is only a hint. Indexing more documents or terms than reserved for still works, and the index never
+ * shrinks as a result of this call.
+ */
+int index_reserve(index_t *index, size_t n_docs, size_t n_terms);
+
+/**
+ * @brief Create an index that is partitioned into shards, one index per range of document ids.
+ *
+ * @param shards: array of `n_shards` indexes, each over the documents following the ones in the shard before it
+ * @param n_shards: number of shards, at least 1
+ * @returns pointer to the new index, or NULL on error
+ *
+ * @note The shards are owned by the returned index from this point, and are destroyed on error. The array
+ * itself is copied, and remains owned by the caller. The index is configured as the first shard.
+ *
+ * Each query runs on all shards concurrently, one thread per shard, and the top results of the shards are merged.
+ * Term weights and document lengths are computed over all shards, so the results are the same as from a single
+ * index over all documents. Documents indexed or merged into the returned index are added to the last shard.
+ * The statistics from `index_stat_detail` are summed over the shards.
+ */
+index_t *index_create_sharded(index_t **shards, size_t n_shards);
+
+/**
+ * @brief Freeze the index into a compact, read-only layout once all documents have been added
+ *
+ * @param index: pointer to index
+ * @returns 0 if the operation succeeded, otherwise a negative status code. On failure, the index is left as it was
+ * and can still be queried.
+ *
+ * @note The terms are stored one after another in a single array, with an open-addressing table of term ids for
+ * lookups. The posting lists of all terms are packed into one array of block headers and one of compressed data,
+ * and the document names into a single array. The mutable structures they replace are freed. Queries give the
+ * same results as before.
+ *
+ * @note After this, documents can no longer be indexed or merged into the index (or merged from it). Freezing an
+ * index that already is frozen does nothing. It must not be queried from other threads while it is being frozen.
+ */
+int index_freeze(index_t *index);
+
+/**
+ * @brief Save the index to a file, which can later be loaded with `index_load` instead of indexing the documents again
+ *
+ * @param index: pointer to index
+ * @param path: path of the file to write. An existing file is replaced.
+ * @returns 0 if the operation succeeded, otherwise a negative status code
+ *
+ * @note The index is frozen with `index_freeze` first, and the arrays of its compact layout are written as they are,
+ * after a header with a version number and a checksum of the file. The file is written next to `path` and renamed to
+ * it once complete, so `path` is never left half written.
+ */
+int index_save(index_t *index, const char *path);
+
+/**
+ * @brief Load an index saved with `index_save`
+ *
+ * @param path: path of the file to load
+ * @param config: configuration of the loaded index. The codec and the BM25 parameters are taken from the file, as
+ * the postings and term weights were computed with them.
+ * @returns the loaded index if successful, otherwise NULL
+ *
+ * @note The file is mapped into memory and used in place. Loading reads the header, the layout of each shard, and
+ * the weight and posting list record of each term, which it sets up an entry for. The document names, block headers
+ * and postings are only read when queries touch them. The file must not be modified while the index exists.
+ *
+ * @note Files with another version, or whose header or layout does not fit the file, are rejected. With
+ * `INDEX_VERIFY_NONE` the rest of the file is trusted to be as `index_save` wrote it, and a file that was damaged
+ * or modified since can crash a query. With `INDEX_VERIFY_FULL`, files whose checksum does not match their
+ * contents, or with any offset, slot or posting outside of its array, are also rejected, at the cost of reading
+ * the whole file.
+ *
+ * @note The loaded index is frozen and has the same shards as the saved one. Queries give the same results as on
+ * the saved index.
+ */
+index_t *index_load(const char *path, const index_config_t *config);
+
 /**
  * @brief Search the index for documents that match the query
  *
@@ -70,14 +304,63 @@ int index_document(index_t *index, char *doc_name, list_t *words);
  * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
  *
  * @returns NULL if the query was malformed or otherwise invalid, otherwise a list containing 0..n
- * `query_result_t` structs, sorted by score in descending order. If the return value is NULL, `errbuf` should
- * be set to a string with reasoning. (e.g. "expected term after <some_token>, found operator <other_token>")
+ * `query_result_t` structs, sorted by their BM25 score in descending order. If the return value is NULL, `errbuf`
+ * should be set to a string with reasoning. (e.g. "expected term after <some_token>, found operator <other_token>")
  *
  * @note the index may remove strings from the given list of tokens, as long as they are cleaned up (freed) by
  * the index. The list itself should not be destroyed.
+ *
+ * @note a document is scored by the terms of the query that it contains, each counted once however many times it
+ * appears in the query. Terms that are only used to exclude documents (the right hand side of `&!`) do not count.
  */
 list_t *index_query(index_t *index, list_t *query_tokens, char *errbuf);
 
+/**
+ * @brief Search the index for the `k` best documents that match the query
+ *
+ * @param index: pointer to index
+ * @param query_tokens: ordered list of strings representing individual query tokens
+ * @param k: maximum number of results to return, or 0 for all of them
+ * @param stats: nullable. If present, filled in with statistics of the query, such as the number of matching documents
+ * @param errbuf: Caller-provided buffer to write error messages to (min. buffer size = LINE_MAX)
+ *
+ * @returns same as `index_query`, but with at most `k` results. Ties in score are ordered by document name.
+ *
+ * @note only the `k` best results are kept in memory while the matching documents are scored
+ *
+ * @note with pruning enabled in the config, documents of a disjunction that cannot make it into the `k` best are
+ * skipped without being scored. The results are the same as without pruning, but the number of matching documents
+ * is then only a lower bound.
+ *
+ * @note results are kept in a least-recently-used cache, keyed on the canonical form of the query: the operands of
+ * `&&` and `||` in any order, with duplicates removed. Queries that only differ in this way share results. The cache
+ * is cleared whenever documents are added to the index.
+ *
+ * @note queries are parsed, planned and compiled to a flat program once. The program is kept in a cache keyed on the
+ * query tokens, and run again for repeated queries.
+ */
+list_t *index_query_topk(index_t *index, list_t *query_tokens, size_t k, index_query_stats_t *stats, char *errbuf);
+
+/**
+ * @brief Search the index for the `k` best documents of each query in a batch, spread over worker threads
+ *
+ * @param index: pointer to index
+ * @param queries: array of `n_queries` queries. The results, statistics and any error message of each query are
+ * written to the query itself, so they come back in input order.
+ * @param n_queries: number of queries
+ * @param k: maximum number of results per query, or 0 for all of them
+ * @param n_threads: number of worker threads to run the queries on. With 1, they are run on the calling thread.
+ *
+ * @returns 0 if the batch was run, otherwise a negative status code. Queries that are malformed only fail by
+ * themselves, see `index_batch_query_t`.
+ *
+ * @note the results are the same as running each query with `index_query_topk`. Each distinct query in the batch is
+ * parsed only once, and each distinct term of the batch is looked up only once in each shard.
+ *
+ * @note the index must not be modified, or queried from other threads, while the batch is running
+ */
+int index_query_batch(index_t *index, index_batch_query_t *queries, size_t n_queries, size_t k, size_t n_threads);
+
 /**
  * @brief Get the number of unique documents and terms that have been indexed
  * @param n_docs: pointer to size_t - must be set to the number of docs
@@ -85,5 +368,12 @@ list_t *index_query(index_t *index, list_t *query_tokens, char *errbuf);
  */
 void index_stat(index_t *index, size_t *n_docs, size_t *n_terms);
 
+/**
+ * @brief Get detailed statistics of the index, such as the compressed size of its postings per term class
+ * @param index: pointer to index
+ * @param stats: pointer to stats struct, which is filled in by this call
+ */
+void index_stat_detail(index_t *index, index_stats_t *stats);
+
 
 #endif /* INDEX_H */
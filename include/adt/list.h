@@ -36,6 +36,16 @@ struct list_iter {
  */
 list_t *list_create(cmp_fn cmpfn);
 
+/**
+ * @brief Hint that about `n` more items will be added to the list, so that the implementation may allocate room
+ * for them at once rather than one by one.
+ * @param list: pointer to list
+ * @param n: expected number of items to be added
+ * @returns 0 on success, otherwise a negative error code
+ * @note the list still accepts any number of items, regardless of the hint
+ */
+int list_reserve(list_t *list, size_t n);
+
 /**
  * @brief Destroy a list, and optionally its items.
  * @param list: pointer to list
@@ -12,6 +12,7 @@
 #define MAP_H
 
 #include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
 
 #include "defs.h"
 
@@ -44,6 +45,23 @@ typedef struct entry {
  */
 map_t *map_create(cmp_fn cmpfn, hash64_fn hashfn);
 
+/**
+ * @brief Same as `map_create`, but with room for `capacity` entries before the map has to grow
+ * @param capacity: the expected number of entries. 0 gives the same map as `map_create`
+ * @returns NULL on error, otherwise a pointer to the newly created map
+ * @note this is only a hint. The map still grows past `capacity` as needed
+ */
+map_t *map_create_with_capacity(cmp_fn cmpfn, hash64_fn hashfn, size_t capacity);
+
+/**
+ * @brief Make room for at least `n` entries in total, so that the map does not have to grow (and rehash) until
+ * it holds more than `n` entries. Does nothing if the map already has room for them.
+ * @param map: pointer to a map
+ * @param n: the expected total number of entries
+ * @returns 0 on success, otherwise a negative error code (the map is left as it was)
+ */
+int map_reserve(map_t *map, size_t n);
+
 /**
  * @brief Destroys the given map. Optional functionality to also destroy values
  * @param map: pointer to a map
@@ -76,6 +94,36 @@ size_t map_length(map_t *map);
  */
 entry_t *map_insert(map_t *map, void *key, void *val);
 
+/**
+ * @brief Same as `map_insert`, but with the hash of the key computed by the caller
+ * @param hash: the hash of `key`, exactly as given by the `hashfn` of the map
+ * @note Implementations that do not hash keys simply ignore `hash`
+ */
+entry_t *map_insert_hashed(map_t *map, void *key, void *val, uint64_t hash);
+
+/**
+ * @brief Get the entry of `key`, inserting a new entry for it if it is not present. This replaces the common
+ * pattern of `map_get` followed by `map_insert` on a miss, which looks the key up twice.
+ *
+ * @param map: pointer to map
+ * @param key: pointer to a key. Only kept by the map if it is inserted
+ * @param inserted: set to 1 if a new entry was inserted, otherwise 0
+ *
+ * @returns The entry associated with key. A new entry has `key` as its key and NULL as its value, which the
+ * caller is expected to set through the returned entry.
+ *
+ * @warning The returned entry is borrowed to the caller by the map, as with `map_get`.
+ * @note this function panics on malloc failure, as with `map_insert`
+ */
+entry_t *map_upsert(map_t *map, void *key, int *inserted);
+
+/**
+ * @brief Same as `map_upsert`, but with the hash of the key computed by the caller
+ * @param hash: the hash of `key`, exactly as given by the `hashfn` of the map
+ * @note Implementations that do not hash keys simply ignore `hash`
+ */
+entry_t *map_upsert_hashed(map_t *map, void *key, uint64_t hash, int *inserted);
+
 /**
  * @brief Attempt to remove an entry from the map by its key
  * @param map: pointer to a map
@@ -88,6 +136,13 @@ entry_t *map_insert(map_t *map, void *key, void *val);
  */
 entry_t *map_remove(map_t *map, void *key);
 
+/**
+ * @brief Same as `map_remove`, but with the hash of the key computed by the caller
+ * @param hash: the hash of `key`, exactly as given by the `hashfn` of the map
+ * @note Implementations that do not hash keys simply ignore `hash`
+ */
+entry_t *map_remove_hashed(map_t *map, void *key, uint64_t hash);
+
 /**
  * @brief Attempt to get the entry associated with the given key. This function also serves as the de-facto
  * utility to check for the presense of a key in the map
@@ -102,6 +157,20 @@ entry_t *map_remove(map_t *map, void *key);
  */
 entry_t *map_get(map_t *map, void *key);
 
+/**
+ * @brief Same as `map_get`, but with the hash of the key computed by the caller
+ *
+ * @param map: pointer to a map
+ * @param key: pointer to key
+ * @param hash: the hash of `key`, exactly as given by the `hashfn` of the map
+ *
+ * @returns The entry associated with key if is present in the map, otherwise NULL
+ *
+ * @note This lets a key that is looked up in several maps with the same hash function be hashed only once.
+ * Implementations that do not hash keys simply ignore `hash`.
+ */
+entry_t *map_get_hashed(map_t *map, void *key, uint64_t hash);
+
 /**
  * Type of map iterator. `map_iter_t` is an alias for `struct map_iter`
  */
@@ -27,6 +27,16 @@ typedef struct set set_t;
  */
 set_t *set_create(cmp_fn cmpfn);
 
+/**
+ * @brief Hint that about `n` more elements will be added to the set, so that the implementation may allocate room
+ * for them at once rather than one by one.
+ * @param set: pointer to a set
+ * @param n: expected number of elements to be added
+ * @returns 0 on success, otherwise a negative error code
+ * @note the set still accepts any number of elements, regardless of the hint
+ */
+int set_reserve(set_t *set, size_t n);
+
 /**
  * @brief Destroys the given set. Optional functionality to also destroy values
  * @param set: pointer to a set
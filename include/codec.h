@@ -0,0 +1,76 @@
+/**
+ * @brief Compression of arrays of small unsigned integers, such as the gaps between sorted document ids
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+/**
+ * Available integer codecs
+ *
+ * - `CODEC_VARINT`: variable-byte (LEB128) encoding, 7 bits of each byte hold data
+ * - `CODEC_SIMPLE8B`: Simple-8b, packs as many values as fit into each 64-bit word with a 4-bit selector
+ * - `CODEC_BITPACK`: every value of the array is packed with the bit width of the largest value
+ */
+typedef enum codec {
+    CODEC_VARINT = 0,
+    CODEC_SIMPLE8B,
+    CODEC_BITPACK,
+} codec_t;
+
+/**
+ * @brief Get the name of a codec, e.g. "varint"
+ */
+const char *codec_name(codec_t codec);
+
+/**
+ * @brief Look up a codec by its name
+ * @param name: null-terminated string
+ * @param codec: pointer to codec, set if the name is recognized
+ * @returns 0 if the name is recognized, otherwise -1
+ */
+int codec_from_name(const char *name, codec_t *codec);
+
+/**
+ * @brief Upper bound on the number of bytes needed to encode `n` values with any codec
+ */
+static inline size_t codec_max_bytes(size_t n) {
+    return 8 * n + 8;
+}
+
+/**
+ * @brief Encode an array of values
+ * @param codec: codec to use
+ * @param values: array of `n` values
+ * @param n: number of values
+ * @param out: output buffer of at least `codec_max_bytes(n)` bytes
+ * @returns number of bytes written to `out`
+ */
+size_t codec_encode(codec_t codec, const uint32_t *values, size_t n, uint8_t *out);
+
+/**
+ * @brief Decode an array of values encoded with `codec_encode`
+ * @param codec: codec the values were encoded with
+ * @param in: encoded bytes
+ * @param n: number of values to decode. Must be the same as when encoding.
+ * @param values: output array of at least `n` values
+ * @returns number of bytes read from `in`
+ */
+size_t codec_decode(codec_t codec, const uint8_t *in, size_t n, uint32_t *values);
+
+/**
+ * @brief Check that `n` values can be decoded with `codec_decode` from encoded bytes that may be corrupt
+ * @param codec: codec the values were encoded with
+ * @param in: encoded bytes
+ * @param avail: number of bytes at `in`
+ * @param n: number of values to decode, at least 1
+ * @returns number of bytes `codec_decode` would read from `in`, or 0 if it would read past `avail` bytes, or the
+ * bytes are not a valid encoding of `n` values
+ */
+size_t codec_check(codec_t codec, const uint8_t *in, size_t avail, size_t n);
+
+
+#endif /* CODEC_H */
@@ -6,6 +6,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stddef.h> // for size_t
 #include <stdint.h>
 
 #include "defs.h"
@@ -40,6 +41,33 @@ int compare_pointers(const void *a, const void *b);
  */
 uint64_t hash_string_fnv1a64(const void *str);
 
+/**
+ * @brief wyhash-style hash algorithm for strings, 64-bit
+ * @param str: null-terminated string
+ * @returns The 64 bit hash of `str`
+ * @note Reads the string 8 bytes at a time (after finding its length), and mixes them with 64x64 -> 128 bit
+ * multiplications. This is several times faster than `hash_string_fnv1a64` on all but the shortest strings, and
+ * mixes all bits of the hash well, so that both the low and the high bits can be used to select a bucket.
+ * See [wyhash](https://github.com/wangyi-fudan/wyhash).
+ */
+uint64_t hash_string_wyhash64(const void *str);
+
+/**
+ * @brief The hash of `hash_string_wyhash64` over an arbitrary array of bytes
+ * @param data: pointer to the bytes
+ * @param len: number of bytes
+ * @returns The 64 bit hash of the `len` bytes at `data`. For a string, this is the same as `hash_string_wyhash64`.
+ */
+uint64_t hash_bytes_wyhash64(const void *data, size_t len);
+
+/**
+ * @brief Write a checksum into a file whose header holds a `hash_bytes_wyhash64` of the rest of the file
+ * @param path: path of the file, which is complete except for the checksum
+ * @param offset: byte offset of the 64-bit checksum in the file. Everything after it is hashed.
+ * @returns 0 on success, otherwise -1. On success, the file has been synced to disk.
+ */
+int file_write_checksum(const char *path, size_t offset);
+
 /**
  * @param c: character-type integer
  * @returns a positive integer if character is a newline, otherwise 0
@@ -0,0 +1,114 @@
+/**
+ * @brief Sets of document ids as sorted arrays, and the set algebra used to evaluate queries
+ *
+ * @details
+ * The kernels take plain sorted arrays without duplicates. Each picks a linear merge when both inputs are of
+ * similar size, and galloping (exponential) search through the larger input when one is much smaller, so
+ * the cost is roughly proportional to the smaller input.
+ *
+ * The linear merges have SIMD kernels (SSE4.2 and AVX2 on x86) next to the scalar ones. The widest kernel
+ * the cpu supports is picked at runtime the first time a set operation is run.
+ */
+
+#ifndef DOCSET_H
+#define DOCSET_H
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+/**
+ * Galloping is used once one input is at least this many times larger than the other
+ */
+#define DOCSET_GALLOP_RATIO 16
+
+/**
+ * Implementations of the merge kernels, in order of preference
+ */
+typedef enum docset_kernel {
+    DOCSET_KERNEL_SCALAR,
+    DOCSET_KERNEL_SSE42,
+    DOCSET_KERNEL_AVX2,
+    DOCSET_N_KERNELS,
+} docset_kernel_t;
+
+/**
+ * Sorted array of document ids. `docset_t` is an alias for `struct docset`
+ */
+typedef struct docset {
+    uint32_t *doc_ids;
+    size_t length;
+} docset_t;
+
+/**
+ * @brief Create an empty docset with room for `capacity` ids
+ * @returns A pointer to the newly allocated docset, or NULL on failure
+ */
+docset_t *docset_create(size_t capacity);
+
+/**
+ * @brief Create a copy of a docset, with room for exactly its ids
+ * @returns A pointer to the newly allocated docset, or NULL on failure
+ */
+docset_t *docset_copy(const docset_t *docset);
+
+/**
+ * @brief Destroy a docset
+ * @note this is safe to call with `docset` == NULL, where it simply returns
+ */
+void docset_destroy(docset_t *docset);
+
+/**
+ * @brief Find the first position at or after `from` that holds an id >= `target`, by galloping forward
+ * @param doc_ids: sorted array
+ * @param length: length of the array
+ * @param from: position to start at
+ * @param target: id to search for
+ * @returns the position, or `length` if all ids from `from` are less than `target`
+ */
+size_t docset_gallop(const uint32_t *doc_ids, size_t length, size_t from, uint32_t target);
+
+/**
+ * @brief Intersection of two sorted arrays
+ * @param out: output array with room for at least min(`a_len`, `b_len`) ids. May not overlap the inputs.
+ * @returns number of ids written to `out`
+ */
+size_t docset_intersect(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out);
+
+/**
+ * @brief Union of two sorted arrays
+ * @param out: output array with room for at least `a_len` + `b_len` ids. May not overlap the inputs.
+ * @returns number of ids written to `out`
+ */
+size_t docset_union(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out);
+
+/**
+ * @brief Difference of two sorted arrays, i.e. the ids of `a` that are not in `b`
+ * @param out: output array with room for at least `a_len` ids. May not overlap the inputs.
+ * @returns number of ids written to `out`
+ */
+size_t docset_difference(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out);
+
+/**
+ * @brief Check whether a kernel is compiled in and supported by the cpu
+ * @returns non-zero if `kernel` can be used
+ */
+int docset_kernel_supported(docset_kernel_t kernel);
+
+/**
+ * @brief Get the kernel currently used by the set operations
+ */
+docset_kernel_t docset_kernel(void);
+
+/**
+ * @brief Use `kernel` for all following set operations, in place of the one picked at runtime
+ * @returns 0 on success, or -1 if the kernel is not supported
+ * @note intended for benchmarks and testing. Should not be called while set operations are running.
+ */
+int docset_use_kernel(docset_kernel_t kernel);
+
+/**
+ * @brief Get the name of a kernel, e.g. "avx2"
+ */
+const char *docset_kernel_name(docset_kernel_t kernel);
+
+#endif /* DOCSET_H */
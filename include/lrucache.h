@@ -0,0 +1,68 @@
+/**
+ * @brief Least-recently-used cache from string keys to values, bounded by a memory budget
+ *
+ * @details
+ * Each value is inserted along with the number of bytes it accounts for. Once the total exceeds the budget,
+ * the values that were used the longest ago are evicted and freed. Both lookups and insertions count as a use.
+ */
+
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <stddef.h> // for size_t
+
+#include "defs.h"
+
+/**
+ * Type of cache. `lru_cache_t` is an alias for `struct lru_cache`
+ */
+typedef struct lru_cache lru_cache_t;
+
+/**
+ * @brief Create a new, empty cache
+ * @param budget: maximum number of bytes of the values held by the cache
+ * @param val_freefn: nullable. If present, called on values as they are evicted
+ * @returns A pointer to the newly allocated cache, or NULL on failure
+ */
+lru_cache_t *lru_create(size_t budget, free_fn val_freefn);
+
+/**
+ * @brief Destroy a cache, freeing all values
+ * @note this is safe to call with `cache` == NULL, where it simply returns
+ */
+void lru_destroy(lru_cache_t *cache);
+
+/**
+ * @brief Get the value of a key, and mark it as the most recently used
+ * @returns the value, borrowed from the cache, or NULL if the key is not present
+ * @warning the value may be evicted by any following insertion
+ */
+void *lru_get(lru_cache_t *cache, const char *key);
+
+/**
+ * @brief Insert a value, replacing any value already present for the key. Values that were used the longest
+ * ago are evicted until the new value fits within the budget.
+ * @param key: copied by the cache
+ * @param val: owned by the cache on success
+ * @param n_bytes: number of bytes the value accounts for
+ * @returns 0 on success, or -1 if the value is larger than the whole budget or memory allocation failed. The
+ * value is then left to the caller.
+ */
+int lru_put(lru_cache_t *cache, const char *key, void *val, size_t n_bytes);
+
+/**
+ * @brief Evict and free all values
+ */
+void lru_clear(lru_cache_t *cache);
+
+/**
+ * @brief Get the number of values in a cache
+ */
+size_t lru_length(lru_cache_t *cache);
+
+/**
+ * @brief Get the total number of bytes accounted for by the values in a cache, including the keys
+ */
+size_t lru_bytes(lru_cache_t *cache);
+
+#endif /* LRUCACHE_H */
@@ -0,0 +1,117 @@
+/**
+ * @brief Build manifest of the documents of an index, used to rebuild it without reading unchanged files again
+ *
+ * @details
+ * For each file the manifest keeps its size, modification time and a hash of its contents, along with the term
+ * frequencies of the document. When the index is rebuilt, files whose size and modification time are unchanged are
+ * neither read nor tokenized, and are indexed from the term frequencies in the manifest. Other files are read and
+ * hashed, and only tokenized again if their contents have changed. Files that no longer exist are removed from the
+ * manifest with `manifest_prune`.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdio.h>
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+#include "list.h"
+
+/**
+ * Type of manifest. `manifest_t` is an alias for `struct manifest`
+ */
+typedef struct manifest manifest_t;
+
+/**
+ * A document of the manifest, see `manifest_update`
+ */
+typedef struct manifest_doc {
+    char *path;
+    uint64_t size;      // size of the file, in bytes
+    int64_t mtime_ns;   // last modification time of the file, in nanoseconds since the epoch
+    uint64_t hash;      // `hash_bytes_wyhash64` of the contents of the file
+    uint32_t n_terms;   // number of distinct terms in the document
+    const char **terms; // the distinct terms, in no particular order. Shared by all documents of the manifest.
+    uint32_t *counts;   // number of occurrences of each term
+    int seen;           // set once the document has been updated, see `manifest_prune`
+} manifest_doc_t;
+
+/**
+ * What `manifest_update` found the files to be, since the manifest was loaded or created
+ */
+typedef struct manifest_stats {
+    size_t unchanged; // same size and modification time, so the file was not read
+    size_t touched;   // modified, but with the same contents, so the file was read but not tokenized
+    size_t modified;  // modified, and tokenized again
+    size_t added;     // not in the manifest, and tokenized
+    size_t removed;   // in the manifest, but no longer found, see `manifest_prune`
+} manifest_stats_t;
+
+/**
+ * @brief Type of tokenize function. Reads the terms of a document from `f` into `terms`, as they appear in it.
+ * @returns 0 on success, otherwise a negative error code
+ */
+typedef int (*manifest_tokenize_fn)(FILE *f, list_t *terms);
+
+/**
+ * @brief Create a new, empty manifest
+ * @returns A pointer to the newly allocated manifest, or NULL on failure
+ */
+manifest_t *manifest_create(void);
+
+/**
+ * @brief Load a manifest saved with `manifest_save`
+ * @param path: path of the file to load
+ * @returns the loaded manifest, or NULL if the file could not be read, has another format version, or has a
+ * checksum that does not match its contents
+ */
+manifest_t *manifest_load(const char *path);
+
+/**
+ * @brief Save a manifest to a file. An existing file is replaced.
+ * @param manifest: pointer to manifest
+ * @param path: path of the file to write. The file is written next to `path` and renamed to it once complete.
+ * @returns 0 on success, otherwise a negative error code
+ */
+int manifest_save(manifest_t *manifest, const char *path);
+
+/**
+ * @brief Destroy a manifest and all of its documents
+ * @note this is safe to call with `manifest` == NULL, where it simply returns
+ */
+void manifest_destroy(manifest_t *manifest);
+
+/**
+ * @brief Get the number of documents in a manifest
+ */
+size_t manifest_length(manifest_t *manifest);
+
+/**
+ * @brief Bring the document of a file up to date, and mark it as seen
+ *
+ * @param manifest: pointer to manifest
+ * @param path: path of the file. Copied by the manifest if it is new.
+ * @param tokenize: called to read the terms of the file, if its contents are new
+ * @returns the document, owned by the manifest, or NULL if the file could not be read or tokenized
+ *
+ * @note The file is trusted to be unchanged if its size and modification time are, and is otherwise read and
+ * hashed. Safe to call from several threads at once. The returned document stays valid until `manifest_prune` or
+ * `manifest_destroy`.
+ */
+const manifest_doc_t *manifest_update(manifest_t *manifest, const char *path, manifest_tokenize_fn tokenize);
+
+/**
+ * @brief Remove every document that has not been updated since the manifest was loaded, i.e. the files that were
+ * deleted or are no longer included
+ * @returns the number of removed documents
+ */
+size_t manifest_prune(manifest_t *manifest);
+
+/**
+ * @brief Get what `manifest_update` and `manifest_prune` found the files to be
+ */
+void manifest_stats(manifest_t *manifest, manifest_stats_t *stats);
+
+
+#endif /* MANIFEST_H */
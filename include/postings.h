@@ -0,0 +1,280 @@
+/**
+ * @brief Compressed posting lists of the inverted index, sorted by document id
+ *
+ * @details
+ * Documents are appended in increasing order of document id. They are first collected in an uncompressed
+ * tail, which is compressed into a block once it holds `POSTINGS_BLOCK_LEN` documents. A block stores the
+ * gaps between consecutive ids followed by the term counts, both encoded with the codec of the list, and is
+ * described by a small header with the last id of the block (for skipping) and its position in the data.
+ *
+ * Once the index is built the list is frozen, which compresses whatever is left in the tail as a final
+ * partial block and trims the allocations to their exact size. Queries decode the list one block at a time,
+ * either all at once or through a cursor that moves forward over the documents of the list.
+ */
+
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+#include <stdio.h>  // for FILE
+
+#include "codec.h"
+
+/* number of documents in each compressed block (the last block of a list may hold fewer) */
+#define POSTINGS_BLOCK_LEN 128
+
+/* document id of a cursor that has moved past the last document of its list */
+#define POSTINGS_END UINT32_MAX
+
+/**
+ * Type of posting list. `postings_t` is an alias for `struct postings`
+ */
+typedef struct postings postings_t;
+
+/**
+ * Type of a pack of read-only posting lists, see `postings_pack`. `postings_pack_t` is an alias for
+ * `struct postings_pack`
+ */
+typedef struct postings_pack postings_pack_t;
+
+/**
+ * Cursor over the documents of a posting list, holding the decoded block of its current document. Counts are
+ * only decoded if asked for. Initialize with `postings_cursor_init`. No cleanup is needed.
+ */
+typedef struct postings_cursor {
+    postings_t *postings;
+    uint32_t doc_id;  // current document, or POSTINGS_END once the cursor has moved past the last one
+    size_t block_i;   // index of the decoded block
+    size_t block_len; // number of documents in the decoded block
+    size_t pos;       // position of the current document in the decoded block
+    size_t ids_bytes; // size of the encoded ids of the block, where its counts start
+    int counts_decoded;
+    uint32_t doc_ids[POSTINGS_BLOCK_LEN];
+    uint32_t counts[POSTINGS_BLOCK_LEN];
+} postings_cursor_t;
+
+/**
+ * @brief Create a new, empty posting list
+ * @param codec: codec used to compress the blocks of the list
+ * @returns A pointer to the newly allocated posting list, or NULL on failure
+ */
+postings_t *postings_create(codec_t codec);
+
+/**
+ * @brief Destroy a posting list
+ * @param postings: pointer to posting list
+ * @note this is safe to call with `postings` == NULL, where it simply returns
+ */
+void postings_destroy(postings_t *postings);
+
+/**
+ * @brief Get the number of documents in a posting list
+ * @param postings: pointer to posting list
+ */
+size_t postings_length(postings_t *postings);
+
+/**
+ * @brief Append a document to the end of a posting list
+ * @param postings: pointer to posting list
+ * @param doc_id: id of the document. Must be greater than the id of the last document in the list.
+ * @param count: number of occurrences of the term in the document. Must be at least 1.
+ * @returns 0 on success, otherwise a negative error code
+ * @note appending to a frozen posting list is allowed. A partial last block is then decompressed again.
+ * @note on failure, the document is not added to the list
+ */
+int postings_append(postings_t *postings, uint32_t doc_id, uint32_t count);
+
+/**
+ * @brief Remove the last document of a posting list, undoing `postings_append`
+ * @param postings: pointer to posting list
+ * @param doc_id: id of the document to remove. Must be the last document in the list.
+ * @returns 0 on success, otherwise a negative error code if `doc_id` is not the last document of the list
+ * @note cannot fail right after `postings_append` of `doc_id`, as the block it was added to has room in memory
+ */
+int postings_remove_last(postings_t *postings, uint32_t doc_id);
+
+/**
+ * @brief Append all documents of `src` to `dst`, adding `doc_offset` to their ids
+ * @param dst: pointer to posting list to append to
+ * @param src: pointer to posting list to append from. Left unmodified.
+ * @param doc_offset: offset added to all document ids of `src`. The first resulting id must be greater than
+ * the last id in `dst`.
+ * @returns 0 on success, otherwise a negative error code
+ */
+int postings_append_all(postings_t *dst, postings_t *src, uint32_t doc_offset);
+
+/**
+ * @brief Add an offset to the id of every document in a posting list
+ * @param postings: pointer to posting list
+ * @param doc_offset: offset to add
+ * @note compressed blocks store the gaps between ids, so this only touches the block headers
+ */
+void postings_offset(postings_t *postings, uint32_t doc_offset);
+
+/**
+ * @brief Freeze a posting list once no more documents will be added, compressing any remaining documents
+ * and trimming it to its exact size
+ * @param postings: pointer to posting list
+ */
+void postings_freeze(postings_t *postings);
+
+/**
+ * @brief Pack frozen posting lists into a few contiguous arrays: the lists themselves, the block headers of all
+ * lists, and the compressed data of all lists, each in the order of `lists`
+ * @param lists: array of `n_lists` frozen posting lists. Left unmodified, and still owned by the caller.
+ * @param n_lists: number of lists
+ * @returns A pointer to the newly allocated pack, or NULL on failure
+ * @note the packed lists are read-only copies. They can be decoded and iterated like any other posting list, but
+ * must not be appended to, frozen, offset or destroyed by themselves.
+ */
+postings_pack_t *postings_pack(postings_t **lists, size_t n_lists);
+
+/**
+ * @brief Get a packed posting list
+ * @param pack: pointer to pack
+ * @param i: index of the list, less than the number of lists in the pack
+ * @returns pointer to the list, which is valid until `postings_pack_destroy`
+ */
+postings_t *postings_pack_get(postings_pack_t *pack, size_t i);
+
+/**
+ * @brief Get the number of bytes `postings_pack_write` writes for a pack, which is a multiple of 8
+ * @param pack: pointer to pack
+ */
+size_t postings_pack_file_size(postings_pack_t *pack);
+
+/**
+ * @brief Write a pack to a file, so that it can be loaded again with `postings_pack_load`
+ * @param pack: pointer to pack
+ * @param f: file to write to, at its current position
+ * @returns 0 on success, otherwise a negative error code
+ * @note the pack is written in the byte order of this machine
+ */
+int postings_pack_write(postings_pack_t *pack, FILE *f);
+
+/**
+ * @brief Load a pack from memory holding what `postings_pack_write` wrote, typically a memory mapped file
+ * @param mem: pointer to the written pack, aligned to 8 bytes
+ * @param size: number of bytes at `mem`, as from `postings_pack_file_size`
+ * @param codec: codec the lists were compressed with
+ * @returns A pointer to the new pack, or NULL if the memory does not hold a valid pack or allocation failed
+ * @note the block headers and data of the lists are used in place, so `mem` must stay valid and unmodified until
+ * the pack is destroyed. Only the bounds of each list are checked, not its blocks, so decoding the lists of a
+ * pack that was modified after it was written can read outside of `mem`, unless it passes `postings_pack_verify`.
+ */
+postings_pack_t *postings_pack_load(const void *mem, size_t size, codec_t codec);
+
+/**
+ * @brief Check every block of every list of a loaded pack, so that decoding them never reads outside of the pack
+ * @param pack: pointer to pack, from `postings_pack_load`
+ * @param n_docs: number of documents. Every id in the lists must be less than it.
+ * @returns 0 if the blocks lie within the data of their list, can be decoded, and hold increasing ids that match
+ * their block headers and are less than `n_docs`, otherwise -1
+ * @note every block is decoded, so this reads all of the pack
+ */
+int postings_pack_verify(postings_pack_t *pack, uint32_t n_docs);
+
+/**
+ * @brief Get the number of posting lists in a pack
+ */
+size_t postings_pack_length(postings_pack_t *pack);
+
+/**
+ * @brief Destroy a pack, including all of its posting lists
+ * @param pack: pointer to pack
+ * @note this is safe to call with `pack` == NULL, where it simply returns
+ */
+void postings_pack_destroy(postings_pack_t *pack);
+
+/**
+ * @brief Get the number of blocks in a posting list. Uncompressed documents that are not yet frozen count
+ * as a final block.
+ * @param postings: pointer to posting list
+ */
+size_t postings_n_blocks(postings_t *postings);
+
+/**
+ * @brief Get the id of the last document in a block
+ * @param postings: pointer to posting list
+ * @param block_i: index of block, less than `postings_n_blocks`
+ */
+uint32_t postings_block_last(postings_t *postings, size_t block_i);
+
+/**
+ * @brief Decode a block of a posting list
+ * @param postings: pointer to posting list
+ * @param block_i: index of block, less than `postings_n_blocks`
+ * @param doc_ids: output array of at least `POSTINGS_BLOCK_LEN` ids
+ * @param counts: nullable. If present, output array of at least `POSTINGS_BLOCK_LEN` counts
+ * @returns the number of documents in the block
+ */
+size_t postings_decode_block(postings_t *postings, size_t block_i, uint32_t *doc_ids, uint32_t *counts);
+
+/**
+ * @brief Intersect a sorted array of document ids with a posting list
+ * @param postings: pointer to posting list
+ * @param doc_ids: sorted array of ids
+ * @param n: length of `doc_ids`
+ * @param out: output array with room for at least `n` ids. May not overlap `doc_ids`.
+ * @returns number of ids written to `out`
+ * @note blocks that hold none of the ids are skipped using their headers, without being decoded. The cost is
+ * thus roughly proportional to `n` when the posting list is much longer.
+ */
+size_t postings_intersect(postings_t *postings, const uint32_t *doc_ids, size_t n, uint32_t *out);
+
+/**
+ * @brief Remove the documents of a posting list from a sorted array of document ids
+ * @param postings: pointer to posting list
+ * @param doc_ids: sorted array of ids
+ * @param n: length of `doc_ids`
+ * @param out: output array with room for at least `n` ids. May not overlap `doc_ids`.
+ * @returns number of ids written to `out`
+ * @note skips blocks in the same manner as `postings_intersect`
+ */
+size_t postings_subtract(postings_t *postings, const uint32_t *doc_ids, size_t n, uint32_t *out);
+
+/**
+ * @brief Place a cursor at the first document of a posting list
+ * @param cursor: pointer to cursor
+ * @param postings: pointer to posting list, which must not be modified while the cursor is in use
+ */
+void postings_cursor_init(postings_cursor_t *cursor, postings_t *postings);
+
+/**
+ * @brief Move a cursor to the next document
+ * @param cursor: pointer to cursor
+ * @returns the id of the new current document, or `POSTINGS_END` if there are no more
+ */
+uint32_t postings_cursor_next(postings_cursor_t *cursor);
+
+/**
+ * @brief Move a cursor forward to the first document with an id >= `target`. Does nothing if the current
+ * document already is.
+ * @param cursor: pointer to cursor
+ * @param target: document id to move to
+ * @returns the id of the new current document, or `POSTINGS_END` if there are no more
+ * @note blocks before the one holding `target` are skipped using their headers, without being decoded
+ */
+uint32_t postings_cursor_advance(postings_cursor_t *cursor, uint32_t target);
+
+/**
+ * @brief Get the number of occurrences of the term in the current document of a cursor
+ * @param cursor: pointer to cursor, which must not be at the end
+ */
+uint32_t postings_cursor_count(postings_cursor_t *cursor);
+
+/**
+ * @brief Get the number of bytes used to store the documents of a posting list, including block headers
+ * @param postings: pointer to posting list
+ */
+size_t postings_size_bytes(postings_t *postings);
+
+/**
+ * @brief Get the number of bytes the documents of a posting list would take up as plain 32-bit ids and counts
+ * @param postings: pointer to posting list
+ */
+size_t postings_raw_bytes(postings_t *postings);
+
+
+#endif /* POSTINGS_H */
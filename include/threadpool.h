@@ -0,0 +1,56 @@
+/**
+ * @brief Fixed-size pool of worker threads executing submitted tasks in FIFO order
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h> // for size_t
+
+/**
+ * Type of thread pool. `threadpool_t` is an alias for `struct threadpool`
+ */
+typedef struct threadpool threadpool_t;
+
+/**
+ * @brief Type of task function. Called on a worker thread with the argument given at submission.
+ */
+typedef void (*task_fn)(void *arg);
+
+/**
+ * @brief Create a thread pool and start its worker threads
+ * @param n_threads: number of worker threads. Must be at least 1.
+ * @returns A pointer to the newly created pool, or NULL on failure
+ */
+threadpool_t *threadpool_create(size_t n_threads);
+
+/**
+ * @brief Wait for all submitted tasks to complete, then stop and join the workers and free the pool.
+ * @param pool: pointer to pool
+ * @note this is safe to call with `pool` == NULL, where it simply returns
+ */
+void threadpool_destroy(threadpool_t *pool);
+
+/**
+ * @brief Get the number of worker threads in a pool
+ * @param pool: pointer to pool
+ */
+size_t threadpool_size(threadpool_t *pool);
+
+/**
+ * @brief Submit a task to the pool. The task is run on the first available worker.
+ * @param pool: pointer to pool
+ * @param fn: task function
+ * @param arg: nullable. Passed on to `fn`, and still owned by the caller.
+ * @returns 0 on success, otherwise a negative error code
+ */
+int threadpool_submit(threadpool_t *pool, task_fn fn, void *arg);
+
+/**
+ * @brief Block until every task submitted so far has completed
+ * @param pool: pointer to pool
+ */
+void threadpool_wait(threadpool_t *pool);
+
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,141 @@
+/**
+ * @implements heap.h
+ *
+ * @brief Heap implementation as an implicit binary tree in a dynamic array, where the children of the node at
+ * index i are at 2i + 1 and 2i + 2.
+ */
+
+#include <stdlib.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "heap.h"
+
+#define HEAP_INITIAL_CAPACITY 16
+
+struct heap {
+    void **elems;
+    size_t length;
+    size_t capacity;
+    cmp_fn cmpfn;
+};
+
+heap_t *heap_create(cmp_fn cmpfn) {
+    heap_t *heap = malloc(sizeof(heap_t));
+    if (!heap) {
+        pr_error("Cannot allocate memory\n");
+        return NULL;
+    }
+
+    heap->elems = malloc(HEAP_INITIAL_CAPACITY * sizeof(void *));
+    if (!heap->elems) {
+        pr_error("Cannot allocate memory\n");
+        free(heap);
+        return NULL;
+    }
+    heap->length = 0;
+    heap->capacity = HEAP_INITIAL_CAPACITY;
+    heap->cmpfn = cmpfn;
+
+    return heap;
+}
+
+void heap_destroy(heap_t *heap, free_fn elem_freefn) {
+    if (!heap) {
+        return;
+    }
+    if (elem_freefn) {
+        for (size_t i = 0; i < heap->length; i++) {
+            elem_freefn(heap->elems[i]);
+        }
+    }
+    free(heap->elems);
+    free(heap);
+}
+
+size_t heap_length(heap_t *heap) {
+    return heap->length;
+}
+
+/* move the element at index i up until its parent is lower */
+static void sift_up(heap_t *heap, size_t i) {
+    void *elem = heap->elems[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap->cmpfn(elem, heap->elems[parent]) >= 0) {
+            break;
+        }
+        heap->elems[i] = heap->elems[parent];
+        i = parent;
+    }
+    heap->elems[i] = elem;
+}
+
+/* move the element at index i down until both its children are higher */
+static void sift_down(heap_t *heap, size_t i) {
+    void *elem = heap->elems[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap->length) {
+            break;
+        }
+        if (child + 1 < heap->length && heap->cmpfn(heap->elems[child + 1], heap->elems[child]) < 0) {
+            child++;
+        }
+        if (heap->cmpfn(heap->elems[child], elem) >= 0) {
+            break;
+        }
+        heap->elems[i] = heap->elems[child];
+        i = child;
+    }
+    heap->elems[i] = elem;
+}
+
+int heap_push(heap_t *heap, void *elem) {
+    if (heap->length == heap->capacity) {
+        void **elems = realloc(heap->elems, 2 * heap->capacity * sizeof(void *));
+        if (!elems) {
+            pr_error("Cannot allocate memory\n");
+            return -1;
+        }
+        heap->elems = elems;
+        heap->capacity *= 2;
+    }
+
+    heap->elems[heap->length++] = elem;
+    sift_up(heap, heap->length - 1);
+
+    return 0;
+}
+
+void *heap_peek(heap_t *heap) {
+    return heap->length ? heap->elems[0] : NULL;
+}
+
+void *heap_pop(heap_t *heap) {
+    if (heap->length == 0) {
+        PANIC("Attempted to pop from an empty heap\n");
+    }
+
+    void *top = heap->elems[0];
+    heap->elems[0] = heap->elems[--heap->length];
+    if (heap->length) {
+        sift_down(heap, 0);
+    }
+
+    return top;
+}
+
+void *heap_replace_top(heap_t *heap, void *elem) {
+    if (heap->length == 0) {
+        PANIC("Attempted to replace the top of an empty heap\n");
+    }
+
+    void *top = heap->elems[0];
+    heap->elems[0] = elem;
+    sift_down(heap, 0);
+
+    return top;
+}
@@ -8,6 +8,7 @@
  * @brief doubly linked list implementation with merge sort
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "printing.h"
@@ -27,6 +28,9 @@ struct list {
     lnode_t *rightmost;
     size_t length;
     cmp_fn cmpfn;
+    lnode_t *pool;     // nodes allocated up front by list_reserve, or NULL
+    size_t pool_used;  // nodes of the pool handed out so far. Nodes are never returned to the pool
+    size_t pool_size;
 };
 
 // struct list_iter {
@@ -35,8 +39,14 @@ struct list {
 // };
 
 
-static lnode_t *newnode(void *item) {
-    lnode_t *node = malloc(sizeof(lnode_t));
+/* take a node from the reserved pool while it lasts, otherwise allocate it on its own */
+static lnode_t *newnode(list_t *list, void *item) {
+    lnode_t *node;
+    if (list->pool_used < list->pool_size) {
+        node = &list->pool[list->pool_used++];
+    } else {
+        node = malloc(sizeof(lnode_t));
+    }
     if (!node) {
         pr_error("Cannot allocate memory\n");
         return NULL;
@@ -48,6 +58,18 @@ static lnode_t *newnode(void *item) {
     return node;
 }
 
+/**
+ * free a node, unless it is part of the pool (which is freed along with the list). The addresses are compared as
+ * integers, as comparing pointers into different allocations is undefined. A node below the pool wraps around to a
+ * large offset, and with no pool the size is 0, so both are freed.
+ */
+static inline void freenode(list_t *list, lnode_t *node) {
+    uintptr_t offset = (uintptr_t) node - (uintptr_t) list->pool;
+    if (offset >= list->pool_size * sizeof(lnode_t)) {
+        free(node);
+    }
+}
+
 list_t *list_create(cmp_fn cmpfn) {
     list_t *list = malloc(sizeof(list_t));
     if (!list) {
@@ -59,10 +81,29 @@ list_t *list_create(cmp_fn cmpfn) {
     list->rightmost = NULL;
     list->length = 0;
     list->cmpfn = cmpfn;
+    list->pool = NULL;
+    list->pool_used = 0;
+    list->pool_size = 0;
 
     return list;
 }
 
+int list_reserve(list_t *list, size_t n) {
+    /* only the first reservation gets a pool. Nodes past the pool are allocated one by one as before */
+    if (list->pool != NULL || n == 0) {
+        return 0;
+    }
+
+    list->pool = malloc(n * sizeof(lnode_t));
+    if (!list->pool) {
+        pr_error("Cannot allocate memory\n");
+        return -1;
+    }
+    list->pool_size = n;
+
+    return 0;
+}
+
 void list_destroy(list_t *list, free_fn item_free) {
     if (!list) {
         return;
@@ -72,10 +113,11 @@ void list_destroy(list_t *list, free_fn item_free) {
         if (item_free) {
             item_free(list->leftmost->item);
         }
-        free(list->leftmost);
+        freenode(list, list->leftmost);
         list->leftmost = right;
     }
 
+    free(list->pool);
     free(list);
 }
 
@@ -84,7 +126,7 @@ size_t list_length(list_t *list) {
 }
 
 int list_addfirst(list_t *list, void *item) {
-    lnode_t *node = newnode(item);
+    lnode_t *node = newnode(list, item);
     if (node == NULL) {
         return -1;
     }
@@ -102,7 +144,7 @@ int list_addfirst(list_t *list, void *item) {
 }
 
 int list_addlast(list_t *list, void *item) {
-    lnode_t *node = newnode(item);
+    lnode_t *node = newnode(list, item);
     if (node == NULL) {
         return -1;
     }
@@ -137,7 +179,7 @@ void *list_popfirst(list_t *list) {
     }
 
     list->length--;
-    free(tmp);
+    freenode(list, tmp);
 
     return item;
 }
@@ -159,7 +201,7 @@ void *list_poplast(list_t *list) {
     }
 
     list->length--;
-    free(tmp);
+    freenode(list, tmp);
 
     return item;
 }
@@ -197,7 +239,7 @@ void *list_remove(list_t *list, void *item) {
         node->right->left = node->left;
     }
 
-    free(node);
+    freenode(list, node);
 
     return found;
 }
@@ -4,7 +4,7 @@
  *
  * @implements map.h
  * 
- * @brief Hash map with separate chaining.
+ * @brief Hash map with separate chaining. The map grows incrementally, see REHASH_STEP.
  */
 
 #include <stdint.h>
@@ -17,7 +17,7 @@
 #include "map.h"
 
 
-/* how many buckets each map should start with */
+/* how many buckets each map should start with, unless given a larger capacity */
 #define N_BUCKETS_INITIAL 16
 
 /**
@@ -29,11 +29,22 @@
  */
 #define LF_GROW 0.75
 
+/**
+ * Number of old buckets moved to the new array of buckets by each insertion or removal while the map grows.
+ * Rather than rehashing every node at once when the map grows, the old and the new buckets coexist until all
+ * nodes are moved over, a few buckets at a time. This bounds the time of any single insertion.
+ *
+ * The map grows once the length reaches 3/4 of the capacity, and then has another 3/4 of the old capacity worth
+ * of insertions until it grows again. Any value >= 2 thus moves all nodes before then. 0 rehashes all at once.
+ */
+#define REHASH_STEP 16
+
 
 typedef struct mnode mnode_t;
 struct mnode {
     entry_t *entry;
     mnode_t *overflow; // points to overflow entry if a collision occurs
+    uint64_t hash;     // hash of the key, so that nodes can be moved without hashing the key again
 };
 
 struct map {
@@ -43,6 +54,9 @@ struct map {
     size_t capacity;
     size_t length;
     size_t rehash_threshold;
+    mnode_t **old_buckets;  // buckets that are being moved into `buckets`, or NULL
+    size_t old_capacity;
+    size_t i_next_old;      // old buckets before this one are already moved (and empty)
 };
 
 /**
@@ -84,58 +98,133 @@ static inline mnode_t *map_flatten(map_t *map) {
 }
 
 /**
- * resize the array of buckets and rehash all entries. There is simply no way to do this that isn't O(n), as
- * we must rehash for all nodes.
+ * Move up to `n_buckets` of the old buckets into the new ones, using the cached hash of each node. The old
+ * buckets are freed once the last one is moved.
  */
-static inline int map_resize(map_t *map, size_t new_capacity) {
-    mnode_t **new_buckets = calloc(new_capacity, sizeof(mnode_t *));
-    if (new_buckets == NULL) {
-        return -1;
+static void map_rehash_step(map_t *map, size_t n_buckets) {
+    size_t i_end = map->i_next_old + n_buckets;
+    if (i_end > map->old_capacity) {
+        i_end = map->old_capacity;
     }
 
-    size_t n_i = 0;
-
-    /* iterate over all existing buckets */
-    for (size_t i_old = 0; i_old < map->capacity; i_old++) {
-        mnode_t *node = map->buckets[i_old];
+    for (; map->i_next_old < i_end; map->i_next_old++) {
+        mnode_t *node = map->old_buckets[map->i_next_old];
 
         /* iterate over the node & overflow chain */
         while (node) {
             mnode_t *next = node->overflow; // tmp
-            size_t i_new = map->hashfn(node->entry->key) % new_capacity;
+            size_t i_new = node->hash % map->capacity;
 
-            node->overflow = new_buckets[i_new]; // NULL if no chain
-            new_buckets[i_new] = node;           // set as new head of chain
+            node->overflow = map->buckets[i_new]; // NULL if no chain
+            map->buckets[i_new] = node;           // set as new head of chain
 
             node = next; // increment iter
-            n_i += 1;
         }
+        map->old_buckets[map->i_next_old] = NULL;
     }
 
-    assert(n_i == map->length);
+    if (map->i_next_old == map->old_capacity) {
+        free(map->old_buckets);
+        map->old_buckets = NULL;
+        map->old_capacity = 0;
+        map->i_next_old = 0;
+    }
+}
+
+/**
+ * resize the array of buckets. The nodes are moved to the new buckets by `map_rehash_step`, either right away
+ * or a few buckets at a time by the following insertions and removals (see REHASH_STEP).
+ */
+static inline int map_resize(map_t *map, size_t new_capacity) {
+    mnode_t **new_buckets = calloc(new_capacity, sizeof(mnode_t *));
+    if (new_buckets == NULL) {
+        return -1;
+    }
 
-    /* free old buckets */
-    free(map->buckets);
+    /* finish moving the nodes of any previous resize first */
+    if (map->old_buckets) {
+        map_rehash_step(map, map->old_capacity);
+    }
 
     // pr_info("{ c: %zu, t: %zu }", map->capacity, map->rehash_threshold);
 
+    map->old_buckets = map->buckets;
+    map->old_capacity = map->capacity;
+    map->i_next_old = 0;
+
     map->buckets = new_buckets;
     map->capacity = new_capacity;
     map->rehash_threshold = calc_rehash_threshold(new_capacity);
 
     // pr_info(" -> { c: %zu, t: %zu }\n", map->capacity, map->rehash_threshold);
 
+    if (REHASH_STEP == 0) {
+        map_rehash_step(map, map->old_capacity);
+    }
+
     return 0;
 }
 
+/**
+ * Find the link pointing to the node of `key` in a chain, i.e. the head of the bucket or the overflow pointer of
+ * the previous node
+ * @returns the link, or NULL if the key is not in the chain
+ */
+static inline mnode_t **chain_find(map_t *map, mnode_t **link, void *key, uint64_t hash) {
+    while (*link) {
+        mnode_t *node = *link;
+        if (node->hash == hash && map->cmpfn(key, node->entry->key) == 0) {
+            return link;
+        }
+        link = &node->overflow;
+    }
+
+    return NULL;
+}
+
+/**
+ * Find the link pointing to the node of `key`, in the new buckets or in the old buckets that are not moved yet
+ * @returns the link, or NULL if the key is not present
+ */
+static inline mnode_t **map_find(map_t *map, void *key, uint64_t hash) {
+    mnode_t **link = chain_find(map, &map->buckets[hash % map->capacity], key, hash);
+
+    if (link == NULL && map->old_buckets) {
+        size_t i_old = hash % map->old_capacity;
+        if (i_old >= map->i_next_old) {
+            link = chain_find(map, &map->old_buckets[i_old], key, hash);
+        }
+    }
+
+    return link;
+}
+
+/**
+ * The smallest number of buckets (a power of two, at least N_BUCKETS_INITIAL) that holds `n` entries without
+ * growing
+ */
+static size_t calc_capacity(size_t n) {
+    size_t capacity = N_BUCKETS_INITIAL;
+    while (calc_rehash_threshold(capacity) <= n) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
 map_t *map_create(cmp_fn cmpfn, hash64_fn hashfn) {
+    return map_create_with_capacity(cmpfn, hashfn, 0);
+}
+
+map_t *map_create_with_capacity(cmp_fn cmpfn, hash64_fn hashfn, size_t capacity) {
     map_t *map = malloc(sizeof(map_t));
     if (map == NULL) {
         pr_error("Failed to allocate memory\n");
         return NULL;
     }
 
-    map->buckets = calloc(N_BUCKETS_INITIAL, sizeof(mnode_t *));
+    size_t n_buckets = calc_capacity(capacity);
+    map->buckets = calloc(n_buckets, sizeof(mnode_t *));
     if (map->buckets == NULL) {
         pr_error("Failed to allocate memory\n");
         free(map);
@@ -145,21 +234,39 @@ map_t *map_create(cmp_fn cmpfn, hash64_fn hashfn) {
     map->cmpfn = cmpfn;
     map->hashfn = hashfn;
     map->length = 0;
-    map->capacity = N_BUCKETS_INITIAL;
-    map->rehash_threshold = calc_rehash_threshold(N_BUCKETS_INITIAL);
+    map->capacity = n_buckets;
+    map->rehash_threshold = calc_rehash_threshold(n_buckets);
+    map->old_buckets = NULL;
+    map->old_capacity = 0;
+    map->i_next_old = 0;
 
     return map;
 }
 
-void map_destroy(map_t *map, free_fn key_freefn, free_fn val_freefn) {
-    if (!map) {
-        return;
+int map_reserve(map_t *map, size_t n) {
+    size_t new_capacity = calc_capacity(n);
+    if (new_capacity <= map->capacity) {
+        return 0;
+    }
+
+    if (map_resize(map, new_capacity) != 0) {
+        pr_error("Failed to allocate memory\n");
+        return -1;
     }
+
+    /* the caller is about to add many entries, so the nodes are moved right away rather than by those insertions */
+    map_rehash_step(map, map->old_capacity);
+
+    return 0;
+}
+
+/* free all nodes and entries of an array of buckets */
+static void buckets_destroy(mnode_t **buckets, size_t capacity, free_fn key_freefn, free_fn val_freefn) {
     mnode_t *node;
 
     /* iterate over all buckets */
-    for (size_t i = 0; i < map->capacity; i++) {
-        node = map->buckets[i];
+    for (size_t i = 0; i < capacity; i++) {
+        node = buckets[i];
 
         /* iterate over the node & overflow chain */
         while (node) {
@@ -179,7 +286,17 @@ void map_destroy(map_t *map, free_fn key_freefn, free_fn val_freefn) {
         }
     }
 
-    free(map->buckets);
+    free(buckets);
+}
+
+void map_destroy(map_t *map, free_fn key_freefn, free_fn val_freefn) {
+    if (!map) {
+        return;
+    }
+
+    /* the old buckets that are already moved are empty */
+    buckets_destroy(map->old_buckets, map->old_capacity, key_freefn, val_freefn);
+    buckets_destroy(map->buckets, map->capacity, key_freefn, val_freefn);
     free(map);
 }
 
@@ -187,40 +304,21 @@ size_t map_length(map_t *map) {
     return map->length;
 }
 
-entry_t *map_insert(map_t *map, void *key, void *val) {
-    /* Allocate a new entry to be inserted */
-    entry_t *entry = malloc(sizeof(entry_t));
-    if (!entry) {
-        PANIC("Failed to allocate memory\n");
-    }
-
-    /* initialize the new entry */
-    entry->key = key;
-    entry->val = val;
-
-    size_t bucket_i = map->hashfn(key) % map->capacity;
-    mnode_t *head = map->buckets[bucket_i];
-    mnode_t *curr = head;
-
-    while (curr) {
-        if (map->cmpfn(key, curr->entry->key) == 0) {
-            /* already present, swap entries and return old entry */
-            entry_t *old_entry = curr->entry;
-            curr->entry = entry;
-
-            return old_entry;
-        }
-        curr = curr->overflow;
-    }
-
-    /* Key is not present in the map. Allocate a new node as well. */
+/**
+ * Add a node for `entry`, whose key is not in the map, to the new buckets. Grows the map if needed.
+ */
+static void map_add_node(map_t *map, entry_t *entry, uint64_t hash) {
     mnode_t *new_node = malloc(sizeof(mnode_t));
     if (new_node == NULL) {
         PANIC("Failed to allocate memory\n");
     }
 
+    size_t bucket_i = hash % map->capacity;
+    mnode_t *head = map->buckets[bucket_i];
+
     new_node->entry = entry;
     new_node->overflow = head; // NULL if there was no collission
+    new_node->hash = hash;
 
     map->buckets[bucket_i] = new_node; // set as new head of chain
     map->length++;
@@ -236,31 +334,88 @@ entry_t *map_insert(map_t *map, void *key, void *val) {
             PANIC("Failed to rehash\n");
         }
     }
+}
+
+entry_t *map_insert(map_t *map, void *key, void *val) {
+    return map_insert_hashed(map, key, val, map->hashfn(key));
+}
+
+entry_t *map_insert_hashed(map_t *map, void *key, void *val, uint64_t hash) {
+    /* Allocate a new entry to be inserted */
+    entry_t *entry = malloc(sizeof(entry_t));
+    if (!entry) {
+        PANIC("Failed to allocate memory\n");
+    }
+
+    /* initialize the new entry */
+    entry->key = key;
+    entry->val = val;
+
+    if (map->old_buckets) {
+        map_rehash_step(map, REHASH_STEP);
+    }
+
+    mnode_t **link = map_find(map, key, hash);
+
+    if (link) {
+        /* already present, swap entries and return old entry */
+        entry_t *old_entry = (*link)->entry;
+        (*link)->entry = entry;
+
+        return old_entry;
+    }
+
+    /* Key is not present in the map. Add a node as well. */
+    map_add_node(map, entry, hash);
 
     return NULL;
 }
 
-entry_t *map_remove(map_t *map, void *key) {
-    size_t bucket_i = map->hashfn(key) % map->capacity;
-    mnode_t *node = map->buckets[bucket_i];
+entry_t *map_upsert(map_t *map, void *key, int *inserted) {
+    return map_upsert_hashed(map, key, map->hashfn(key), inserted);
+}
 
-    mnode_t *prev = NULL;
+entry_t *map_upsert_hashed(map_t *map, void *key, uint64_t hash, int *inserted) {
+    if (map->old_buckets) {
+        map_rehash_step(map, REHASH_STEP);
+    }
+
+    mnode_t **link = map_find(map, key, hash);
+    *inserted = (link == NULL);
 
-    while (node && (map->cmpfn(node->entry->key, key) != 0)) {
-        prev = node;
-        node = node->overflow;
+    if (link) {
+        return (*link)->entry;
     }
 
-    if (!node) {
-        return NULL;
+    entry_t *entry = malloc(sizeof(entry_t));
+    if (!entry) {
+        PANIC("Failed to allocate memory\n");
+    }
+    entry->key = key;
+    entry->val = NULL;
+
+    map_add_node(map, entry, hash);
+
+    return entry;
+}
+
+entry_t *map_remove(map_t *map, void *key) {
+    return map_remove_hashed(map, key, map->hashfn(key));
+}
+
+entry_t *map_remove_hashed(map_t *map, void *key, uint64_t hash) {
+    if (map->old_buckets) {
+        map_rehash_step(map, REHASH_STEP);
     }
 
-    if (!prev) {
-        map->buckets[bucket_i] = node->overflow; // node is first in a bucket
-    } else {
-        prev->overflow = node->overflow; // fix previous' overflow pointer
+    mnode_t **link = map_find(map, key, hash);
+    if (!link) {
+        return NULL;
     }
 
+    mnode_t *node = *link;
+    *link = node->overflow; // unlink from the bucket or the previous node
+
     entry_t *entry = node->entry;
     free(node);
     map->length--;
@@ -269,23 +424,21 @@ entry_t *map_remove(map_t *map, void *key) {
 }
 
 entry_t *map_get(map_t *map, void *key) {
-    size_t bucket_i = map->hashfn(key) % map->capacity;
-    mnode_t *node = map->buckets[bucket_i];
+    return map_get_hashed(map, key, map->hashfn(key));
+}
 
-    while (node) {
-        if (map->cmpfn(node->entry->key, key) == 0) {
-            return node->entry;
-        }
-        node = node->overflow;
-    }
+entry_t *map_get_hashed(map_t *map, void *key, uint64_t hash) {
+    /* lookups never move nodes, so that several threads may look up keys in a map that is not modified */
+    mnode_t **link = map_find(map, key, hash);
 
-    return NULL;
+    return link ? (*link)->entry : NULL;
 }
 
 
 struct map_iter {
-    mnode_t **buckets;
+    map_t *map;
     mnode_t *next;
+    int in_old_buckets;
     size_t i_curr_bucket;
     size_t n_remaining;
 };
@@ -297,10 +450,12 @@ map_iter_t *map_createiter(map_t *map) {
         return NULL;
     }
 
+    /* the old buckets that are not moved yet are visited first */
+    iter->map = map;
     iter->n_remaining = map->length;
-    iter->buckets = map->buckets;
-    iter->i_curr_bucket = 0;
-    iter->next = map->buckets[0];
+    iter->in_old_buckets = (map->old_buckets != NULL);
+    iter->i_curr_bucket = iter->in_old_buckets ? map->i_next_old : 0;
+    iter->next = iter->in_old_buckets ? map->old_buckets[iter->i_curr_bucket] : map->buckets[0];
 
     return iter;
 }
@@ -322,7 +477,12 @@ entry_t *map_next(map_iter_t *iter) {
 
     while (curr == NULL) {
         iter->i_curr_bucket += 1;
-        curr = iter->buckets[iter->i_curr_bucket];
+
+        if (iter->in_old_buckets && iter->i_curr_bucket == iter->map->old_capacity) {
+            iter->in_old_buckets = 0;
+            iter->i_curr_bucket = 0;
+        }
+        curr = iter->in_old_buckets ? iter->map->old_buckets[iter->i_curr_bucket] : iter->map->buckets[iter->i_curr_bucket];
     }
 
     assert(curr);
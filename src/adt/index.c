@@ -3,8 +3,21 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <stddef.h>
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <malloc.h> // for malloc_trim
+#endif
 
 #include "printing.h"
 #include "index.h"
@@ -12,14 +25,143 @@
 #include "common.h"
 #include "list.h"
 #include "map.h"
-#include "set.h"
+#include "postings.h"
+#include "docset.h"
+#include "lrucache.h"
+#include "heap.h"
+#include "threadpool.h"
+
+/* hvor mange plasser dokumenttabellen starter med */
+#define DOC_TABLE_INITIAL 64
+
+/* termfrekvensene i det midlertidige mappet i index_document lagres direkte som verdier, uten egen allokering */
+#define COUNT_TO_VAL(count) ((void *) (uintptr_t) (count))
+#define VAL_TO_COUNT(val) ((uint32_t) (uintptr_t) (val))
+
+/* den kompakte term-ordboken har minst dobbelt så mange plasser som termer, slik at prøvesekvensene blir korte */
+#define COMPACT_MAX_LOAD 0.5
+
+/* starten av en lagret index (se index_save). Versjonen økes når formatet endres, siden eldre filer da ikke kan leses. */
+#define INDEX_FILE_MAGIC "INDEXER"
+#define INDEX_FILE_VERSION 1
+#define INDEX_FILE_BYTE_ORDER 0x01020304u
+
+/* alle delene av en lagret index fylles ut til et helt antall av 8 bytes, slik at alle arrayene i filen er justert */
+#define FILE_PAD8(n) (((n) + 7) & ~(size_t)7)
+
+/* de øvre grensene for scoren gjøres så mye større enn den høyeste scoren, slik at avrundingsfeil ikke gjør dem for lave */
+#define SCORE_BOUND_SLACK (1.0 + 1e-9)
+
+typedef struct term_entry
+{
+    // verdien til hver term i map. postings er doc id'ene (sortert) og antall forekomster komprimert i blokker.
+    //  idf er IDF-en til termen i BM25, som regnes ut på nytt hver gang indexen fryses. Med beskjæring regnes også
+    //  max_score og block_max_scores ut, som er den høyeste scoren termen gir i hele listen og i hver blokk.
+    postings_t *postings;
+    double idf;
+    double max_score;
+    double *block_max_scores;
+} term_entry_t;
+
+typedef struct term_slot
+{
+    // en plass i hashtabellen til den kompakte term-ordboken: id + 1 til termen (0 betyr en tom plass), og de øverste 32
+    //  bitene av hashen, slik at plasser med andre termer nesten alltid hoppes over uten å sammenligne strengene
+    uint32_t term_id;
+    uint32_t tag;
+} term_slot_t;
+
+typedef struct term_weight
+{
+    // IDF-en og den høyeste scoren til en term i den kompakte term-ordboken, som i term_entry_t
+    double idf;
+    double max_score;
+} term_weight_t;
+
+typedef struct compact_index
+{
+    // den skrivebeskyttede utgaven av term-ordboken og dokumenttabellen som index_freeze lager. Termene er sortert, og
+    //  term_chars er alle termene etter hverandre med '\0' mellom, der term i starter på term_offsets[i], og weights er
+    //  IDF-en og den høyeste scoren til hver term. terms er term_entry_t til hver term (se compact_link), som peker inn i postings (alle dokumentlistene pakket etter hverandre) og
+    //  block_max_scores (grensene til alle blokkene etter hverandre, NULL uten beskjæring). slots er en hashtabell med
+    //  lineær prøving fra term til id, med n_slots plasser (en toerpotens). doc_chars er navnene til alle dokumentene, der
+    //  navnet til dokument i starter på doc_offsets[i]. Alt unntatt terms og listene i postings er arrays uten pekere,
+    //  slik at de kan skrives rett til en fil og brukes direkte fra den (se index_load). mapped er da satt, og arrayene ligger
+    //  i filen i stedet for å være allokert hver for seg. Filen deles av alle shardene, og mapping er satt i den som eier den.
+    char *term_chars;
+    uint64_t *term_offsets;
+    term_weight_t *weights;
+    term_entry_t *terms;
+    size_t n_terms;
+    term_slot_t *slots;
+    size_t n_slots;
+    double *block_max_scores;
+    size_t n_blocks;
+    postings_pack_t *postings;
+    char *doc_chars;
+    uint64_t *doc_offsets;
+    size_t term_chars_len;
+    size_t doc_chars_len;
+    int mapped;
+    void *mapping;
+    size_t mapping_size;
+} compact_index_t;
+
+typedef struct cached_query
+{
+    // et resultat i resultat-cachen: de k beste resultatene spørringen ga (k = 0 betyr alle), og statistikken
+    size_t k;
+    query_result_t *results;
+    size_t n_results;
+    index_query_stats_t stats;
+} cached_query_t;
+
+typedef struct query_cache
+{
+    // cachene til indexen, med tellere for hvor mange oppslag som traff. results går fra den kanoniske nøkkelen til en
+    //  spørring til en cached_query_t, og subqueries fra nøkkelen til et deluttrykk til settet av dokumenter det matcher.
+    //  programs går fra teksten til en spørring til det kompilerte programmet (se program_get).
+    //  En cache er NULL når den er slått av. lock tas rundt alle oppslag i cachene, siden spørringene i en batch og i
+    //  shardene kjøres på flere tråder samtidig (se index_query_batch og sharded_query_topk).
+    lru_cache_t *results;
+    size_t result_hits;
+    size_t result_misses;
+    lru_cache_t *subqueries;
+    size_t subquery_hits;
+    size_t subquery_misses;
+    lru_cache_t *programs;
+    size_t program_hits;
+    size_t program_misses;
+    pthread_mutex_t lock;
+} query_cache_t;
 
 struct index
 {
-    // Struktur for den inverterte indexen
+    // Struktur for den inverterte indexen. map går fra term til en term_entry_t med dokumentlisten til termen.
+    // doc_names, doc_lengths og doc_norms er dokumenttabellen der doc id brukes som indeks: navnet, antall ord, og
+    // k1 * (1 - b + b * lengde / snittlengde), som er den delen av BM25 som kun avhenger av dokumentet.
+    // frozen er satt når alle dokumentlistene er komprimert og trimmet etter indekseringen, og IDF-ene og doc_norms er
+    // regnet ut. Den nullstilles når nye dokumenter legges til. config inneholder innstillingene indexen ble opprettet med.
+    // cache er resultat-cachen, cachen for deluttrykk og program-cachen, som tømmes når nye dokumenter legges til.
+    // En index som er delt opp (se index_create_sharded) har shards, som er indexene over hvert sitt område av doc id'er,
+    // og pool, som er trådene spørringene kjøres på i shardene. Da er map og dokumenttabellen tomme, og bare antall
+    // dokumenter og den samlede lengden telles her. n_shards er 0 for en vanlig index.
+    // compact er satt etter index_freeze, og erstatter da map. Indexen kan ikke endres etter det.
     map_t *map;
+    char **doc_names;
+    uint32_t *doc_lengths;
+    float *doc_norms;
+    size_t doc_capacity;
     size_t amount_of_docs;
     size_t amount_of_terms;
+    uint64_t total_length;
+    int frozen;
+    index_config_t config;
+    query_cache_t cache;
+    index_t **shards;
+    size_t n_shards;
+    threadpool_t *pool;
+    compact_index_t *compact;
 };
 
 typedef struct ast_node
@@ -102,6 +244,32 @@ parse_t *parser_create(list_t *tokens)
     return parser;
 }
 
+void parser_destroy(parse_t *parser)
+{
+    // frigjør parseren og iteratoren dens. Selve token-listen eies av den som kalte index_query.
+    list_destroyiter(parser->iter);
+    free(parser);
+}
+
+void ast_destroy(ast_node_t *node)
+{
+    // frigjør hele treet rekursivt, inkludert kopiene av termene i løvnodene.
+    if (node == NULL)
+    {
+        return;
+    }
+    if (node->type == TERM)
+    {
+        free(node->term);
+    }
+    else
+    {
+        ast_destroy(node->left);
+        ast_destroy(node->right);
+    }
+    free(node);
+}
+
 ast_node_t *handle_not(parse_t *parser)
 {
     // funksjonen er av typen ast_node_t og forventer samme returverdi. Den tar inn en parser som argument.
@@ -171,298 +339,3704 @@ ast_node_t *handle_term(parse_t *parser)
     return NULL;
 }
 
-set_t *evaluate_ast(index_t *index, ast_node_t *node, map_t *score_map)
+static term_entry_t *compact_lookup(compact_index_t *compact, char *term, uint64_t hash)
 {
-    // funksjonen er av typen set_t og forventer et set i retur. Den tar inn tre argumenter: index, node og score map. Index er den
-    // inverterte indexen sendt inn fra index_query. Funksjonene begynner med å sjekke nodetypen for å velge hvilken operasjoner den skal
-    //  gjøre. Dersom nodetypen er en TERM vil dette si at det kun er et enkeltord som skal prossesseres. Her vil det da den inverterte indexen
-    //  hentes og det vil opprettes et set for å lagre dokumentene som inneholder søkeordet. Dersom ingen dokumenter finnes vil det returneres
-    // et tomt set. Dersom det finnes, vil det itereres over dokumenetene og legge hvert dokumentnavn til i settet. Til slutt blir scoren incrementet
-    //  og settet blir returnert.
-    //  dersom det ikke er et enkelt ord men en operasjon som skal utføres vil det først sjekkes hvilken operasjon det er. Dette blir gjort ved bruk
-    //  av set sine funksjoner; set_intersection for AND, set_union for OR og set_difference for dokumenter i venstre side, men ikke høyre.
-
-    if (node->type == TERM)
+    // slår opp en term i den kompakte term-ordboken. Prøvingen starter på plassen til de nederste bitene av hashen, og går
+    //  videre til neste plass til termen eller en tom plass er funnet.
+    size_t mask = compact->n_slots - 1;
+    uint32_t tag = (uint32_t)(hash >> 32);
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
     {
-        entry_t *entry = map_get(index->map, node->term);
-        set_t *docs = set_create((cmp_fn)strcmp);
-
-        if (entry == NULL)
+        term_slot_t *slot = &compact->slots[i];
+        if (slot->term_id == 0)
         {
-            return docs;
+            return NULL;
         }
-
-        list_t *doc_list = (list_t *)entry->val;
-        list_iter_t *iter = list_createiter(doc_list);
-        while (list_hasnext(iter))
+        size_t id = slot->term_id - 1;
+        if (slot->tag == tag && strcmp(&compact->term_chars[compact->term_offsets[id]], term) == 0)
         {
-            query_result_t *doc = list_next(iter);
-            set_insert(docs, doc->doc_name);
-
-            if (score_map != NULL)
-            {
-                entry_t *score_entry = map_get(score_map, doc->doc_name);
-                if (score_entry)
-                {
-                    double *score = (double *)score_entry->val;
-                    *score += doc->score;
-                }
-                else
-                {
-                    double *new_score = malloc(sizeof(double));
-                    *new_score = doc->score;
-                    map_insert(score_map, strdup(doc->doc_name), new_score);
-                }
-            }
+            return &compact->terms[id];
         }
-        list_destroyiter(iter);
-        return docs;
     }
-    else if (node->type == AND)
+}
+
+static term_entry_t *lookup_term(index_t *index, char *term, uint64_t hash)
+{
+    // henter dokumentlisten og IDF-en til en term, eller NULL dersom termen ikke finnes i indexen. hash er
+    //  hash_string_wyhash64 av termen, som er hashfunksjonen til term-ordboken.
+    if (index->compact)
     {
-        set_t *left = evaluate_ast(index, node->left, score_map);
-        set_t *right = evaluate_ast(index, node->right, score_map);
-        set_t *result = set_intersection(left, right);
-        return result;
+        return compact_lookup(index->compact, term, hash);
     }
-    else if (node->type == OR)
+    entry_t *entry = map_get_hashed(index->map, term, hash);
+    return entry ? (term_entry_t *)entry->val : NULL;
+}
+
+static inline char *doc_name(index_t *index, uint32_t doc_id)
+{
+    // navnet til et dokument, fra dokumenttabellen eller fra doc_chars i en kompakt index
+    if (index->compact)
     {
-        set_t *left = evaluate_ast(index, node->left, score_map);
-        set_t *right = evaluate_ast(index, node->right, score_map);
-        set_t *result = set_union(left, right);
-        return result;
+        return &index->compact->doc_chars[index->compact->doc_offsets[doc_id]];
     }
-    else if (node->type == NOT)
+    return index->doc_names[doc_id];
+}
+
+static inline double bm25(index_t *index, double idf, uint32_t count, uint32_t doc_id)
+{
+    // BM25-scoren til en term i et dokument, der count er antall forekomster av termen i dokumentet
+    return idf * count * (index->config.bm25_k1 + 1) / (count + index->doc_norms[doc_id]);
+}
+
+static docset_t *decode_postings(postings_t *postings)
+{
+    // dekoder en hel dokumentliste til et sortert array av doc id'er. En term som ikke finnes gir et tomt sett.
+    docset_t *docs = docset_create(postings ? postings_length(postings) : 0);
+    if (docs == NULL || postings == NULL)
     {
-        set_t *left = evaluate_ast(index, node->left, score_map);
-        set_t *right = evaluate_ast(index, node->right, score_map);
-        set_t *result = set_difference(left, right);
-        return result;
+        return docs;
     }
 
-    return NULL;
+    size_t n_blocks = postings_n_blocks(postings);
+    for (size_t block_i = 0; block_i < n_blocks; block_i++)
+    {
+        docs->length += postings_decode_block(postings, block_i, &docs->doc_ids[docs->length], NULL);
+    }
+    return docs;
 }
 
-ATTR_MAYBE_UNUSED
-int compare_results_by_score(query_result_t *a, query_result_t *b)
+static docset_t *filter_by_postings(docset_t *docs, postings_t *postings, int keep_present)
 {
-    if (a->score > b->score)
+    // tar vare på (AND) eller fjerner (NOT) dokumentene i docs som finnes i dokumentlisten. Dokumentlisten
+    //  dekodes ikke i sin helhet, blokker uten noen av dokumentene i docs hoppes over. docs frigjøres.
+    docset_t *result = docset_create(docs->length);
+    if (result != NULL)
     {
-        return -1;
+        if (keep_present)
+        {
+            result->length = postings_intersect(postings, docs->doc_ids, docs->length, result->doc_ids);
+        }
+        else
+        {
+            result->length = postings_subtract(postings, docs->doc_ids, docs->length, result->doc_ids);
+        }
     }
-    if (a->score < b->score)
+    docset_destroy(docs);
+    return result;
+}
+
+static docset_t *combine_docsets(docset_t *left, docset_t *right, ast_enums_t type)
+{
+    // kombinerer to sett med snitt (AND), union (OR) eller differanse (NOT). Begge settene frigjøres.
+    docset_t *result = NULL;
+    if (left != NULL && right != NULL)
     {
-        return 1;
+        if (type == AND)
+        {
+            result = docset_create(left->length < right->length ? left->length : right->length);
+            if (result)
+            {
+                result->length = docset_intersect(left->doc_ids, left->length, right->doc_ids, right->length, result->doc_ids);
+            }
+        }
+        else if (type == OR)
+        {
+            result = docset_create(left->length + right->length);
+            if (result)
+            {
+                result->length = docset_union(left->doc_ids, left->length, right->doc_ids, right->length, result->doc_ids);
+            }
+        }
+        else
+        {
+            result = docset_create(left->length);
+            if (result)
+            {
+                result->length = docset_difference(left->doc_ids, left->length, right->doc_ids, right->length, result->doc_ids);
+            }
+        }
     }
-    return 0;
+    docset_destroy(left);
+    docset_destroy(right);
+    return result;
 }
 
-/**
- * @brief debug / helper to print a list of strings with a description.
- * Can safely be removed, but could be useful for debugging/development.
- *
- * Remove this function from your finished program once you are done
- */
-ATTR_MAYBE_UNUSED
-void print_list_of_strings(const char *descr, list_t *tokens)
+typedef struct plan_node
 {
-    if (LOG_LEVEL <= LOG_LEVEL_INFO)
+    // Struktur for hver node i spørringsplanen. Planen lages fra ASTet og kompileres til et program (se program_compile), der kjeder av samme operator
+    //  er slått sammen til én node med alle operandene. type er TERM, AND eller OR. For TERM er postings dokumentlisten
+    //  (NULL dersom termen ikke finnes). For AND er children konjunktene sortert på stigende kostnad, og excluded er
+    //  operandene til &! som trekkes fra etter snittet. For OR er children alternativene. term er oppslaget i
+    //  term-ordboken, og postings er hentet derfra.
+    //  key er den kanoniske formen til noden, der operandene er sortert og like operander fjernet, slik at spørringer
+    //  som er like bortsett fra rekkefølgen får samme nøkkel i resultat-cachen.
+    //  Like deluttrykk deles mellom alle stedene de brukes i spørringen (se plan_share), og refs er antall steder noden
+    //  brukes. slot er plassen noden har fått i programmet den kompileres til, pluss én (0 betyr ingen plass).
+    //  cost er et estimat på hvor mange dokumenter noden gir: df for en term, den minste for AND og summen for OR.
+    //  En node med kostnad 0 er garantert tom, og evalueres ikke.
+    ast_enums_t type;
+    char *key;
+    size_t refs;
+    size_t slot;
+    term_entry_t *term;
+    postings_t *postings;
+    struct plan_node **children;
+    size_t n_children;
+    struct plan_node **excluded;
+    size_t n_excluded;
+    size_t cost;
+} plan_node_t;
+
+void plan_destroy(plan_node_t *plan)
+{
+    // frigjør planen rekursivt. Dokumentlistene eies av indexen. En delt node frigjøres først når den ikke brukes noe sted.
+    if (plan == NULL || --plan->refs > 0)
     {
         return;
     }
-    list_iter_t *tokens_iter = list_createiter(tokens);
-    if (!tokens_iter)
+    for (size_t i = 0; i < plan->n_children; i++)
     {
-        /* this is not a critical function, so just print an error and return. */
-        pr_error("Failed to create iterator\n");
-        return;
+        plan_destroy(plan->children[i]);
     }
-
-    pr_info("\n%s:", descr);
-    while (list_hasnext(tokens_iter))
+    for (size_t i = 0; i < plan->n_excluded; i++)
     {
-        char *token = (char *)list_next(tokens_iter);
-        pr_info("\"%s\", ", token);
+        plan_destroy(plan->excluded[i]);
     }
-    pr_info("\n");
-
-    list_destroyiter(tokens_iter);
+    free(plan->children);
+    free(plan->excluded);
+    free(plan->key);
+    free(plan);
 }
 
-index_t *index_create()
+static int plan_append(plan_node_t ***array, size_t *length, plan_node_t *node)
 {
-    // funkjsonen er av typen index_t og forventer index_t returverdi. Funkjsonen setter opp verdiene til en tom index og setter hvilke
-    //  compare functions den skal ha i sin struktur.
-    index_t *index = malloc(sizeof(index_t));
-    if (index == NULL)
+    // legger node til sist i et array av noder. Returnerer -1 og frigjør noden dersom det feiler.
+    plan_node_t **grown = realloc(*array, (*length + 1) * sizeof(plan_node_t *));
+    if (grown == NULL)
     {
-        pr_error("Failed to allocate memory for index\n");
-        return NULL;
+        pr_error("failed to allocate memory!\n");
+        plan_destroy(node);
+        return -1;
     }
-    index->map = map_create((cmp_fn)strcmp, (hash64_fn)hash_string_fnv1a64);
-    index->amount_of_docs = 0;
-    index->amount_of_terms = 0;
-    return index;
+    grown[(*length)++] = node;
+    *array = grown;
+    return 0;
 }
 
-void index_destroy(index_t *index)
+static int compare_plans_by_key(const void *a, const void *b)
 {
-    // Destroys the index sent in as argument
-    index->amount_of_docs = 0;
-    index->amount_of_terms = 0;
-    map_destroy(index->map, NULL, NULL);
-    free(index);
+    return strcmp((*(plan_node_t **)a)->key, (*(plan_node_t **)b)->key);
 }
 
-int index_document(index_t *index, char *doc_name, list_t *terms)
+static int compare_plans_by_cost(const void *a, const void *b)
 {
-    // funksjonen er av typen int og forventer en integer i retur. Den tar inn tre argumenter index, doc_name og terms. Den fungerer ved å
-    //  først opprette en iterator av listen terms. Deretter opprettes en while løkke som itererer over iteratoren. for hver iterasjon
-    // hentes et nytt term ut og map_get brukes for å finne ut om termen allerede finnes i indexen. Dersom den gjør det, hentes tilhørende
-    // dokumentliste. Hvis termen ikke finnes, opprettes en ny dokumentliste og legges inn i map sammen med termen som nøkkel.
-    //  Deretter opprettes en ny iterator for dokumentlisten for å se om dokumentet allerede finnes i listen. Hvis det gjør det, økes scoren.
-    //  Hvis det ikke finnes, opprettes en ny query_result_t og legges til i dokumentlisten. Når alle terms er behandlet økes dokumentteller.
-    if (index == NULL || doc_name == NULL || terms == NULL)
-    {
-        perror("Index, doc_name or terms == NULL!\n");
-        return -1;
-    }
+    // ved lik kostnad ordnes operandene på nøkkelen, slik at rekkefølgen kun avhenger av den kanoniske formen
+    size_t a_cost = (*(plan_node_t **)a)->cost;
+    size_t b_cost = (*(plan_node_t **)b)->cost;
+    return (a_cost > b_cost) ? 1 : (a_cost < b_cost) ? -1 : compare_plans_by_key(a, b);
+}
 
-    list_iter_t *iterator = list_createiter(terms);
-    while (list_hasnext(iterator))
+static void plan_dedup(plan_node_t **operands, size_t *n_operands)
+{
+    // fjerner operander som er like, dvs. har samme nøkkel. Operandene er sortert, så like operander ligger etter hverandre.
+    size_t n_kept = 0;
+    for (size_t i = 0; i < *n_operands; i++)
     {
-        char *term = (char *)list_next(iterator);
-
-        entry_t *entry = map_get(index->map, term);
-        list_t *doc_list = NULL;
-        if (entry != NULL)
+        if (n_kept > 0 && strcmp(operands[n_kept - 1]->key, operands[i]->key) == 0)
         {
-            doc_list = (list_t *)entry->val;
+            plan_destroy(operands[i]);
         }
-        if (doc_list == NULL)
+        else
         {
-            doc_list = list_create(NULL);
-            map_insert(index->map, strdup(term), doc_list);
-            index->amount_of_terms++;
+            operands[n_kept++] = operands[i];
         }
+    }
+    *n_operands = n_kept;
+}
 
-        list_iter_t *doc_iter = list_createiter(doc_list);
-        query_result_t *found = NULL;
-        while (list_hasnext(doc_iter))
-        {
-            query_result_t *doc = (query_result_t *)list_next(doc_iter);
-            if (strcmp(doc->doc_name, doc_name) == 0)
-            {
-                found = doc;
-                break;
-            }
-        }
-        if (found != NULL)
-        {
-            found->score++;
-        }
-        else
+static char *plan_make_key(plan_node_t *plan)
+{
+    // lager den kanoniske nøkkelen til en AND- eller OR-node fra nøklene til operandene, som "(& a b &! c)" og "(| a b)".
+    //  Termer kan ikke inneholde mellomrom eller parenteser, så ulike planer får aldri samme nøkkel.
+    size_t length = sizeof("(& &!)");
+    for (size_t i = 0; i < plan->n_children; i++)
+    {
+        length += strlen(plan->children[i]->key) + 1;
+    }
+    for (size_t i = 0; i < plan->n_excluded; i++)
+    {
+        length += strlen(plan->excluded[i]->key) + 1;
+    }
+
+    char *key = malloc(length);
+    if (key == NULL)
+    {
+        return NULL;
+    }
+    char *end = stpcpy(key, plan->type == OR ? "(|" : "(&");
+    for (size_t i = 0; i < plan->n_children; i++)
+    {
+        end = stpcpy(stpcpy(end, " "), plan->children[i]->key);
+    }
+    if (plan->n_excluded > 0)
+    {
+        end = stpcpy(end, " &!");
+        for (size_t i = 0; i < plan->n_excluded; i++)
         {
-            query_result_t *new_doc = malloc(sizeof(query_result_t));
-            if (new_doc == NULL)
-            {
-                pr_error("failed to allocate memory!\n");
-                return -1;
-            }
-            new_doc->doc_name = strdup(doc_name);
-            new_doc->score = 1;
-            list_addlast(doc_list, new_doc);
+            end = stpcpy(stpcpy(end, " "), plan->excluded[i]->key);
         }
     }
-    index->amount_of_docs++;
-    return 0;
+    stpcpy(end, ")");
+    return key;
 }
 
-list_t *index_query(index_t *index, list_t *query_tokens, char *errbuf)
-{
-    // funksjonen er av typen list_t og forventer samme returverdi. Den tar inn tre argumenter
-    // index som er den inverterte indexen, query_tokens som er en liste med tokens fra spørringen, og errbuf som er en buffer for feilmeldinger.
-    // først opprettes en parser, basert på token listen og deretter bygges det opp et abstrakt syntax tre ved hjelp av handle_not.
-    // dette ASTet evalueres for å finne hvilke dokumenter som matcher, og dette lagres i result_docs.
-    // så opprettes en score_map for å kunne rangere resultatene. Deretter itereres det over hvert token i spørringen for å finne hvilke
-    // dokumenter som inneholder hvert søkeord, og scorer disse dersom de finnes i result_docs.
-    // Til slutt opprettes en liste med query_result_t for hver dokument, hvor scorene hentes fra score_map, og returneres som resultat.
-    parse_t *parser = parser_create(query_tokens);
-    ast_node_t *ast = handle_not(parser);
-    set_t *result_docs = evaluate_ast(index, ast, NULL);
-    map_t *score_map = map_create((cmp_fn)strcmp, (hash64_fn)hash_string_fnv1a64);
-    list_iter_t *query_iter = list_createiter(query_tokens);
+static plan_node_t *plan_build(index_t *index, map_t *terms, ast_node_t *node, char *errbuf);
 
-    while (list_hasnext(query_iter))
+static int plan_collect(index_t *index, map_t *terms, plan_node_t *plan, ast_node_t *node, char *errbuf)
+{
+    // samler operandene til en kjede av samme operator i plan. For AND følges både AND og &!, siden (a &! b) && c er det
+    //  samme som (a && c) &! b: venstre side av &! blir en konjunkt, og høyre side en operand som trekkes fra.
+    //  For OR følges bare OR. Alle andre noder planlegges for seg og legges til som en operand.
+    if (node == NULL)
     {
+        snprintf(errbuf, LINE_MAX, "Expected a term after the last operator");
+        return -1;
+    }
 
-        char *token = list_next(query_iter);
-        entry_t *entry = map_get(index->map, token);
-        if (entry == NULL)
+    if (plan->type == AND && node->type == AND)
+    {
+        return plan_collect(index, terms, plan, node->left, errbuf) || plan_collect(index, terms, plan, node->right, errbuf) ? -1 : 0;
+    }
+    if (plan->type == AND && node->type == NOT)
+    {
+        if (plan_collect(index, terms, plan, node->left, errbuf) != 0)
         {
-            continue;
+            return -1;
         }
+        plan_node_t *excluded = plan_build(index, terms, node->right, errbuf);
+        return excluded ? plan_append(&plan->excluded, &plan->n_excluded, excluded) : -1;
+    }
+    if (plan->type == OR && node->type == OR)
+    {
+        return plan_collect(index, terms, plan, node->left, errbuf) || plan_collect(index, terms, plan, node->right, errbuf) ? -1 : 0;
+    }
 
-        list_t *docs = (list_t *)entry->val;
+    plan_node_t *child = plan_build(index, terms, node, errbuf);
+    return child ? plan_append(&plan->children, &plan->n_children, child) : -1;
+}
 
-        list_iter_t *doc_iter = list_createiter(docs);
-        while (list_hasnext(doc_iter))
-        {
-            query_result_t *doc = list_next(doc_iter);
-            if (set_get(result_docs, doc->doc_name) == NULL)
-            {
-                continue;
-            }
+static term_entry_t *plan_lookup_term(index_t *index, map_t *terms, char *term)
+{
+    // slår opp en term med lookup_term. terms er termene som allerede er slått opp i en batch (se index_query_batch),
+    //  fra teksten til term_entry_t-en (NULL dersom termen ikke finnes), slik at hver ulike term bare slås opp én gang
+    //  i ordboken uansett hvor mange av spørringene den er med i. Uten terms slås termen opp direkte.
+    uint64_t hash = hash_string_wyhash64(term);
+    if (terms == NULL)
+    {
+        return lookup_term(index, term, hash);
+    }
+    entry_t *entry = map_get_hashed(terms, term, hash);
+    if (entry)
+    {
+        return entry->val;
+    }
+    term_entry_t *found = lookup_term(index, term, hash);
+    char *key = strdup(term);
+    if (key)
+    {
+        map_insert_hashed(terms, key, found, hash);
+    }
+    return found;
+}
 
-            entry_t *score_entry = map_get(score_map, doc->doc_name);
-            if (score_entry != NULL)
-            {
-                double *score = score_entry->val;
-                *score += doc->score;
-            }
-            else
-            {
-                double *new_score = malloc(sizeof(double));
-                *new_score = doc->score;
-                map_insert(score_map, doc->doc_name, new_score);
-            }
+static plan_node_t *plan_build(index_t *index, map_t *terms, ast_node_t *node, char *errbuf)
+{
+    // funksjonen lager spørringsplanen for et deltre av ASTet, med termene slått opp med plan_lookup_term. Returnerer
+    //  NULL og skriver til errbuf dersom spørringen er ugyldig, eller minnet ikke strekker til.
+    //  For AND sorteres konjunktene på stigende kostnad, slik at snittet starter med den korteste dokumentlisten og
+    //  resten bare trenger å slå opp dokumentene som er igjen. Er en av konjunktene tom, er hele noden tom.
+    //  Operander som er tomme beholdes i OR og &!, og blir OP_EMPTY når planen kompileres. Hvilke operander som er tomme
+    //  avhenger av dokumentene i akkurat denne indexen (eller shardet), så å fjerne dem ville gitt ulike planer, og
+    //  dermed ulike nøkler og score, for samme spørring. En node med bare én operand erstattes av operanden.
+    //  Operandene til OR og &! sorteres på nøkkelen, og like operander fjernes fra alle tre, slik at planen og nøkkelen
+    //  (se plan_make_key) kun avhenger av den kanoniske formen til spørringen.
+    if (node == NULL)
+    {
+        snprintf(errbuf, LINE_MAX, "Expected a term after the last operator");
+        return NULL;
+    }
+
+    plan_node_t *plan = calloc(1, sizeof(plan_node_t));
+    if (plan == NULL)
+    {
+        snprintf(errbuf, LINE_MAX, "Failed to allocate memory for the query plan");
+        return NULL;
+    }
+    plan->refs = 1;
+
+    if (node->type == TERM)
+    {
+        term_entry_t *term = plan_lookup_term(index, terms, node->term);
+        plan->type = TERM;
+        plan->key = strdup(node->term);
+        if (plan->key == NULL)
+        {
+            snprintf(errbuf, LINE_MAX, "Failed to allocate memory for the query plan");
+            free(plan);
+            return NULL;
         }
+        plan->term = term;
+        plan->postings = term ? term->postings : NULL;
+        plan->cost = plan->postings ? postings_length(plan->postings) : 0;
+        return plan;
     }
 
-    list_t *results = list_create(NULL);
-    if (results == NULL)
+    plan->type = (node->type == OR) ? OR : AND;
+    if (plan_collect(index, terms, plan, node, errbuf) != 0)
     {
-        snprintf(errbuf, LINE_MAX, "Failed to create results list");
+        if (errbuf[0] == '\0')
+        {
+            snprintf(errbuf, LINE_MAX, "Failed to allocate memory for the query plan");
+        }
+        plan_destroy(plan);
         return NULL;
     }
 
-    map_iter_t *score_iter = map_createiter(score_map);
-    while (map_hasnext(score_iter))
+    if (plan->n_excluded > 0)
     {
-        entry_t *entry = map_next(score_iter);
-        if (!entry || !entry->key || !entry->val)
-            continue;
+        qsort(plan->excluded, plan->n_excluded, sizeof(plan_node_t *), compare_plans_by_key);
+        plan_dedup(plan->excluded, &plan->n_excluded);
+    }
+    if (plan->type == AND)
+    {
+        qsort(plan->children, plan->n_children, sizeof(plan_node_t *), compare_plans_by_cost);
+        plan_dedup(plan->children, &plan->n_children);
+        plan->cost = plan->children[0]->cost;
+    }
+    else
+    {
+        qsort(plan->children, plan->n_children, sizeof(plan_node_t *), compare_plans_by_key);
+        plan_dedup(plan->children, &plan->n_children);
+        plan->cost = 0;
+        for (size_t i = 0; i < plan->n_children; i++)
+        {
+            plan->cost += plan->children[i]->cost;
+        }
+        plan->cost = (plan->cost < index->amount_of_docs) ? plan->cost : index->amount_of_docs;
+    }
 
-        query_result_t *result = malloc(sizeof(query_result_t));
-        result->doc_name = strdup((char *)entry->key);
-        result->score = *(double *)entry->val;
-        list_addlast(results, result);
+    if (plan->n_children == 1 && plan->n_excluded == 0)
+    {
+        plan_node_t *child = plan->children[0];
+        plan->n_children = 0;
+        plan_destroy(plan);
+        return child;
     }
 
-    return results;
+    plan->key = plan_make_key(plan);
+    if (plan->key == NULL)
+    {
+        snprintf(errbuf, LINE_MAX, "Failed to allocate memory for the query plan");
+        plan_destroy(plan);
+        return NULL;
+    }
+    return plan;
 }
-void index_stat(index_t *index, size_t *n_docs, size_t *n_terms)
+
+static void plan_share_operands(plan_node_t **operands, size_t n_operands, map_t *nodes);
+
+static void plan_share(plan_node_t *plan, map_t *nodes)
 {
-    // funksjonen er av typen void og returnerer derfor ingenting. Den tar inn tre argumenter en peker til index-strukturen,
-    // og to pekere til variabler der antall dokumenter og antall unike termer skal lagres.
-    // funksjonen begynner med å sjekke om noen av pekerne er NULL. Hvis dette stemmer returneres det direkte uten å gjøre noe mer.
-    // hvis alt er gyldig, settes verdiene til n_docs og n_terms ved å hente tallene direkte fra index-strukturen.
+    // deler like deluttrykk i planen (hash-consing): hver operand slås opp på nøkkelen i nodes, som går fra nøkkel til den
+    //  første noden med den nøkkelen. Finnes den fra før, erstattes operanden av den, slik at hvert ulike deluttrykk bare
+    //  finnes én gang, og bare trenger å evalueres én gang. Operandene deles før noden selv, nedenfra og opp.
+    plan_share_operands(plan->children, plan->n_children, nodes);
+    plan_share_operands(plan->excluded, plan->n_excluded, nodes);
+}
 
-    if (index == NULL || n_docs == NULL || n_terms == NULL)
+static void plan_share_operands(plan_node_t **operands, size_t n_operands, map_t *nodes)
+{
+    for (size_t i = 0; i < n_operands; i++)
     {
-        return;
+        plan_share(operands[i], nodes);
+
+        int inserted;
+        entry_t *entry = map_upsert(nodes, operands[i]->key, &inserted);
+        if (inserted)
+        {
+            entry->val = operands[i];
+        }
+        else if (entry->val != operands[i])
+        {
+            plan_destroy(operands[i]);
+            operands[i] = entry->val;
+            operands[i]->refs++;
+        }
     }
+}
 
-    *n_docs = index->amount_of_docs;
-    *n_terms = index->amount_of_terms;
-}
\ No newline at end of file
+static int plan_is_disjunction(plan_node_t *plan)
+{
+    // sjekker om planen er en enkelt term eller termer med || mellom, som er spørringene som kan beskjæres. Alle termene
+    //  må ha øvre grenser for scoren, bortsett fra de som er tomme og ikke bidrar.
+    if (plan->cost == 0)
+    {
+        return 0;
+    }
+    if (plan->type == TERM)
+    {
+        return plan->term->block_max_scores != NULL;
+    }
+    if (plan->type != OR)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < plan->n_children; i++)
+    {
+        plan_node_t *child = plan->children[i];
+        if (child->type != TERM || (child->cost > 0 && !plan_is_disjunction(child)))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+typedef enum opcode
+{
+    // instruksjonene i et kompilert program (se program_compile). Programmet er i postfiks, der operandene kommer før
+    //  operatoren, og kjøres med en stack av sett (program_run) eller gjøres om til et iterator-tre (iter_build).
+    OP_TERM,          // legg dokumentene til term arg på stacken
+    OP_EMPTY,         // legg et tomt sett på stacken
+    OP_FILTER,        // behold dokumentene på toppen som term arg har, uten å dekode hele dokumentlisten
+    OP_EXCLUDE,       // fjern dokumentene på toppen som term arg har
+    OP_INTERSECT,     // erstatt de to øverste med snittet
+    OP_SUBTRACT,      // erstatt de to øverste med det nest øverste minus det øverste
+    OP_UNION,         // erstatt de to øverste med unionen
+    OP_JUMP_IF_EMPTY, // hopp til arg dersom toppen er tom, siden resten av en AND da ikke kan gi noe
+    OP_AND_END,       // slutten på en AND med arg konjunkter og arg2 operander til &!
+    OP_OR_END,        // slutten på en OR med arg alternativer
+    OP_SUBQUERY,      // starten på deluttrykket i plass arg, som slutter ved arg2. Er det evaluert før, hopp dit.
+    OP_STORE,         // slutten på deluttrykket i plass arg: ta vare på toppen
+} opcode_t;
+
+typedef struct instr
+{
+    // en instruksjon i et kompilert program. Hva arg og arg2 er avhenger av op, se opcode_t.
+    uint8_t op;
+    uint32_t arg;
+    uint32_t arg2;
+} instr_t;
+
+typedef struct program_slot
+{
+    // et deluttrykk som kan hentes i stedet for å evalueres: key er den kanoniske nøkkelen, og shared er satt dersom det
+    //  brukes flere steder i spørringen
+    char *key;
+    int shared;
+} program_slot_t;
+
+typedef struct program
+{
+    // Struktur for en kompilert spørring. code er instruksjonene, og terms er termene de bruker, slått opp i
+    //  term-ordboken når spørringen kompileres. scored er termene som bidrar til scoren (se program_add_scored_terms).
+    //  slots er deluttrykkene som er omsluttet av OP_SUBQUERY og OP_STORE.
+    //  key er den kanoniske nøkkelen til hele spørringen, og disjunction er satt dersom den kan beskjæres (se
+    //  plan_is_disjunction). Programmet endres ikke etter kompileringen, så det kan kjøres om igjen for like spørringer.
+    //  refs er antall som bruker programmet, inkludert program-cachen, slik at det ikke frigjøres mens det kjøres.
+    instr_t *code;
+    size_t n_code;
+    size_t capacity;
+    term_entry_t **terms;
+    size_t n_terms;
+    term_entry_t **scored;
+    size_t n_scored;
+    program_slot_t *slots;
+    size_t n_slots;
+    char *key;
+    int disjunction;
+    size_t refs;
+} program_t;
+
+void program_release(program_t *program)
+{
+    // slipper programmet, og frigjør det når ingen bruker det lenger. Termene eies av indexen.
+    if (program == NULL || --program->refs > 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < program->n_slots; i++)
+    {
+        free(program->slots[i].key);
+    }
+    free(program->slots);
+    free(program->code);
+    free(program->terms);
+    free(program->scored);
+    free(program->key);
+    free(program);
+}
+
+static size_t program_size(program_t *program)
+{
+    // antall bytes programmet bruker, til program-cachen
+    size_t size = sizeof(program_t) + program->n_code * sizeof(instr_t) +
+                  (program->n_terms + program->n_scored) * sizeof(term_entry_t *) + strlen(program->key) + 1;
+    for (size_t i = 0; i < program->n_slots; i++)
+    {
+        size += sizeof(program_slot_t) + strlen(program->slots[i].key) + 1;
+    }
+    return size;
+}
+
+static int program_emit(program_t *program, opcode_t op, size_t arg, size_t arg2)
+{
+    // legger en instruksjon til sist i programmet. Plassen dobles når den er full. Returnerer -1 dersom minnet ikke
+    //  strekker til.
+    if (program->n_code == program->capacity)
+    {
+        size_t capacity = program->capacity ? program->capacity * 2 : 16;
+        instr_t *code = realloc(program->code, capacity * sizeof(instr_t));
+        if (code == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            return -1;
+        }
+        program->code = code;
+        program->capacity = capacity;
+    }
+    program->code[program->n_code++] = (instr_t){(uint8_t)op, (uint32_t)arg, (uint32_t)arg2};
+    return 0;
+}
+
+static int program_emit_term(program_t *program, opcode_t op, term_entry_t *term)
+{
+    // legger til en instruksjon som bruker en term. Hver term finnes bare én gang i program->terms.
+    size_t term_i = 0;
+    while (term_i < program->n_terms && program->terms[term_i] != term)
+    {
+        term_i++;
+    }
+    if (term_i == program->n_terms)
+    {
+        term_entry_t **terms = realloc(program->terms, (program->n_terms + 1) * sizeof(term_entry_t *));
+        if (terms == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            return -1;
+        }
+        terms[program->n_terms++] = term;
+        program->terms = terms;
+    }
+    return program_emit(program, op, term_i, 0);
+}
+
+static int program_add_slot(program_t *program, plan_node_t *plan)
+{
+    // gir et deluttrykk en plass i programmet. Alle stedene en delt node brukes får samme plass.
+    program_slot_t *slots = realloc(program->slots, (program->n_slots + 1) * sizeof(program_slot_t));
+    if (slots == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        return -1;
+    }
+    program->slots = slots;
+    slots[program->n_slots].key = strdup(plan->key);
+    slots[program->n_slots].shared = plan->refs > 1;
+    if (slots[program->n_slots].key == NULL)
+    {
+        return -1;
+    }
+    plan->slot = ++program->n_slots;
+    return 0;
+}
+
+static int program_compile_node(program_t *program, plan_node_t *plan, int guard_all)
+{
+    // kompilerer en node i planen til postfiks. En node med kostnad 0 blir OP_EMPTY. For AND kommer konjunktene i
+    //  rekkefølgen fra planen, og hver av de neste konjunktene og operandene til &! kombineres med resultatet så langt.
+    //  En term blir da OP_FILTER eller OP_EXCLUDE. Før hver av dem sjekkes det om resultatet er tomt, og i så fall
+    //  hoppes det til OP_AND_END. For OR kombineres alternativene med OP_UNION.
+    //  Et deluttrykk som er delt, eller alle deluttrykk dersom guard_all er satt (med cachen for deluttrykk), omsluttes
+    //  av OP_SUBQUERY og OP_STORE. En delt node kompileres på hvert sted den brukes, men evalueres bare første gang.
+    if (plan->cost == 0)
+    {
+        return program_emit(program, OP_EMPTY, 0, 0);
+    }
+    if (plan->type == TERM)
+    {
+        return program_emit_term(program, OP_TERM, plan->term);
+    }
+
+    int guarded = plan->refs > 1 || guard_all;
+    size_t guard_pc = program->n_code;
+    if (guarded && ((plan->slot == 0 && program_add_slot(program, plan) != 0) ||
+                    program_emit(program, OP_SUBQUERY, plan->slot - 1, 0) != 0))
+    {
+        return -1;
+    }
+
+    if (program_compile_node(program, plan->children[0], guard_all) != 0)
+    {
+        return -1;
+    }
+
+    if (plan->type == OR)
+    {
+        for (size_t i = 1; i < plan->n_children; i++)
+        {
+            if (program_compile_node(program, plan->children[i], guard_all) != 0 ||
+                program_emit(program, OP_UNION, 0, 0) != 0)
+            {
+                return -1;
+            }
+        }
+        if (program_emit(program, OP_OR_END, plan->n_children, 0) != 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        size_t first_pc = program->n_code;
+        for (size_t i = 1; i < plan->n_children + plan->n_excluded; i++)
+        {
+            int is_excluded = (i >= plan->n_children);
+            plan_node_t *operand = is_excluded ? plan->excluded[i - plan->n_children] : plan->children[i];
+            int status = program_emit(program, OP_JUMP_IF_EMPTY, 0, 0);
+            if (status == 0 && operand->type == TERM && operand->cost > 0)
+            {
+                status = program_emit_term(program, is_excluded ? OP_EXCLUDE : OP_FILTER, operand->term);
+            }
+            else if (status == 0)
+            {
+                status = program_compile_node(program, operand, guard_all);
+                status = status ? status : program_emit(program, is_excluded ? OP_SUBTRACT : OP_INTERSECT, 0, 0);
+            }
+            if (status != 0)
+            {
+                return -1;
+            }
+        }
+
+        // hoppene til denne noden går til OP_AND_END. Hoppene i operandene har allerede fått målet sitt, som aldri er 0.
+        for (size_t pc = first_pc; pc < program->n_code; pc++)
+        {
+            if (program->code[pc].op == OP_JUMP_IF_EMPTY && program->code[pc].arg == 0)
+            {
+                program->code[pc].arg = (uint32_t)program->n_code;
+            }
+        }
+        if (program_emit(program, OP_AND_END, plan->n_children, plan->n_excluded) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (guarded)
+    {
+        if (program_emit(program, OP_STORE, plan->slot - 1, 0) != 0)
+        {
+            return -1;
+        }
+        program->code[guard_pc].arg2 = (uint32_t)program->n_code;
+    }
+    return 0;
+}
+
+static int program_add_scored_terms(program_t *program, plan_node_t *plan)
+{
+    // legger termene i planen som bidrar til scoren til program->scored, dvs. termene som ikke er under en operand til
+    //  &!. Også termene i noder som er tomme, og derfor ikke blir kompilert, tas med: et dokument som matcher en annen
+    //  del av spørringen kan fortsatt ha dem, og scoren skal ikke avhenge av hvilke noder som er tomme i akkurat denne
+    //  indexen (eller shardet). Hver term tas bare med én gang, selv om den står flere steder i spørringen, f.eks. både
+    //  i (a &! b) og alene i (a &! b) || a. Termer som ikke finnes i indexen hoppes over, siden ingen dokumenter har dem.
+    if (plan->type == TERM)
+    {
+        size_t term_i = 0;
+        while (term_i < program->n_scored && program->scored[term_i] != plan->term)
+        {
+            term_i++;
+        }
+        if (plan->term == NULL || term_i < program->n_scored)
+        {
+            return 0;
+        }
+        term_entry_t **scored = realloc(program->scored, (program->n_scored + 1) * sizeof(term_entry_t *));
+        if (scored == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            return -1;
+        }
+        scored[program->n_scored++] = plan->term;
+        program->scored = scored;
+        return 0;
+    }
+    for (size_t i = 0; i < plan->n_children; i++)
+    {
+        if (program_add_scored_terms(program, plan->children[i]) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static program_t *program_compile(plan_node_t *plan, int guard_all)
+{
+    // kompilerer en plan, der like deluttrykk er delt (se plan_share), til et program. Returnerer NULL dersom minnet ikke
+    //  strekker til.
+    program_t *program = calloc(1, sizeof(program_t));
+    if (program == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        return NULL;
+    }
+    program->refs = 1;
+    program->key = strdup(plan->key);
+    program->disjunction = plan_is_disjunction(plan);
+    if (program->key == NULL || program_compile_node(program, plan, guard_all) != 0 ||
+        program_add_scored_terms(program, plan) != 0)
+    {
+        program_release(program);
+        return NULL;
+    }
+    return program;
+}
+
+typedef struct scored_term
+{
+    // en term som bidrar til scoren, med en cursor som flyttes fram til hvert dokument i resultatet
+    postings_cursor_t cursor;
+    double idf;
+} scored_term_t;
+
+static void program_start_scored_terms(program_t *program, scored_term_t *terms)
+{
+    // starter en cursor for hver av termene som bidrar til scoren (se program_add_scored_terms)
+    for (size_t i = 0; i < program->n_scored; i++)
+    {
+        postings_cursor_init(&terms[i].cursor, program->scored[i]->postings);
+        terms[i].idf = program->scored[i]->idf;
+    }
+}
+
+static double score_terms(index_t *index, scored_term_t *terms, size_t n_terms, uint32_t doc_id)
+{
+    // summerer BM25-scoren til termene som har dokumentet. Dokumentene scores i stigende rekkefølge, så cursorene flyttes
+    //  bare fremover, og blokker uten noen av dokumentene i resultatet hoppes over.
+    double score = 0.0;
+    for (size_t i = 0; i < n_terms; i++)
+    {
+        if (postings_cursor_advance(&terms[i].cursor, doc_id) == doc_id)
+        {
+            score += bm25(index, terms[i].idf, postings_cursor_count(&terms[i].cursor), doc_id);
+        }
+    }
+    return score;
+}
+
+typedef struct query_exec
+{
+    // tilstanden mens et program kjøres. memo har dokumentene til hvert delte deluttrykk etter at det er evaluert første
+    //  gang, med plassen i programmet som indeks.
+    index_t *index;
+    program_t *program;
+    docset_t **memo;
+} query_exec_t;
+
+static docset_t *exec_lookup_subquery(query_exec_t *exec, size_t slot)
+{
+    // henter dokumentene til et deluttrykk som allerede er evaluert, enten tidligere i spørringen eller i cachen for
+    //  deluttrykk. Returnerer en kopi, eller NULL dersom det må evalueres.
+    if (exec->memo[slot])
+    {
+        return docset_copy(exec->memo[slot]);
+    }
+
+    query_cache_t *cache = &exec->index->cache;
+    if (cache->subqueries == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&cache->lock);
+    docset_t *cached = lru_get(cache->subqueries, exec->program->slots[slot].key);
+    docset_t *docs = cached ? docset_copy(cached) : NULL;
+    cache->subquery_hits += cached != NULL;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (docs && exec->program->slots[slot].shared)
+    {
+        exec->memo[slot] = docset_copy(docs);
+    }
+    return docs;
+}
+
+static void exec_store_subquery(query_exec_t *exec, size_t slot, docset_t *docs)
+{
+    // tar vare på dokumentene til et deluttrykk som nettopp er evaluert, i cachen for deluttrykk og for resten av
+    //  spørringen dersom det er delt
+    query_cache_t *cache = &exec->index->cache;
+    if (cache->subqueries)
+    {
+        docset_t *copy = docset_copy(docs);
+        pthread_mutex_lock(&cache->lock);
+        cache->subquery_misses++;
+        if (copy && lru_put(cache->subqueries, exec->program->slots[slot].key, copy,
+                            sizeof(docset_t) + copy->length * sizeof(uint32_t)) != 0)
+        {
+            docset_destroy(copy);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    if (exec->program->slots[slot].shared)
+    {
+        exec->memo[slot] = docset_copy(docs);
+    }
+}
+
+static docset_t *program_run(query_exec_t *exec, size_t from, size_t to)
+{
+    // kjører instruksjonene fra og med from til to med en stack av sett, og returnerer settet som ligger igjen, som eies
+    //  av den som kaller. Returnerer NULL dersom minnet ikke strekker til.
+    //  Termer dekodes med decode_postings, og OP_FILTER og OP_EXCLUDE bruker filter_by_postings, som hopper over blokkene
+    //  som ikke kan inneholde noen av dokumentene. Snitt, union og differanse bruker docset_*, som fletter når sidene er
+    //  omtrent like store, og bruker galopperende søk i den største når den ene er mye mindre.
+    program_t *program = exec->program;
+    docset_t **stack = malloc((to - from + 1) * sizeof(docset_t *));
+    if (stack == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        return NULL;
+    }
+
+    size_t top = 0;
+    int failed = 0;
+    for (size_t pc = from; pc < to && !failed; pc++)
+    {
+        instr_t *instr = &program->code[pc];
+        switch (instr->op)
+        {
+        case OP_TERM:
+            stack[top++] = decode_postings(program->terms[instr->arg]->postings);
+            break;
+        case OP_EMPTY:
+            stack[top++] = docset_create(0);
+            break;
+        case OP_FILTER:
+        case OP_EXCLUDE:
+            stack[top - 1] = filter_by_postings(stack[top - 1], program->terms[instr->arg]->postings, instr->op == OP_FILTER);
+            break;
+        case OP_INTERSECT:
+        case OP_SUBTRACT:
+        case OP_UNION:
+            top--;
+            stack[top - 1] = combine_docsets(stack[top - 1], stack[top],
+                                             instr->op == OP_INTERSECT ? AND : instr->op == OP_UNION ? OR : NOT);
+            break;
+        case OP_JUMP_IF_EMPTY:
+            if (stack[top - 1]->length == 0)
+            {
+                pc = instr->arg - 1;
+            }
+            break;
+        case OP_SUBQUERY:
+        {
+            docset_t *docs = exec_lookup_subquery(exec, instr->arg);
+            if (docs)
+            {
+                stack[top++] = docs;
+                pc = instr->arg2 - 1;
+            }
+            break;
+        }
+        case OP_STORE:
+            exec_store_subquery(exec, instr->arg, stack[top - 1]);
+            break;
+        default:
+            // OP_AND_END og OP_OR_END trengs bare for å bygge iterator-treet
+            break;
+        }
+        failed = (top > 0 && stack[top - 1] == NULL);
+    }
+
+    if (failed)
+    {
+        for (size_t i = 0; i < top; i++)
+        {
+            docset_destroy(stack[i]);
+        }
+    }
+    docset_t *docs = failed ? NULL : stack[0];
+    free(stack);
+    return docs;
+}
+
+typedef struct doc_iter
+{
+    // Struktur for hver node i iterator-treet, som lages fra spørringsplanen når spørringen evalueres ett dokument om gangen.
+    //  Hver node har et gjeldende dokument doc_id, som kan flyttes med iter_next og iter_advance. Når noden ikke har
+    //  flere dokumenter er doc_id lik POSTINGS_END. For TERM peker cursor på dokumentlisten (NULL for en tom node).
+    //  For AND er children konjunktene sortert på stigende kostnad og excluded operandene til &!, og for OR er children
+    //  alternativene, som i planen. Ingenting her vokser med antall dokumenter som matcher, bortsett fra deluttrykk som
+    //  er delt, eller alle deluttrykk når cachen for deluttrykk er slått på. De evalueres én gang til settet docs, der
+    //  pos er det gjeldende dokumentet. Iteratorene brukes bare til å finne dokumentene, som scores på samme måte som
+    //  med sett-motoren.
+    ast_enums_t type;
+    uint32_t doc_id;
+    postings_cursor_t *cursor;
+    double idf;
+    struct doc_iter **children;
+    size_t n_children;
+    struct doc_iter **excluded;
+    size_t n_excluded;
+    docset_t *docs;
+    size_t pos;
+} doc_iter_t;
+
+uint32_t iter_next(doc_iter_t *iter);
+uint32_t iter_advance(doc_iter_t *iter, uint32_t target);
+
+static uint32_t iter_and_align(doc_iter_t *iter, uint32_t candidate)
+{
+    // finner det første dokumentet fra og med candidate som alle konjunktene har, og som ingen av operandene til &! har.
+    //  candidate er alltid det gjeldende dokumentet til den første (korteste) konjunkten. De andre flyttes fram til
+    //  candidate. Har en av dem ikke candidate, er dokumentet den stoppet på neste mulige kandidat, og den første
+    //  konjunkten flyttes fram dit. Slik hopper alle listene over dokumenter som ikke kan matche.
+    while (candidate != POSTINGS_END)
+    {
+        size_t i;
+        for (i = 1; i < iter->n_children; i++)
+        {
+            uint32_t doc_id = iter_advance(iter->children[i], candidate);
+            if (doc_id != candidate)
+            {
+                candidate = iter_advance(iter->children[0], doc_id);
+                break;
+            }
+        }
+        if (i < iter->n_children)
+        {
+            continue;
+        }
+
+        for (i = 0; i < iter->n_excluded; i++)
+        {
+            if (iter_advance(iter->excluded[i], candidate) == candidate)
+            {
+                break;
+            }
+        }
+        if (i == iter->n_excluded)
+        {
+            break;
+        }
+        candidate = iter_next(iter->children[0]);
+    }
+
+    iter->doc_id = candidate;
+    return candidate;
+}
+
+static uint32_t iter_or_min(doc_iter_t *iter)
+{
+    // det gjeldende dokumentet til en OR er det laveste av alternativene sine
+    uint32_t min = POSTINGS_END;
+    for (size_t i = 0; i < iter->n_children; i++)
+    {
+        min = (iter->children[i]->doc_id < min) ? iter->children[i]->doc_id : min;
+    }
+    iter->doc_id = min;
+    return min;
+}
+
+uint32_t iter_next(doc_iter_t *iter)
+{
+    // flytter iteratoren til neste dokument som matcher, og returnerer det
+    if (iter->doc_id == POSTINGS_END)
+    {
+        return POSTINGS_END;
+    }
+
+    if (iter->type == TERM)
+    {
+        iter->doc_id = postings_cursor_next(iter->cursor);
+        return iter->doc_id;
+    }
+    if (iter->docs)
+    {
+        iter->pos++;
+        iter->doc_id = (iter->pos < iter->docs->length) ? iter->docs->doc_ids[iter->pos] : POSTINGS_END;
+        return iter->doc_id;
+    }
+    if (iter->type == AND)
+    {
+        return iter_and_align(iter, iter_next(iter->children[0]));
+    }
+
+    // for OR flyttes alle alternativene som står på det gjeldende dokumentet
+    for (size_t i = 0; i < iter->n_children; i++)
+    {
+        if (iter->children[i]->doc_id == iter->doc_id)
+        {
+            iter_next(iter->children[i]);
+        }
+    }
+    return iter_or_min(iter);
+}
+
+uint32_t iter_advance(doc_iter_t *iter, uint32_t target)
+{
+    // flytter iteratoren til det første dokumentet >= target som matcher, og returnerer det
+    if (iter->doc_id >= target)
+    {
+        return iter->doc_id;
+    }
+
+    if (iter->type == TERM)
+    {
+        iter->doc_id = postings_cursor_advance(iter->cursor, target);
+        return iter->doc_id;
+    }
+    if (iter->docs)
+    {
+        iter->pos = docset_gallop(iter->docs->doc_ids, iter->docs->length, iter->pos, target);
+        iter->doc_id = (iter->pos < iter->docs->length) ? iter->docs->doc_ids[iter->pos] : POSTINGS_END;
+        return iter->doc_id;
+    }
+    if (iter->type == AND)
+    {
+        return iter_and_align(iter, iter_advance(iter->children[0], target));
+    }
+
+    for (size_t i = 0; i < iter->n_children; i++)
+    {
+        iter_advance(iter->children[i], target);
+    }
+    return iter_or_min(iter);
+}
+
+void iter_destroy(doc_iter_t *iter)
+{
+    // frigjør iterator-treet rekursivt
+    if (iter == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < iter->n_children; i++)
+    {
+        iter_destroy(iter->children[i]);
+    }
+    for (size_t i = 0; i < iter->n_excluded; i++)
+    {
+        iter_destroy(iter->excluded[i]);
+    }
+    free(iter->children);
+    free(iter->excluded);
+    free(iter->cursor);
+    docset_destroy(iter->docs);
+    free(iter);
+}
+
+static doc_iter_t *iter_create_term(term_entry_t *term)
+{
+    // lager en iterator for dokumentlisten til en term, som står på det første dokumentet. Uten term blir den tom.
+    doc_iter_t *iter = calloc(1, sizeof(doc_iter_t));
+    if (iter == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        return NULL;
+    }
+    iter->type = TERM;
+    iter->doc_id = POSTINGS_END;
+    if (term == NULL)
+    {
+        return iter;
+    }
+
+    iter->cursor = malloc(sizeof(postings_cursor_t));
+    if (iter->cursor == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        free(iter);
+        return NULL;
+    }
+    postings_cursor_init(iter->cursor, term->postings);
+    iter->doc_id = iter->cursor->doc_id;
+    iter->idf = term->idf;
+    return iter;
+}
+
+static doc_iter_t *iter_create_operator(ast_enums_t type, doc_iter_t **operands, size_t n_children, size_t n_excluded)
+{
+    // lager en AND- eller OR-iterator over operandene, der de første n_children er konjunktene eller alternativene og
+    //  resten operandene til &!. Iteratoren tar over operandene, og frigjør dem dersom det feiler.
+    doc_iter_t *iter = calloc(1, sizeof(doc_iter_t));
+    doc_iter_t **children = malloc(n_children * sizeof(doc_iter_t *));
+    doc_iter_t **excluded = malloc((n_excluded + 1) * sizeof(doc_iter_t *));
+    if (iter == NULL || children == NULL || excluded == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        free(iter);
+        free(children);
+        free(excluded);
+        for (size_t i = 0; i < n_children + n_excluded; i++)
+        {
+            iter_destroy(operands[i]);
+        }
+        return NULL;
+    }
+    memcpy(children, operands, n_children * sizeof(doc_iter_t *));
+    memcpy(excluded, &operands[n_children], n_excluded * sizeof(doc_iter_t *));
+    iter->type = type;
+    iter->children = children;
+    iter->n_children = n_children;
+    iter->excluded = excluded;
+    iter->n_excluded = n_excluded;
+
+    if (type == AND)
+    {
+        iter_and_align(iter, iter->children[0]->doc_id);
+    }
+    else
+    {
+        iter_or_min(iter);
+    }
+    return iter;
+}
+
+static doc_iter_t *iter_create_subquery(query_exec_t *exec, size_t from, size_t to)
+{
+    // evaluerer deluttrykket i instruksjonene fra og med from til to med program_run, og lager en iterator over settet
+    doc_iter_t *iter = calloc(1, sizeof(doc_iter_t));
+    if (iter == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        return NULL;
+    }
+    iter->type = AND;
+    iter->docs = program_run(exec, from, to);
+    if (iter->docs == NULL)
+    {
+        iter_destroy(iter);
+        return NULL;
+    }
+    iter->doc_id = iter->docs->length ? iter->docs->doc_ids[0] : POSTINGS_END;
+    return iter;
+}
+
+doc_iter_t *iter_build(query_exec_t *exec)
+{
+    // lager iterator-treet fra programmet, og plasserer hver node på sitt første dokument. Iteratorene til operandene
+    //  legges på en stack, og OP_AND_END og OP_OR_END tar dem av igjen og lager iteratoren til operatoren. Resten av
+    //  operatorene trengs ikke her. En tom node blir en TERM uten cursor. Et deluttrykk som er delt med andre steder i
+    //  spørringen evalueres i stedet med program_run, slik at det bare regnes ut én gang. Med cachen for deluttrykk
+    //  gjelder det alle deluttrykkene, slik at de hentes fra cachen eller legges inn i den som med sett-motoren.
+    //  Returnerer NULL dersom minnet ikke strekker til.
+    program_t *program = exec->program;
+    query_cache_t *cache = &exec->index->cache;
+    doc_iter_t **stack = malloc((program->n_code + 1) * sizeof(doc_iter_t *));
+    if (stack == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        return NULL;
+    }
+
+    size_t top = 0;
+    int failed = 0;
+    for (size_t pc = 0; pc < program->n_code && !failed; pc++)
+    {
+        instr_t *instr = &program->code[pc];
+        doc_iter_t *iter = NULL;
+        switch (instr->op)
+        {
+        case OP_TERM:
+        case OP_FILTER:
+        case OP_EXCLUDE:
+            iter = iter_create_term(program->terms[instr->arg]);
+            break;
+        case OP_EMPTY:
+            iter = iter_create_term(NULL);
+            break;
+        case OP_AND_END:
+            top -= instr->arg + instr->arg2;
+            iter = iter_create_operator(AND, &stack[top], instr->arg, instr->arg2);
+            break;
+        case OP_OR_END:
+            top -= instr->arg;
+            iter = iter_create_operator(OR, &stack[top], instr->arg, 0);
+            break;
+        case OP_SUBQUERY:
+            if (program->slots[instr->arg].shared || cache->subqueries != NULL)
+            {
+                iter = iter_create_subquery(exec, pc, instr->arg2);
+                pc = instr->arg2 - 1;
+                break;
+            }
+            continue;
+        default:
+            continue;
+        }
+
+        failed = (iter == NULL);
+        stack[top] = iter;
+        top += !failed;
+    }
+
+    if (failed)
+    {
+        for (size_t i = 0; i < top; i++)
+        {
+            iter_destroy(stack[i]);
+        }
+    }
+    doc_iter_t *root = failed ? NULL : stack[0];
+    free(stack);
+    return root;
+}
+
+int compare_results_by_score(query_result_t *a, query_result_t *b)
+{
+    if (a->score > b->score)
+    {
+        return -1;
+    }
+    if (a->score < b->score)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+static int compare_results_worst_first(query_result_t *a, query_result_t *b)
+{
+    // ordner det dårligste resultatet først, slik at det ligger øverst i heapen med de k beste: lavest score, og ved
+    //  lik score det dokumentnavnet som kommer sist alfabetisk
+    int by_score = compare_results_by_score(b, a);
+    return by_score ? by_score : strcmp(b->doc_name, a->doc_name);
+}
+
+/**
+ * @brief debug / helper to print a list of strings with a description.
+ * Can safely be removed, but could be useful for debugging/development.
+ *
+ * Remove this function from your finished program once you are done
+ */
+ATTR_MAYBE_UNUSED
+void print_list_of_strings(const char *descr, list_t *tokens)
+{
+    if (LOG_LEVEL <= LOG_LEVEL_INFO)
+    {
+        return;
+    }
+    list_iter_t *tokens_iter = list_createiter(tokens);
+    if (!tokens_iter)
+    {
+        /* this is not a critical function, so just print an error and return. */
+        pr_error("Failed to create iterator\n");
+        return;
+    }
+
+    pr_info("\n%s:", descr);
+    while (list_hasnext(tokens_iter))
+    {
+        char *token = (char *)list_next(tokens_iter);
+        pr_info("\"%s\", ", token);
+    }
+    pr_info("\n");
+
+    list_destroyiter(tokens_iter);
+}
+
+void index_config_default(index_config_t *config)
+{
+    // setter standardinnstillingene for en index
+    config->codec = CODEC_BITPACK;
+    config->engine = INDEX_ENGINE_ITERATORS;
+    config->bm25_k1 = 1.2;
+    config->bm25_b = 0.75;
+    config->pruning = INDEX_PRUNING_NONE;
+    config->cache_bytes = 4 << 20;
+    config->subquery_cache_bytes = 0;
+    config->program_cache_bytes = 1 << 20;
+    config->verify = INDEX_VERIFY_NONE;
+}
+
+index_t *index_create()
+{
+    // oppretter en index med standardinnstillingene
+    index_config_t config;
+    index_config_default(&config);
+    return index_create_with_config(&config);
+}
+
+static void cached_query_destroy(cached_query_t *cached)
+{
+    free(cached->results);
+    free(cached);
+}
+
+static void cache_clear(query_cache_t *cache)
+{
+    // tømmer cachene, men beholder tellerne. Kalles når indexen endres, siden resultatene da kan være utdaterte, og
+    //  programmene kan peke på termer som er flyttet eller mangle termer som er lagt til.
+    if (cache->results)
+    {
+        lru_clear(cache->results);
+    }
+    if (cache->subqueries)
+    {
+        lru_clear(cache->subqueries);
+    }
+    if (cache->programs)
+    {
+        lru_clear(cache->programs);
+    }
+}
+
+static list_t *cache_lookup(index_t *index, const char *key, size_t k, index_query_stats_t *stats)
+{
+    // slår opp en spørring i resultat-cachen. Et resultat kan brukes dersom det har minst de k beste resultatene.
+    //  Returnerer en ny liste med kopier av resultatene, eller NULL dersom spørringen ikke er i cachen.
+    query_cache_t *cache = &index->cache;
+    if (cache->results == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&cache->lock);
+    cached_query_t *cached = lru_get(cache->results, key);
+    list_t *results = NULL;
+    size_t n_results = 0;
+    if (cached && (cached->k == 0 || (k != 0 && k <= cached->k)))
+    {
+        results = list_create(NULL);
+        n_results = (k != 0 && k < cached->n_results) ? k : cached->n_results;
+    }
+
+    for (size_t i = 0; results && i < n_results; i++)
+    {
+        query_result_t *result = malloc(sizeof(query_result_t));
+        if (result == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            list_destroy(results, free);
+            results = NULL;
+            break;
+        }
+        *result = cached->results[i];
+        list_addlast(results, result);
+    }
+    if (results)
+    {
+        *stats = cached->stats;
+        cache->result_hits++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return results;
+}
+
+static void cache_insert(index_t *index, const char *key, size_t k, list_t *results, index_query_stats_t *stats)
+{
+    // legger resultatene til en spørring i resultat-cachen. Et eldre resultat for samme spørring erstattes.
+    query_cache_t *cache = &index->cache;
+    if (cache->results == NULL)
+    {
+        return;
+    }
+    size_t n_results = list_length(results);
+    cached_query_t *cached = malloc(sizeof(cached_query_t));
+    query_result_t *copies = malloc((n_results ? n_results : 1) * sizeof(query_result_t));
+    if (cached == NULL || copies == NULL)
+    {
+        free(cached);
+        free(copies);
+        return;
+    }
+
+    list_iter_t *results_iter = list_createiter(results);
+    for (size_t i = 0; list_hasnext(results_iter); i++)
+    {
+        copies[i] = *(query_result_t *)list_next(results_iter);
+    }
+    list_destroyiter(results_iter);
+
+    cached->k = k;
+    cached->results = copies;
+    cached->n_results = n_results;
+    cached->stats = *stats;
+    pthread_mutex_lock(&cache->lock);
+    cache->result_misses++;
+    if (lru_put(cache->results, key, cached, sizeof(cached_query_t) + n_results * sizeof(query_result_t)) != 0)
+    {
+        cached_query_destroy(cached);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+index_t *index_create_with_config(const index_config_t *config)
+{
+    // funkjsonen er av typen index_t og forventer index_t returverdi. Funkjsonen setter opp verdiene til en tom index og setter hvilke
+    //  compare functions den skal ha i sin struktur. Innstillingene kopieres inn i indexen.
+    index_t *index = malloc(sizeof(index_t));
+    if (index == NULL)
+    {
+        pr_error("Failed to allocate memory for index\n");
+        return NULL;
+    }
+    index->map = map_create((cmp_fn)strcmp, (hash64_fn)hash_string_wyhash64);
+    index->doc_names = malloc(DOC_TABLE_INITIAL * sizeof(char *));
+    index->doc_lengths = malloc(DOC_TABLE_INITIAL * sizeof(uint32_t));
+    index->doc_norms = malloc(DOC_TABLE_INITIAL * sizeof(float));
+    if (index->map == NULL || index->doc_names == NULL || index->doc_lengths == NULL || index->doc_norms == NULL)
+    {
+        pr_error("Failed to allocate memory for index\n");
+        map_destroy(index->map, NULL, NULL);
+        free(index->doc_names);
+        free(index->doc_lengths);
+        free(index->doc_norms);
+        free(index);
+        return NULL;
+    }
+    index->doc_capacity = DOC_TABLE_INITIAL;
+    index->amount_of_docs = 0;
+    index->amount_of_terms = 0;
+    index->total_length = 0;
+    index->frozen = 0;
+    index->config = *config;
+    index->shards = NULL;
+    index->n_shards = 0;
+    index->pool = NULL;
+    index->compact = NULL;
+
+    memset(&index->cache, 0, sizeof(query_cache_t));
+    pthread_mutex_init(&index->cache.lock, NULL);
+    if (config->cache_bytes > 0)
+    {
+        index->cache.results = lru_create(config->cache_bytes, (free_fn)cached_query_destroy);
+    }
+    if (config->subquery_cache_bytes > 0)
+    {
+        index->cache.subqueries = lru_create(config->subquery_cache_bytes, (free_fn)docset_destroy);
+    }
+    if (config->program_cache_bytes > 0)
+    {
+        index->cache.programs = lru_create(config->program_cache_bytes, (free_fn)program_release);
+    }
+    return index;
+}
+
+static void term_entry_destroy(term_entry_t *term)
+{
+    postings_destroy(term->postings);
+    free(term->block_max_scores);
+    free(term);
+}
+
+static void compact_destroy(compact_index_t *compact)
+{
+    if (compact == NULL)
+    {
+        return;
+    }
+    free(compact->terms);
+    postings_pack_destroy(compact->postings);
+    if (!compact->mapped)
+    {
+        free(compact->term_chars);
+        free(compact->term_offsets);
+        free(compact->weights);
+        free(compact->slots);
+        free(compact->block_max_scores);
+        free(compact->doc_chars);
+        free(compact->doc_offsets);
+    }
+    if (compact->mapping)
+    {
+        munmap(compact->mapping, compact->mapping_size);
+    }
+    free(compact);
+}
+
+static int index_is_compact(index_t *index)
+{
+    // en index med shards kan ikke endres så snart en av shardene er gjort kompakt
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        if (index->shards[s]->compact)
+        {
+            return 1;
+        }
+    }
+    return index->compact != NULL;
+}
+
+void index_destroy(index_t *index)
+{
+    // Destroys the index sent in as argument, including the terms, posting lists and the document table
+    if (index == NULL)
+    {
+        return;
+    }
+    lru_destroy(index->cache.results);
+    lru_destroy(index->cache.subqueries);
+    lru_destroy(index->cache.programs);
+    pthread_mutex_destroy(&index->cache.lock);
+    threadpool_destroy(index->pool);
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        index_destroy(index->shards[s]);
+    }
+    free(index->shards);
+    if (index->map)
+    {
+        map_destroy(index->map, free, (free_fn)term_entry_destroy);
+    }
+    // dokumentene i en index med shards ligger i dokumenttabellene til shardene, og navnene i en kompakt index i doc_chars
+    for (size_t i = 0; index->n_shards == 0 && index->compact == NULL && i < index->amount_of_docs; i++)
+    {
+        free(index->doc_names[i]);
+    }
+    free(index->doc_names);
+    // i en index som er lastet fra fil ligger dokumentlengdene og doc_norms i filen
+    if (index->compact == NULL || !index->compact->mapped)
+    {
+        free(index->doc_lengths);
+        free(index->doc_norms);
+    }
+    compact_destroy(index->compact);
+    free(index);
+}
+
+index_t *index_create_sharded(index_t **shards, size_t n_shards)
+{
+    // lager en index av shards over hvert sitt område av doc id'er, i rekkefølge, med innstillingene til den første.
+    //  Indexen tar over shardene, og frigjør dem dersom det feiler. Spørringene kjøres på alle shardene samtidig, den
+    //  første på tråden som spør og resten på n_shards - 1 tråder i pool (se sharded_query_topk).
+    int valid = n_shards > 0;
+    for (size_t s = 0; s < n_shards; s++)
+    {
+        valid = valid && shards[s] != NULL && shards[s]->n_shards == 0;
+    }
+
+    index_t *index = valid ? index_create_with_config(&shards[0]->config) : NULL;
+    index_t **copy = valid ? malloc(n_shards * sizeof(index_t *)) : NULL;
+    threadpool_t *pool = (valid && n_shards > 1) ? threadpool_create(n_shards - 1) : NULL;
+    if (index == NULL || copy == NULL || (n_shards > 1 && pool == NULL))
+    {
+        pr_error("Failed to create sharded index\n");
+        index_destroy(index);
+        free(copy);
+        threadpool_destroy(pool);
+        for (size_t s = 0; s < n_shards; s++)
+        {
+            index_destroy(shards[s]);
+        }
+        return NULL;
+    }
+
+    memcpy(copy, shards, n_shards * sizeof(index_t *));
+    index->shards = copy;
+    index->n_shards = n_shards;
+    index->pool = pool;
+    for (size_t s = 0; s < n_shards; s++)
+    {
+        index->amount_of_docs += shards[s]->amount_of_docs;
+        index->total_length += shards[s]->total_length;
+    }
+    return index;
+}
+
+static int doc_table_grow(index_t *index, size_t new_capacity)
+{
+    // gjør plass til new_capacity dokumenter i dokumenttabellen. Tabellen blir aldri mindre.
+    if (new_capacity > index->doc_capacity)
+    {
+        char **new_names = realloc(index->doc_names, new_capacity * sizeof(char *));
+        if (new_names == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            return -1;
+        }
+        index->doc_names = new_names;
+
+        uint32_t *new_lengths = realloc(index->doc_lengths, new_capacity * sizeof(uint32_t));
+        if (new_lengths == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            return -1;
+        }
+        index->doc_lengths = new_lengths;
+
+        float *new_norms = realloc(index->doc_norms, new_capacity * sizeof(float));
+        if (new_norms == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            return -1;
+        }
+        index->doc_norms = new_norms;
+        index->doc_capacity = new_capacity;
+    }
+    return 0;
+}
+
+static int doc_table_reserve(index_t *index)
+{
+    // gjør plass til ett dokument til i dokumenttabellen, slik at doc_table_add ikke kan feile etterpå. Tabellen dobles
+    //  når den er full.
+    if (index->amount_of_docs >= UINT32_MAX)
+    {
+        pr_error("Document table is full\n");
+        return -1;
+    }
+    if (index->amount_of_docs == index->doc_capacity && doc_table_grow(index, index->doc_capacity * 2) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int doc_table_add(index_t *index, char *doc_name, uint32_t length, uint32_t *doc_id)
+{
+    // legger til et dokument med length ord i dokumenttabellen og gir det neste ledige doc id (se doc_table_reserve)
+    if (doc_table_reserve(index) != 0)
+    {
+        return -1;
+    }
+    *doc_id = (uint32_t)index->amount_of_docs;
+    index->doc_names[index->amount_of_docs] = doc_name;
+    index->doc_lengths[index->amount_of_docs] = length;
+    index->amount_of_docs++;
+    index->total_length += length;
+    return 0;
+}
+
+int index_reserve(index_t *index, size_t n_docs, size_t n_terms)
+{
+    // gjør plass til n_docs dokumenter og n_terms termer til sammen, slik at dokumenttabellen og term-ordboken ikke
+    //  må vokse (og hashes om) mens de legges til. I en index med shards legges nye dokumenter i den siste sharden.
+    if (index == NULL || index_is_compact(index))
+    {
+        return -1;
+    }
+    if (index->n_shards > 0)
+    {
+        // dokumentene i de andre shardene trekkes fra
+        index_t *last = index->shards[index->n_shards - 1];
+        size_t n_other = index->amount_of_docs - last->amount_of_docs;
+        return index_reserve(last, (n_docs > n_other) ? n_docs - n_other : 0, n_terms);
+    }
+    if (doc_table_grow(index, n_docs) != 0 || map_reserve(index->map, n_terms) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void remove_term(index_t *index, term_entry_t *entry, const char *term, uint64_t hash)
+{
+    // fjerner en term fra term-ordboken og frigjør den sammen med nøkkelen og dokumentlisten
+    entry_t *removed = map_remove_hashed(index->map, (void *)term, hash);
+    if (removed)
+    {
+        free(removed->key);
+        free(removed);
+    }
+    term_entry_destroy(entry);
+    index->amount_of_terms--;
+}
+
+static int add_posting(index_t *index, char *term, uint64_t hash, uint32_t doc_id, uint32_t count,
+                       term_entry_t **term_entry)
+{
+    // legger til en posting for (term, doc_id) i den inverterte indexen. Dersom termen er ny tar indexen over eierskapet
+    // til strengen og bruker den som nøkkel, ellers frigjøres den. Siden dokumentene får stigende doc id'er havner postingen
+    // alltid sist i dokumentlisten, så listen er sortert på doc id uten at vi trenger å lete gjennom den.
+    // Termen slås opp og settes inn i samme oppslag med map_upsert_hashed. term_entry settes til termen, slik at postingen
+    // kan fjernes igjen med remove_posting. Feiler det, er indexen som før.
+    int inserted;
+    entry_t *map_entry = map_upsert_hashed(index->map, term, hash, &inserted);
+    term_entry_t *entry = map_entry->val;
+    if (!inserted)
+    {
+        free(term);
+    }
+    else
+    {
+        entry = malloc(sizeof(term_entry_t));
+        postings_t *postings = postings_create(index->config.codec);
+        if (entry == NULL || postings == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            free(map_remove_hashed(index->map, term, hash));
+            free(entry);
+            free(term);
+            return -1;
+        }
+        entry->postings = postings;
+        entry->idf = 0.0;
+        entry->max_score = 0.0;
+        entry->block_max_scores = NULL;
+        map_entry->val = entry;
+        index->amount_of_terms++;
+    }
+
+    *term_entry = entry;
+    if (postings_append(entry->postings, doc_id, count) != 0)
+    {
+        // en ny term uten dokumenter fjernes igjen
+        if (postings_length(entry->postings) == 0)
+        {
+            remove_term(index, entry, term, hash);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static void remove_posting(index_t *index, term_entry_t *entry, const char *term, uint64_t hash, uint32_t doc_id)
+{
+    // fjerner postingen til doc_id fra slutten av dokumentlisten til en term igjen, når dokumentet ikke kunne legges til.
+    //  En term som var ny for dokumentet har da ingen dokumenter, og fjernes fra ordboken med remove_term.
+    postings_remove_last(entry->postings, doc_id);
+    if (postings_length(entry->postings) == 0)
+    {
+        remove_term(index, entry, term, hash);
+    }
+}
+
+static int term_compute_bounds(index_t *index, term_entry_t *term)
+{
+    // regner ut den høyeste BM25-scoren termen gir i hver blokk av dokumentlisten og i hele listen, som brukes som øvre
+    //  grenser når disjunksjoner beskjæres. Grensene lagres sammen med dokumentlisten i term-ordboken, siden de avhenger
+    //  av k1, b og dokumentlengdene.
+    size_t n_blocks = postings_n_blocks(term->postings);
+    double *block_max_scores = realloc(term->block_max_scores, (n_blocks ? n_blocks : 1) * sizeof(double));
+    if (block_max_scores == NULL)
+    {
+        pr_error("failed to allocate memory!\n");
+        free(term->block_max_scores);
+        term->block_max_scores = NULL;
+        return -1;
+    }
+    term->block_max_scores = block_max_scores;
+    term->max_score = 0.0;
+
+    uint32_t doc_ids[POSTINGS_BLOCK_LEN];
+    uint32_t counts[POSTINGS_BLOCK_LEN];
+    for (size_t block_i = 0; block_i < n_blocks; block_i++)
+    {
+        size_t n = postings_decode_block(term->postings, block_i, doc_ids, counts);
+        double block_max = 0.0;
+        for (size_t i = 0; i < n; i++)
+        {
+            double score = bm25(index, term->idf, counts[i], doc_ids[i]);
+            block_max = score > block_max ? score : block_max;
+        }
+        block_max_scores[block_i] = block_max * SCORE_BOUND_SLACK;
+        if (block_max_scores[block_i] > term->max_score)
+        {
+            term->max_score = block_max_scores[block_i];
+        }
+    }
+    return 0;
+}
+
+static void freeze_shard(index_t *index, double n_docs, double avg_length, map_t *dfs)
+{
+    // trimmer alle dokumentlistene ned til nøyaktig størrelse etter at indekseringen er ferdig, og regner ut delene av BM25
+    //  som ikke avhenger av spørringen: IDF-en til hver term, normaliseringen av dokumentlengden til hvert dokument, og
+    //  med beskjæring de øvre grensene for scoren til hver term. n_docs og avg_length er antall dokumenter og snittlengden
+    //  i hele indexen. dfs går fra term til antall dokumenter termen finnes i, i alle shardene, og er NULL uten shards.
+    map_iter_t *term_iter = map_createiter(index->map);
+    while (map_hasnext(term_iter))
+    {
+        entry_t *entry = map_next(term_iter);
+        term_entry_t *term = entry->val;
+        double df = dfs ? (double)VAL_TO_COUNT(map_get(dfs, entry->key)->val) : (double)postings_length(term->postings);
+        postings_freeze(term->postings);
+        term->idf = log(1.0 + (n_docs - df + 0.5) / (df + 0.5));
+    }
+    map_destroyiter(term_iter);
+
+    double k1 = index->config.bm25_k1, b = index->config.bm25_b;
+    for (size_t i = 0; i < index->amount_of_docs; i++)
+    {
+        double relative_length = avg_length > 0.0 ? index->doc_lengths[i] / avg_length : 1.0;
+        index->doc_norms[i] = (float)(k1 * (1.0 - b + b * relative_length));
+    }
+
+    // de øvre grensene trengs kun med beskjæring, og kan først regnes ut når både IDF-ene og doc_norms er klare
+    if (index->config.pruning != INDEX_PRUNING_NONE)
+    {
+        term_iter = map_createiter(index->map);
+        while (map_hasnext(term_iter))
+        {
+            term_compute_bounds(index, map_next(term_iter)->val);
+        }
+        map_destroyiter(term_iter);
+    }
+    index->frozen = 1;
+}
+
+static void freeze_postings(index_t *index)
+{
+    // fryser indexen med freeze_shard. Kalles fra index_query, slik at dette kun gjøres én gang etter at det er lagt til
+    //  nye dokumenter. En index med shards fryses med statistikken til alle shardene samlet: antall dokumenter, snittlengden
+    //  og df for hver term, som telles opp i dfs. Slik får hvert dokument samme score som i én index med alle dokumentene.
+    //  Cachene til shardene tømmes, siden IDF-ene i alle shardene endres når det legges til dokumenter i en av dem.
+    if (index->frozen)
+    {
+        return;
+    }
+
+    double n_docs = (double)index->amount_of_docs;
+    double avg_length = index->amount_of_docs ? (double)index->total_length / n_docs : 0.0;
+    if (index->n_shards == 0)
+    {
+        freeze_shard(index, n_docs, avg_length, NULL);
+        return;
+    }
+
+    map_t *dfs = map_create((cmp_fn)strcmp, (hash64_fn)hash_string_wyhash64);
+    if (dfs == NULL)
+    {
+        return;
+    }
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        map_iter_t *term_iter = map_createiter(index->shards[s]->map);
+        while (map_hasnext(term_iter))
+        {
+            entry_t *term = map_next(term_iter);
+            size_t df = postings_length(((term_entry_t *)term->val)->postings);
+            int inserted;
+            entry_t *entry = map_upsert(dfs, term->key, &inserted);
+            entry->val = COUNT_TO_VAL(VAL_TO_COUNT(entry->val) + df); // en ny term har NULL, altså 0
+
+        }
+        map_destroyiter(term_iter);
+    }
+
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        cache_clear(&index->shards[s]->cache);
+        freeze_shard(index->shards[s], n_docs, avg_length, dfs);
+    }
+    index->amount_of_terms = map_length(dfs);
+    map_destroy(dfs, NULL, NULL);
+    index->frozen = 1;
+}
+
+static int compare_entries_by_key(const void *a, const void *b)
+{
+    return strcmp((*(entry_t *const *)a)->key, (*(entry_t *const *)b)->key);
+}
+
+static int compact_link(compact_index_t *compact)
+{
+    // lager term_entry_t til hver term fra arrayene i den kompakte indexen, slik at spørringene kan bruke termene akkurat
+    //  som termene i term-ordboken. Grensene til blokkene til en term ligger rett etter grensene til termen før den.
+    compact->terms = malloc((compact->n_terms + 1) * sizeof(term_entry_t));
+    if (compact->terms == NULL)
+    {
+        pr_error("Failed to allocate memory for compact index\n");
+        return -1;
+    }
+
+    size_t block_pos = 0;
+    for (size_t id = 0; id < compact->n_terms; id++)
+    {
+        term_entry_t *term = &compact->terms[id];
+        term->postings = postings_pack_get(compact->postings, id);
+        term->idf = compact->weights[id].idf;
+        term->max_score = compact->weights[id].max_score;
+        term->block_max_scores = compact->block_max_scores ? &compact->block_max_scores[block_pos] : NULL;
+        block_pos += postings_n_blocks(term->postings);
+    }
+    if (compact->block_max_scores && block_pos != compact->n_blocks)
+    {
+        pr_error("Block bounds do not match the posting lists\n");
+        return -1;
+    }
+    return 0;
+}
+
+static compact_index_t *compact_create(index_t *index)
+{
+    // lager den kompakte utgaven av en frossen index. Termene sorteres og kopieres etter hverandre til term_chars, alle
+    //  dokumentlistene pakkes sammen med postings_pack, og grensene til blokkene kopieres etter hverandre til ett array
+    //  (dersom alle termene har dem). Hver term settes inn i hashtabellen, og dokumentnavnene kopieres til doc_chars.
+    //  Indexen endres ikke, slik at den kan brukes som før dersom noe feiler.
+    size_t n_terms = map_length(index->map);
+    size_t n_slots = 16;
+    while ((double)n_terms > (double)n_slots * COMPACT_MAX_LOAD)
+    {
+        n_slots *= 2;
+    }
+
+    entry_t **entries = malloc((n_terms + 1) * sizeof(entry_t *));
+    postings_t **lists = malloc((n_terms + 1) * sizeof(postings_t *));
+    compact_index_t *compact = calloc(1, sizeof(compact_index_t));
+    if (entries == NULL || lists == NULL || compact == NULL || n_terms >= UINT32_MAX)
+    {
+        pr_error("Failed to allocate memory for compact index\n");
+        free(entries);
+        free(lists);
+        free(compact);
+        return NULL;
+    }
+
+    size_t n = 0, n_blocks = 0;
+    int has_bounds = index->config.pruning != INDEX_PRUNING_NONE;
+    map_iter_t *term_iter = map_createiter(index->map);
+    while (term_iter && map_hasnext(term_iter))
+    {
+        entries[n] = map_next(term_iter);
+        term_entry_t *term = entries[n]->val;
+        compact->term_chars_len += strlen(entries[n]->key) + 1;
+        n_blocks += postings_n_blocks(term->postings);
+        has_bounds = has_bounds && term->block_max_scores != NULL;
+        n++;
+    }
+    map_destroyiter(term_iter);
+    qsort(entries, n, sizeof(entry_t *), compare_entries_by_key);
+    for (size_t i = 0; i < index->amount_of_docs; i++)
+    {
+        compact->doc_chars_len += strlen(index->doc_names[i]) + 1;
+    }
+
+    compact->n_terms = n;
+    compact->n_slots = n_slots;
+    compact->n_blocks = n_blocks;
+    compact->term_chars = malloc(compact->term_chars_len + 1);
+    compact->term_offsets = malloc((n + 1) * sizeof(uint64_t));
+    compact->weights = malloc((n + 1) * sizeof(term_weight_t));
+    compact->slots = calloc(n_slots, sizeof(term_slot_t));
+    compact->doc_chars = malloc(compact->doc_chars_len + 1);
+    compact->doc_offsets = malloc((index->amount_of_docs + 1) * sizeof(uint64_t));
+    if (has_bounds)
+    {
+        compact->block_max_scores = malloc((n_blocks + 1) * sizeof(double));
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        lists[i] = ((term_entry_t *)entries[i]->val)->postings;
+    }
+    compact->postings = postings_pack(lists, n);
+    free(lists);
+
+    if (n != n_terms || compact->term_chars == NULL || compact->term_offsets == NULL || compact->weights == NULL ||
+        compact->slots == NULL || compact->doc_chars == NULL || compact->doc_offsets == NULL ||
+        compact->postings == NULL || (has_bounds && compact->block_max_scores == NULL))
+    {
+        pr_error("Failed to allocate memory for compact index\n");
+        free(entries);
+        compact_destroy(compact);
+        return NULL;
+    }
+
+    size_t term_pos = 0, block_pos = 0, mask = n_slots - 1;
+    for (size_t id = 0; id < n; id++)
+    {
+        term_entry_t *term = entries[id]->val;
+        size_t len = strlen(entries[id]->key) + 1;
+
+        compact->term_offsets[id] = term_pos;
+        memcpy(&compact->term_chars[term_pos], entries[id]->key, len);
+        term_pos += len;
+
+        compact->weights[id].idf = term->idf;
+        compact->weights[id].max_score = term->max_score;
+        if (has_bounds)
+        {
+            size_t term_blocks = postings_n_blocks(term->postings);
+            memcpy(&compact->block_max_scores[block_pos], term->block_max_scores, term_blocks * sizeof(double));
+            block_pos += term_blocks;
+        }
+
+        // termene er unike, så det holder å finne den første ledige plassen
+        uint64_t hash = hash_string_wyhash64(entries[id]->key);
+        size_t i = hash & mask;
+        while (compact->slots[i].term_id != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        compact->slots[i].term_id = (uint32_t)(id + 1);
+        compact->slots[i].tag = (uint32_t)(hash >> 32);
+    }
+    compact->term_offsets[n] = term_pos;
+    free(entries);
+
+    size_t doc_pos = 0;
+    for (size_t i = 0; i < index->amount_of_docs; i++)
+    {
+        size_t len = strlen(index->doc_names[i]) + 1;
+        compact->doc_offsets[i] = doc_pos;
+        memcpy(&compact->doc_chars[doc_pos], index->doc_names[i], len);
+        doc_pos += len;
+    }
+
+    if (compact_link(compact) != 0)
+    {
+        compact_destroy(compact);
+        return NULL;
+    }
+    return compact;
+}
+
+static int compact_shard(index_t *index)
+{
+    // gjør om en frossen index uten shards til den kompakte utgaven, og frigjør term-ordboken, dokumentlistene og
+    //  dokumentnavnene den erstatter. Dokumenttabellen trimmes til nøyaktig størrelse. Cachene tømmes, siden programmene
+    //  i dem peker på termene i term-ordboken.
+    compact_index_t *compact = compact_create(index);
+    if (compact == NULL)
+    {
+        return -1;
+    }
+
+    cache_clear(&index->cache);
+    map_destroy(index->map, free, (free_fn)term_entry_destroy);
+    index->map = NULL;
+    for (size_t i = 0; i < index->amount_of_docs; i++)
+    {
+        free(index->doc_names[i]);
+    }
+    free(index->doc_names);
+    index->doc_names = NULL;
+
+    // det å krympe et array feiler ikke i praksis, og gjør det det beholdes det gamle
+    size_t n_docs = index->amount_of_docs ? index->amount_of_docs : 1;
+    uint32_t *lengths = realloc(index->doc_lengths, n_docs * sizeof(uint32_t));
+    float *norms = realloc(index->doc_norms, n_docs * sizeof(float));
+    index->doc_lengths = lengths ? lengths : index->doc_lengths;
+    index->doc_norms = norms ? norms : index->doc_norms;
+    index->doc_capacity = n_docs;
+
+    index->compact = compact;
+    return 0;
+}
+
+int index_freeze(index_t *index)
+{
+    // fryser indexen med freeze_postings, og gjør den om til den kompakte utgaven med compact_shard. En index med shards
+    //  fryses samlet, og så gjøres hver shard om for seg. Etter dette kan det ikke legges til flere dokumenter.
+    if (index == NULL)
+    {
+        return -1;
+    }
+    if (index_is_compact(index))
+    {
+        return 0;
+    }
+
+    freeze_postings(index);
+    if (!index->frozen)
+    {
+        return -1;
+    }
+    int status = 0;
+    if (index->n_shards == 0)
+    {
+        status = compact_shard(index);
+    }
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        status = compact_shard(index->shards[s]) ? -1 : status;
+    }
+    cache_clear(&index->cache);
+#ifdef __GLIBC__
+    // de mange små allokeringene som er frigjort gis tilbake til systemet, ellers blir de liggende i heapen til malloc
+    malloc_trim(0);
+#endif
+    return status;
+}
+
+typedef struct doc_term
+{
+    // en unik term i et dokument, med antall forekomster og hashen til termen. entry er termen i ordboken etter at
+    //  postingen er lagt til (se add_posting).
+    char *term;
+    uint64_t hash;
+    uint32_t count;
+    term_entry_t *entry;
+} doc_term_t;
+
+typedef struct shard_counts
+{
+    // antall dokumenter og ord i en shard før et dokument legges til, se shard_counts_update
+    size_t amount_of_docs;
+    uint64_t total_length;
+} shard_counts_t;
+
+static void shard_counts_update(index_t *index, index_t *shard, shard_counts_t *before)
+{
+    // legger dokumentene og ordene som faktisk ble lagt til i shard til tellerne i indexen med shards, etter at shard har
+    //  returnert. Et dokument som ikke kunne legges til er ikke registrert i shard, så da endres ikke tellerne, og de er
+    //  alltid summen av shardene.
+    if (shard->amount_of_docs != before->amount_of_docs)
+    {
+        index->frozen = 0;
+        index->amount_of_docs += shard->amount_of_docs - before->amount_of_docs;
+        index->total_length += shard->total_length - before->total_length;
+    }
+}
+
+int index_document(index_t *index, char *doc_name, list_t *terms)
+{
+    // funksjonen er av typen int og forventer en integer i retur. Den tar inn tre argumenter index, doc_name og terms. Den fungerer ved å
+    //  først gjøre plass til dokumentet i dokumenttabellen, og gi det den neste doc id'en uten å legge det til ennå. Deretter telles
+    //  termfrekvensene for dokumentet i et midlertidig map (term -> plass i doc_terms), slik at hver forekomst kun koster ett oppslag
+    //  i en tabell som er like stor som dokumentet. Termene poppes fra listen, og duplikater frigjøres med en gang, slik at doc_terms eier en kopi av hver unike term
+    //  sammen med antallet og hashen. Hver term hashes bare én gang, og hashen brukes igjen i term-ordboken (se add_posting).
+    //  Så legges nøyaktig én posting per unike term inn i den inverterte indexen med add_posting. Dette gjør indekseringen
+    //  lineær i antall ord, i stedet for å lete gjennom hele dokumentlisten til termen for hvert ord.
+    //  Dokumentet legges inn i dokumenttabellen til slutt, når alle postingene er lagt til. Feiler en av dem, fjernes
+    //  postingene som allerede er lagt til igjen med remove_posting, slik at indexen er som før og doc_name frigjøres.
+    if (index == NULL || doc_name == NULL || terms == NULL)
+    {
+        perror("Index, doc_name or terms == NULL!\n");
+        return -1;
+    }
+    if (index_is_compact(index))
+    {
+        pr_error("Index is frozen, and cannot be changed\n");
+        free(doc_name);
+        list_destroy(terms, free);
+        return -1;
+    }
+
+    // i en index med shards legges dokumentet til i den siste, som har de høyeste doc id'ene
+    if (index->n_shards > 0)
+    {
+        index_t *shard = index->shards[index->n_shards - 1];
+        shard_counts_t before = {shard->amount_of_docs, shard->total_length};
+        int status = index_document(shard, doc_name, terms);
+        shard_counts_update(index, shard, &before);
+        return status;
+    }
+
+    // et dokument har aldri flere unike termer enn ord, så term_counts trenger aldri å vokse
+    map_t *term_counts = map_create_with_capacity((cmp_fn)strcmp, (hash64_fn)hash_string_wyhash64, list_length(terms));
+    doc_term_t *doc_terms = malloc((list_length(terms) + 1) * sizeof(doc_term_t));
+    uint32_t length = (uint32_t)list_length(terms);
+    if (term_counts == NULL || doc_terms == NULL || doc_table_reserve(index) != 0)
+    {
+        map_destroy(term_counts, NULL, NULL);
+        free(doc_terms);
+        free(doc_name);
+        list_destroy(terms, free);
+        return -1;
+    }
+
+    size_t n_doc_terms = 0;
+    while (list_length(terms))
+    {
+        char *term = list_popfirst(terms);
+        uint64_t hash = hash_string_wyhash64(term);
+        int inserted;
+        entry_t *entry = map_upsert_hashed(term_counts, term, hash, &inserted);
+        if (inserted)
+        {
+            doc_terms[n_doc_terms] = (doc_term_t){term, hash, 1, NULL};
+            entry->val = COUNT_TO_VAL(n_doc_terms);
+            n_doc_terms++;
+        }
+        else
+        {
+            doc_terms[VAL_TO_COUNT(entry->val)].count++;
+            free(term);
+        }
+    }
+    list_destroy(terms, NULL);
+    map_destroy(term_counts, NULL, NULL);
+
+    index->frozen = 0;
+    cache_clear(&index->cache);
+    uint32_t doc_id = (uint32_t)index->amount_of_docs;
+    size_t n_added = 0;
+    int status = 0;
+    for (size_t i = 0; i < n_doc_terms; i++)
+    {
+        if (status == 0)
+        {
+            status = add_posting(index, doc_terms[i].term, doc_terms[i].hash, doc_id, doc_terms[i].count,
+                                 &doc_terms[i].entry);
+            n_added += (status == 0);
+        }
+        else
+        {
+            free(doc_terms[i].term);
+        }
+    }
+
+    // termene er nå enten overtatt av indexen eller frigjort. Termene som var nye er nøkler i ordboken, og brukes bare
+    //  av remove_posting dersom de fjernes igjen.
+    status = (status == 0) ? doc_table_add(index, doc_name, length, &doc_id) : status;
+    if (status != 0)
+    {
+        for (size_t i = n_added; i > 0; i--)
+        {
+            remove_posting(index, doc_terms[i - 1].entry, doc_terms[i - 1].term, doc_terms[i - 1].hash, doc_id);
+        }
+        free(doc_name);
+    }
+    free(doc_terms);
+    return status;
+}
+
+int index_document_counts(index_t *index, char *doc_name, const char **terms, const uint32_t *counts, size_t n_terms)
+{
+    // som index_document, men for et dokument der termfrekvensene allerede er talt opp, slik at dokumentet ikke må
+    //  tokeniseres på nytt (se manifest.h). Termene er unike og eies av den som kaller, så bare termer som er nye for
+    //  indexen kopieres. De andre slås opp én gang, og postingen legges rett til dokumentlisten deres. Som i
+    //  index_document legges dokumentet inn i dokumenttabellen til slutt, og postingene fjernes igjen dersom det feiler.
+    if (index == NULL || doc_name == NULL || (terms == NULL && n_terms > 0))
+    {
+        pr_error("Index, doc_name or terms == NULL!\n");
+        return -1;
+    }
+    if (index_is_compact(index))
+    {
+        pr_error("Index is frozen, and cannot be changed\n");
+        free(doc_name);
+        return -1;
+    }
+
+    uint64_t length = 0;
+    for (size_t i = 0; i < n_terms; i++)
+    {
+        length += counts[i];
+    }
+    if (length > UINT32_MAX)
+    {
+        pr_error("Document is too long\n");
+        free(doc_name);
+        return -1;
+    }
+
+    if (index->n_shards > 0)
+    {
+        index_t *shard = index->shards[index->n_shards - 1];
+        shard_counts_t before = {shard->amount_of_docs, shard->total_length};
+        int status = index_document_counts(shard, doc_name, terms, counts, n_terms);
+        shard_counts_update(index, shard, &before);
+        return status;
+    }
+
+    term_entry_t **entries = malloc((n_terms + 1) * sizeof(term_entry_t *));
+    if (entries == NULL || doc_table_reserve(index) != 0)
+    {
+        free(entries);
+        free(doc_name);
+        return -1;
+    }
+
+    index->frozen = 0;
+    cache_clear(&index->cache);
+    uint32_t doc_id = (uint32_t)index->amount_of_docs;
+    size_t n_added = 0;
+    int status = 0;
+    while (status == 0 && n_added < n_terms)
+    {
+        uint64_t hash = hash_string_wyhash64(terms[n_added]);
+        entry_t *entry = map_get_hashed(index->map, (void *)terms[n_added], hash);
+        if (entry)
+        {
+            entries[n_added] = entry->val;
+            status = postings_append(entries[n_added]->postings, doc_id, counts[n_added]);
+        }
+        else
+        {
+            char *term = strdup(terms[n_added]);
+            status = term ? add_posting(index, term, hash, doc_id, counts[n_added], &entries[n_added]) : -1;
+        }
+        n_added += (status == 0);
+    }
+
+    status = (status == 0) ? doc_table_add(index, doc_name, (uint32_t)length, &doc_id) : status;
+    if (status != 0)
+    {
+        for (size_t i = n_added; i > 0; i--)
+        {
+            remove_posting(index, entries[i - 1], terms[i - 1], hash_string_wyhash64(terms[i - 1]), doc_id);
+        }
+        free(doc_name);
+    }
+    free(entries);
+    return status;
+}
+
+int index_merge(index_t *dst, index_t *src)
+{
+    // slår sammen to indexer ved å flytte dokumentene og postingene fra src over i dst. Dokumentene i src får doc id'er
+    //  som følger etter de som allerede finnes i dst, og siden postingene i src er sortert legges de til sist i dst sine
+    //  dokumentlister uten å lete. Termer som ikke finnes i dst flyttes over med hele dokumentlisten. Til slutt frigjøres src.
+    //  Shardene til en src med shards slås sammen med dst én etter én, og er dst delt opp havner src i den siste sharden.
+    if (dst == NULL || src == NULL)
+    {
+        pr_error("Index == NULL!\n");
+        index_destroy(src);
+        return -1;
+    }
+    if (index_is_compact(dst) || index_is_compact(src))
+    {
+        pr_error("Index is frozen, and cannot be changed\n");
+        index_destroy(src);
+        return -1;
+    }
+
+    if (src->n_shards > 0)
+    {
+        int status = 0;
+        for (size_t s = 0; s < src->n_shards; s++)
+        {
+            status = index_merge(dst, src->shards[s]) ? -1 : status;
+        }
+        src->n_shards = 0;
+        index_destroy(src);
+        return status;
+    }
+    if (dst->n_shards > 0)
+    {
+        index_t *shard = dst->shards[dst->n_shards - 1];
+        shard_counts_t before = {shard->amount_of_docs, shard->total_length};
+        int status = index_merge(shard, src);
+        shard_counts_update(dst, shard, &before);
+        return status;
+    }
+
+    uint32_t doc_offset = (uint32_t)dst->amount_of_docs;
+    int status = 0;
+
+    // dst får plass til alle dokumentene med en gang, og minst like mange termer som den største av de to
+    size_t n_terms = map_length(dst->map) > map_length(src->map) ? map_length(dst->map) : map_length(src->map);
+    if (doc_table_grow(dst, dst->amount_of_docs + src->amount_of_docs) != 0 || map_reserve(dst->map, n_terms) != 0)
+    {
+        status = -1;
+    }
+
+    for (size_t i = 0; i < src->amount_of_docs; i++)
+    {
+        uint32_t doc_id;
+        if (status == 0 && doc_table_add(dst, src->doc_names[i], src->doc_lengths[i], &doc_id) == 0)
+        {
+            continue;
+        }
+        status = -1;
+        free(src->doc_names[i]);
+    }
+
+    map_iter_t *term_iter = map_createiter(src->map);
+    while (map_hasnext(term_iter))
+    {
+        entry_t *entry = map_next(term_iter);
+        term_entry_t *src_term = entry->val;
+
+        int inserted;
+        entry_t *dst_entry = map_upsert(dst->map, entry->key, &inserted);
+        if (inserted)
+        {
+            postings_offset(src_term->postings, doc_offset);
+            dst_entry->val = src_term;
+            dst->amount_of_terms++;
+            continue;
+        }
+        term_entry_t *dst_term = dst_entry->val;
+
+        if (postings_append_all(dst_term->postings, src_term->postings, doc_offset) != 0)
+        {
+            status = -1;
+        }
+        term_entry_destroy(src_term);
+        free(entry->key);
+    }
+    map_destroyiter(term_iter);
+    dst->frozen = 0;
+    cache_clear(&dst->cache);
+
+    /* dokumentnavn, termer og dokumentlister er nå flyttet eller frigjort */
+    lru_destroy(src->cache.results);
+    lru_destroy(src->cache.subqueries);
+    lru_destroy(src->cache.programs);
+    pthread_mutex_destroy(&src->cache.lock);
+    map_destroy(src->map, NULL, NULL);
+    free(src->doc_names);
+    free(src->doc_lengths);
+    free(src->doc_norms);
+    free(src);
+    return status;
+}
+
+static int topk_offer(heap_t *top, query_result_t **spare, size_t k, char *doc_name, double score)
+{
+    // tilbyr et dokument til heapen med de k beste resultatene. spare er et ledig resultat som fylles inn, og som byttes
+    //  med det dårligste i heapen dersom dokumentet er bedre. Returnerer -1 dersom det ikke var minne til et nytt resultat.
+    (*spare)->doc_name = doc_name;
+    (*spare)->score = score;
+
+    if (heap_length(top) < k)
+    {
+        if (heap_push(top, *spare) == 0)
+        {
+            *spare = malloc(sizeof(query_result_t));
+        }
+        if (*spare == NULL)
+        {
+            pr_error("failed to allocate memory!\n");
+            return -1;
+        }
+    }
+    else if (compare_results_worst_first(heap_peek(top), *spare) < 0)
+    {
+        *spare = heap_replace_top(top, *spare);
+    }
+    return 0;
+}
+
+typedef struct wand_term
+{
+    // en term i en disjunksjon som beskjæres. block_i er blokken som sist ble slått opp i wand_block_max, slik at
+    //  oppslagene fortsetter der forrige sluttet.
+    postings_cursor_t cursor;
+    term_entry_t *term;
+    size_t block_i;
+} wand_term_t;
+
+static double wand_block_max(wand_term_t *wt, uint32_t target, uint32_t *block_last)
+{
+    // finner den høyeste scoren termen kan gi i blokken som har target, og setter block_last til det siste dokumentet i
+    //  blokken. Blokkene slås kun opp i hodene, uten å dekodes.
+    postings_t *postings = wt->term->postings;
+    size_t n_blocks = postings_n_blocks(postings);
+    size_t block_i = wt->block_i > wt->cursor.block_i ? wt->block_i : wt->cursor.block_i;
+    while (block_i < n_blocks && postings_block_last(postings, block_i) < target)
+    {
+        block_i++;
+    }
+    wt->block_i = block_i;
+    if (block_i == n_blocks)
+    {
+        *block_last = POSTINGS_END;
+        return 0.0;
+    }
+    *block_last = postings_block_last(postings, block_i);
+    return wt->term->block_max_scores[block_i];
+}
+
+static int wand_topk(index_t *index, wand_term_t *terms, wand_term_t **sorted, size_t n_terms, heap_t *top,
+                     query_result_t **spare, size_t k, index_query_stats_t *stats)
+{
+    // finner de k beste dokumentene i en disjunksjon med WAND. sorted er termene sortert på dokumentet cursoren står på.
+    //  Den høyeste scoren hver term kan gi summeres i den rekkefølgen, og pivoten er den første termen der summen når
+    //  scoren til det dårligste resultatet i heapen. Ingen dokumenter før pivot-dokumentet kan komme inn blant de k beste,
+    //  så cursorene før pivoten hoppes fram dit. Med block-max WAND summeres i tillegg den høyeste scoren i blokkene som
+    //  har pivot-dokumentet, og er ikke det nok hoppes alle dokumentene fram til den første av blokkene slutter over.
+    //  Scoren regnes ut i samme rekkefølge som termene står i spørringen, slik at den blir den samme som uten beskjæring.
+    //  Returnerer -1 dersom det ikke var minne til et nytt resultat.
+    int block_max = index->config.pruning == INDEX_PRUNING_BLOCK_MAX;
+    int skipped = 0;
+    size_t scored = 0;
+    size_t max_df = 0;
+    int status = 0;
+
+    for (size_t i = 0; i < n_terms; i++)
+    {
+        size_t df = postings_length(terms[i].term->postings);
+        max_df = df > max_df ? df : max_df;
+    }
+
+    while (1)
+    {
+        // insertion sort, siden bare de få termene som ble flyttet i forrige runde er ute av rekkefølge
+        for (size_t i = 1; i < n_terms; i++)
+        {
+            wand_term_t *wt = sorted[i];
+            size_t j = i;
+            for (; j > 0 && sorted[j - 1]->cursor.doc_id > wt->cursor.doc_id; j--)
+            {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = wt;
+        }
+
+        double threshold = heap_length(top) < k ? -INFINITY : ((query_result_t *)heap_peek(top))->score;
+        double bound = 0.0;
+        size_t pivot = 0;
+        for (; pivot < n_terms && sorted[pivot]->cursor.doc_id != POSTINGS_END; pivot++)
+        {
+            bound += sorted[pivot]->term->max_score;
+            if (bound >= threshold)
+            {
+                break;
+            }
+        }
+        if (pivot == n_terms || sorted[pivot]->cursor.doc_id == POSTINGS_END)
+        {
+            skipped |= sorted[0]->cursor.doc_id != POSTINGS_END;
+            break;
+        }
+
+        uint32_t pivot_doc = sorted[pivot]->cursor.doc_id;
+        while (pivot + 1 < n_terms && sorted[pivot + 1]->cursor.doc_id == pivot_doc)
+        {
+            pivot++;
+        }
+
+        if (block_max)
+        {
+            uint32_t next_doc = (pivot + 1 < n_terms) ? sorted[pivot + 1]->cursor.doc_id : POSTINGS_END;
+            double block_bound = 0.0;
+            for (size_t i = 0; i <= pivot; i++)
+            {
+                uint32_t block_last;
+                block_bound += wand_block_max(sorted[i], pivot_doc, &block_last);
+                if (block_last < next_doc - 1)
+                {
+                    next_doc = block_last + 1;
+                }
+            }
+            if (block_bound < threshold)
+            {
+                skipped = 1;
+                for (size_t i = 0; i <= pivot; i++)
+                {
+                    postings_cursor_advance(&sorted[i]->cursor, next_doc);
+                }
+                continue;
+            }
+        }
+
+        if (sorted[0]->cursor.doc_id != pivot_doc)
+        {
+            skipped = 1;
+            for (size_t i = 0; i < pivot && sorted[i]->cursor.doc_id < pivot_doc; i++)
+            {
+                postings_cursor_advance(&sorted[i]->cursor, pivot_doc);
+            }
+            continue;
+        }
+
+        double score = 0.0;
+        for (size_t i = 0; i < n_terms; i++)
+        {
+            if (terms[i].cursor.doc_id == pivot_doc)
+            {
+                score += bm25(index, terms[i].term->idf, postings_cursor_count(&terms[i].cursor), pivot_doc);
+                postings_cursor_next(&terms[i].cursor);
+            }
+        }
+        scored++;
+        if (topk_offer(top, spare, k, doc_name(index, pivot_doc), score) != 0)
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    if (stats)
+    {
+        stats->n_hits = (skipped && max_df > scored) ? max_df : scored;
+        stats->n_hits_exact = !skipped;
+        stats->n_scored = scored;
+    }
+    return status;
+}
+
+static size_t program_collect_wand_terms(program_t *program, wand_term_t *terms, wand_term_t **sorted)
+{
+    // starter en cursor for hver term i en disjunksjon (se plan_is_disjunction), i rekkefølgen de står i programmet.
+    //  Returnerer antall termer.
+    size_t n = 0;
+    for (size_t pc = 0; pc < program->n_code; pc++)
+    {
+        if (program->code[pc].op == OP_TERM)
+        {
+            terms[n].term = program->terms[program->code[pc].arg];
+            postings_cursor_init(&terms[n].cursor, terms[n].term->postings);
+            terms[n].block_i = 0;
+            sorted[n] = &terms[n];
+            n++;
+        }
+    }
+    return n;
+}
+
+static char *tokens_join(list_t *tokens)
+{
+    // slår sammen tokens med mellomrom mellom, som nøkkel i program-cachen
+    size_t length = 1;
+    list_iter_t *tokens_iter = list_createiter(tokens);
+    while (tokens_iter && list_hasnext(tokens_iter))
+    {
+        length += strlen(list_next(tokens_iter)) + 1;
+    }
+    list_destroyiter(tokens_iter);
+
+    char *text = malloc(length);
+    tokens_iter = list_createiter(tokens);
+    if (text == NULL || tokens_iter == NULL)
+    {
+        free(text);
+        list_destroyiter(tokens_iter);
+        return NULL;
+    }
+    char *end = text;
+    *end = '\0';
+    while (list_hasnext(tokens_iter))
+    {
+        end = stpcpy(stpcpy(end, end == text ? "" : " "), list_next(tokens_iter));
+    }
+    list_destroyiter(tokens_iter);
+    return text;
+}
+
+static program_t *program_get(index_t *index, map_t *terms, list_t *query_tokens, const char *text, char *errbuf)
+{
+    // henter programmet til en spørring fra program-cachen, med teksten til spørringen (se tokens_join) som nøkkel.
+    //  Ellers parses spørringen til et AST med handle_not, som blir til en plan (se plan_build) der like deluttrykk
+    //  deles (se plan_share), og planen kompileres til et program som legges i cachen. Uten text brukes ikke cachen.
+    //  terms er termene som er slått opp i batchen spørringen er en del av (se plan_lookup_term), eller NULL.
+    //  Programmet frigjøres med program_release, mens lock er tatt dersom programmet kan være i cachen.
+    //  Returnerer NULL og skriver til errbuf dersom spørringen er ugyldig.
+    query_cache_t *cache = &index->cache;
+    program_t *program = NULL;
+    if (cache->programs && text)
+    {
+        pthread_mutex_lock(&cache->lock);
+        program = lru_get(cache->programs, text);
+        if (program)
+        {
+            cache->program_hits++;
+            program->refs++;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    if (program)
+    {
+        return program;
+    }
+
+    parse_t *parser = parser_create(query_tokens);
+    ast_node_t *ast = handle_not(parser);
+    plan_node_t *plan = plan_build(index, terms, ast, errbuf);
+    ast_destroy(ast);
+    parser_destroy(parser);
+    if (plan)
+    {
+        map_t *shared_nodes = map_create((cmp_fn)strcmp, (hash64_fn)hash_string_wyhash64);
+        if (shared_nodes)
+        {
+            plan_share(plan, shared_nodes);
+            map_destroy(shared_nodes, NULL, NULL);
+        }
+        program = program_compile(plan, cache->subqueries != NULL);
+        plan_destroy(plan);
+        if (program == NULL)
+        {
+            snprintf(errbuf, LINE_MAX, "Failed to allocate memory for the query program");
+        }
+    }
+
+    if (program && cache->programs && text)
+    {
+        pthread_mutex_lock(&cache->lock);
+        cache->program_misses++;
+        program->refs++;
+        if (lru_put(cache->programs, text, program, program_size(program)) != 0)
+        {
+            program->refs--;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    return program;
+}
+
+static list_t *query_run(index_t *index, program_t *program, size_t k, index_query_stats_t *stats, char *errbuf)
+{
+    // funksjonen er av typen list_t og forventer samme returverdi. Den tar inn fem argumenter
+    // index som er den inverterte indexen, program som er den kompilerte spørringen (se program_get), k som er hvor mange av de
+    // beste resultatene som skal returneres, stats som fylles inn med antall treff og errbuf som er en buffer for feilmeldinger.
+    // Programmet kjøres for å finne hvilke doc id'er som matcher. Med sett-motoren lagres disse som et sortert array i
+    // result_docs, og med iterator-motoren (standard) lages et iterator-tre i result_iter som gir ett dokument om gangen,
+    // slik at ingen mellomresultater lagres.
+    // Hvert dokument scores med BM25 i samme gjennomgang som det hentes ut, ved å summere bidragene fra termene i
+    // spørringen som har dokumentet (operandene til &! teller ikke), uansett hvilke av alternativene til en OR som
+    // matchet. Begge motorene flytter én cursor per term fram til dokumentene i resultatet, slik at de gir samme score.
+    // Dokumentene som matcher telles, og de k beste holdes i en min-heap der det dårligste ligger øverst. Et nytt dokument
+    // som er bedre enn det dårligste erstatter det, slik at vi aldri har mer enn k resultater i minnet. Her slås doc id opp i
+    // dokumenttabellen, og dette er det eneste stedet der vi går fra doc id til dokumentnavn. Til slutt tømmes heapen inn
+    // i resultatlisten, med det beste resultatet først.
+    // Er spørringen en disjunksjon og beskjæring er slått på, brukes WAND i stedet (se wand_topk), som hopper over
+    // dokumentene som ikke kan komme inn blant de k beste.
+    // Før evalueringen slås den kanoniske nøkkelen til programmet opp i resultat-cachen, og etterpå legges resultatene inn.
+    // Indexen må være fryst (se freeze_postings), og endres ikke her utenom cachene, slik at flere spørringer kan kjøres
+    // samtidig. Programmet frigjøres ikke.
+    index_query_stats_t own_stats;
+    stats = stats ? stats : &own_stats;
+    list_t *cached_results = cache_lookup(index, program->key, k, stats);
+    if (cached_results)
+    {
+        return cached_results;
+    }
+    size_t requested_k = k;
+
+    query_exec_t exec = {index, program, calloc(program->n_slots + 1, sizeof(docset_t *))};
+    list_t *results = list_create(NULL);
+    heap_t *top = heap_create((cmp_fn)compare_results_worst_first);
+    query_result_t *spare = malloc(sizeof(query_result_t));
+    docset_t *result_docs = NULL;
+    doc_iter_t *result_iter = NULL;
+    scored_term_t *scored_terms = NULL;
+    size_t n_scored_terms = 0;
+    wand_term_t *wand_terms = NULL;
+    wand_term_t **wand_sorted = NULL;
+    size_t n_wand_terms = 0;
+    int pruned = k > 0 && index->config.pruning != INDEX_PRUNING_NONE && program->disjunction;
+
+    if (pruned)
+    {
+        wand_terms = malloc(program->n_terms * sizeof(wand_term_t));
+        wand_sorted = malloc(program->n_terms * sizeof(wand_term_t *));
+        if (wand_terms && wand_sorted)
+        {
+            n_wand_terms = program_collect_wand_terms(program, wand_terms, wand_sorted);
+        }
+    }
+    else if (exec.memo)
+    {
+        if (index->config.engine == INDEX_ENGINE_SETS)
+        {
+            result_docs = program_run(&exec, 0, program->n_code);
+        }
+        else
+        {
+            result_iter = iter_build(&exec);
+        }
+        n_scored_terms = program->n_scored;
+        scored_terms = malloc((n_scored_terms + 1) * sizeof(scored_term_t));
+        if (scored_terms)
+        {
+            program_start_scored_terms(program, scored_terms);
+        }
+    }
+
+    for (size_t i = 0; exec.memo && i < program->n_slots; i++)
+    {
+        docset_destroy(exec.memo[i]);
+    }
+    free(exec.memo);
+
+    if ((pruned && (wand_terms == NULL || wand_sorted == NULL)) ||
+        (!pruned && ((result_docs == NULL && result_iter == NULL) || scored_terms == NULL)) ||
+        results == NULL || top == NULL || spare == NULL)
+    {
+        snprintf(errbuf, LINE_MAX, "Failed to create results list");
+        list_destroy(results, NULL);
+        heap_destroy(top, NULL);
+        free(spare);
+        free(scored_terms);
+        free(wand_terms);
+        free(wand_sorted);
+        docset_destroy(result_docs);
+        iter_destroy(result_iter);
+        return NULL;
+    }
+
+    // med beskjæring finner wand_topk de k beste uten å score alle dokumentene. Ellers er alle dokumentene allerede i
+    //  result_docs med sett-motoren, og med iteratorene hentes ett og ett dokument fra roten.
+    k = k ? k : SIZE_MAX;
+    if (pruned)
+    {
+        wand_topk(index, wand_terms, wand_sorted, n_wand_terms, top, &spare, k, stats);
+    }
+    else
+    {
+        size_t hits = 0;
+        size_t result_i = 0;
+        uint32_t doc_id = result_docs ? (result_docs->length ? result_docs->doc_ids[0] : POSTINGS_END) : result_iter->doc_id;
+        while (doc_id != POSTINGS_END)
+        {
+            hits++;
+            double score = score_terms(index, scored_terms, n_scored_terms, doc_id);
+            if (topk_offer(top, &spare, k, doc_name(index, doc_id), score) != 0)
+            {
+                break;
+            }
+
+            if (result_docs)
+            {
+                doc_id = (++result_i < result_docs->length) ? result_docs->doc_ids[result_i] : POSTINGS_END;
+            }
+            else
+            {
+                doc_id = iter_next(result_iter);
+            }
+        }
+
+        stats->n_hits = hits;
+        stats->n_hits_exact = 1;
+        stats->n_scored = hits;
+    }
+
+    while (heap_length(top) > 0)
+    {
+        list_addfirst(results, heap_pop(top));
+    }
+    cache_insert(index, program->key, requested_k, results, stats);
+
+    heap_destroy(top, NULL);
+    free(spare);
+    free(scored_terms);
+    free(wand_terms);
+    free(wand_sorted);
+    docset_destroy(result_docs);
+    iter_destroy(result_iter);
+    return results;
+}
+
+static list_t *sharded_query_topk(index_t *index, list_t *query_tokens, program_t **programs, size_t k,
+                                  index_query_stats_t *stats, char *errbuf);
+
+list_t *index_query_topk(index_t *index, list_t *query_tokens, size_t k, index_query_stats_t *stats, char *errbuf)
+{
+    // fryser indexen, henter det kompilerte programmet til spørringen (se program_get), som bare parses og kompileres
+    //  første gang, og kjører det med query_run. En index med shards spør alle shardene (se sharded_query_topk).
+    freeze_postings(index);
+    if (index->n_shards > 0)
+    {
+        return sharded_query_topk(index, query_tokens, NULL, k, stats, errbuf);
+    }
+
+    char *text = index->cache.programs ? tokens_join(query_tokens) : NULL;
+    program_t *program = program_get(index, NULL, query_tokens, text, errbuf);
+    free(text);
+    if (program == NULL)
+    {
+        return NULL;
+    }
+    list_t *results = query_run(index, program, k, stats, errbuf);
+    pthread_mutex_lock(&index->cache.lock);
+    program_release(program);
+    pthread_mutex_unlock(&index->cache.lock);
+    return results;
+}
+
+typedef struct shard_fanout
+{
+    // teller hvor mange av shardene som ikke er ferdige med en spørring, slik at tråden som spør kan vente på dem
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    size_t n_pending;
+} shard_fanout_t;
+
+typedef struct shard_query
+{
+    // spørringen til én shard, når en spørring kjøres på alle shardene samtidig. program er det ferdig kompilerte
+    //  programmet til spørringen i shardet, eller NULL dersom shardet skal kompilere tokens selv.
+    index_t *shard;
+    list_t *tokens;
+    program_t *program;
+    size_t k;
+    list_t *results;
+    index_query_stats_t stats;
+    char errbuf[LINE_MAX];
+    shard_fanout_t *fanout;
+} shard_query_t;
+
+static void shard_query_run(void *arg)
+{
+    shard_query_t *query = arg;
+    query->errbuf[0] = '\0';
+    if (query->program)
+    {
+        query->results = query_run(query->shard, query->program, query->k, &query->stats, query->errbuf);
+    }
+    else
+    {
+        query->results = index_query_topk(query->shard, query->tokens, query->k, &query->stats, query->errbuf);
+    }
+
+    pthread_mutex_lock(&query->fanout->lock);
+    if (--query->fanout->n_pending == 0)
+    {
+        pthread_cond_signal(&query->fanout->done);
+    }
+    pthread_mutex_unlock(&query->fanout->lock);
+}
+
+static list_t *sharded_query_topk(index_t *index, list_t *query_tokens, program_t **programs, size_t k,
+                                  index_query_stats_t *stats, char *errbuf)
+{
+    // kjører spørringen på alle shardene samtidig, den første på denne tråden og resten på trådene i pool, og slår sammen
+    //  de k beste fra hver shard til de k beste totalt i en heap med det dårligste øverst. Siden IDF-ene og
+    //  dokumentlengdene er regnet ut for alle shardene samlet (se freeze_postings), blir resultatene de samme som fra én
+    //  index med alle dokumentene. Antall treff summeres, og er bare eksakt dersom det er eksakt i alle shardene.
+    //  programs er programmet til spørringen i hver shard dersom det allerede er kompilert (se index_query_batch), og
+    //  ellers NULL.
+    shard_query_t *queries = calloc(index->n_shards, sizeof(shard_query_t));
+    if (queries == NULL)
+    {
+        snprintf(errbuf, LINE_MAX, "Failed to allocate memory for the query");
+        return NULL;
+    }
+    shard_fanout_t fanout = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, index->n_shards};
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        queries[s].shard = index->shards[s];
+        queries[s].tokens = query_tokens;
+        queries[s].program = programs ? programs[s] : NULL;
+        queries[s].k = k;
+        queries[s].fanout = &fanout;
+    }
+
+    for (size_t s = 1; s < index->n_shards; s++)
+    {
+        if (threadpool_submit(index->pool, shard_query_run, &queries[s]) != 0)
+        {
+            shard_query_run(&queries[s]);
+        }
+    }
+    shard_query_run(&queries[0]);
+    pthread_mutex_lock(&fanout.lock);
+    while (fanout.n_pending > 0)
+    {
+        pthread_cond_wait(&fanout.done, &fanout.lock);
+    }
+    pthread_mutex_unlock(&fanout.lock);
+    pthread_mutex_destroy(&fanout.lock);
+    pthread_cond_destroy(&fanout.done);
+
+    index_query_stats_t own_stats;
+    stats = stats ? stats : &own_stats;
+    memset(stats, 0, sizeof(index_query_stats_t));
+    stats->n_hits_exact = 1;
+    k = k ? k : SIZE_MAX;
+
+    list_t *results = list_create(NULL);
+    heap_t *top = heap_create((cmp_fn)compare_results_worst_first);
+    int failed = (results == NULL || top == NULL);
+    if (failed)
+    {
+        snprintf(errbuf, LINE_MAX, "Failed to create results list");
+    }
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        if (queries[s].results == NULL)
+        {
+            if (!failed)
+            {
+                memcpy(errbuf, queries[s].errbuf, LINE_MAX);
+            }
+            failed = 1;
+            continue;
+        }
+        stats->n_hits += queries[s].stats.n_hits;
+        stats->n_hits_exact &= queries[s].stats.n_hits_exact;
+        stats->n_scored += queries[s].stats.n_scored;
+
+        while (list_length(queries[s].results) > 0)
+        {
+            query_result_t *result = list_popfirst(queries[s].results);
+            if (failed || heap_push(top, result) != 0)
+            {
+                free(result);
+            }
+            else if (heap_length(top) > k)
+            {
+                free(heap_pop(top));
+            }
+        }
+        list_destroy(queries[s].results, NULL);
+    }
+    free(queries);
+
+    if (failed)
+    {
+        list_destroy(results, NULL);
+        heap_destroy(top, free);
+        return NULL;
+    }
+    while (heap_length(top) > 0)
+    {
+        list_addfirst(results, heap_pop(top));
+    }
+    heap_destroy(top, NULL);
+    return results;
+}
+
+typedef struct query_batch
+{
+    // en batch med spørringer som kjøres av arbeidertrådene. programs har n_units programmer til hver spørring, ett til
+    //  hver shard (eller ett til en index uten shards), som alle er NULL dersom spørringen var ugyldig. next er den
+    //  neste spørringen som ingen tråd har tatt ennå.
+    index_t *index;
+    index_batch_query_t *queries;
+    program_t **programs;
+    size_t n_units;
+    size_t n_queries;
+    size_t k;
+    atomic_size_t next;
+} query_batch_t;
+
+static void batch_worker(void *arg)
+{
+    // kjører spørringer fra batchen til alle er tatt. Hver tråd tar den neste ledige spørringen, slik at alle trådene
+    //  holder seg opptatt selv om noen spørringer tar mye lengre tid enn andre.
+    query_batch_t *batch = arg;
+    char errbuf[LINE_MAX];
+    size_t i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->n_queries)
+    {
+        index_batch_query_t *query = &batch->queries[i];
+        program_t **programs = &batch->programs[i * batch->n_units];
+        if (programs[0] == NULL)
+        {
+            continue;
+        }
+        errbuf[0] = '\0';
+        if (batch->index->n_shards > 0)
+        {
+            query->results = sharded_query_topk(batch->index, query->tokens, programs, batch->k, &query->stats, errbuf);
+        }
+        else
+        {
+            query->results = query_run(batch->index, programs[0], batch->k, &query->stats, errbuf);
+        }
+        if (query->results == NULL)
+        {
+            query->errmsg = strdup(errbuf[0] ? errbuf : "Failed to run query");
+        }
+    }
+}
+
+int index_query_batch(index_t *index, index_batch_query_t *queries, size_t n_queries, size_t k, size_t n_threads)
+{
+    // kjører en batch med spørringer i to steg. Først kompileres spørringene én etter én på denne tråden, i hver shard
+    //  for seg i en index med shards. Termene som er slått opp i batchen ligger i batch_terms, én tabell per shard, og
+    //  alle programmene kompileres fra dem (se plan_lookup_term), slik at hver ulike term bare slås opp én gang i hver
+    //  shard selv om den er med i mange spørringer. Like spørringer i batchen finnes i batch_programs, som går fra teksten
+    //  til programmene, slik at de bare parses og kompileres én gang, også uten program-cachen. Deretter kjøres
+    //  programmene på n_threads arbeidertråder (se batch_worker), med query_run eller sharded_query_topk, mens
+    //  resultatene skrives til spørringene i samme rekkefølge som de kom. Til slutt frigjøres programmene igjen her.
+    if (index == NULL || (queries == NULL && n_queries > 0) || n_threads == 0)
+    {
+        pr_error("Invalid batch\n");
+        return -1;
+    }
+
+    freeze_postings(index);
+
+    size_t n_units = index->n_shards > 0 ? index->n_shards : 1;
+    query_batch_t batch = {index, queries, calloc(n_queries * n_units + 1, sizeof(program_t *)), n_units, n_queries, k, 0};
+    map_t *batch_programs = map_create((cmp_fn)strcmp, (hash64_fn)hash_string_wyhash64);
+    map_t **batch_terms = calloc(n_units, sizeof(map_t *));
+    int failed = batch.programs == NULL || batch_programs == NULL || batch_terms == NULL;
+    for (size_t u = 0; !failed && u < n_units; u++)
+    {
+        batch_terms[u] = map_create((cmp_fn)strcmp, (hash64_fn)hash_string_wyhash64);
+        failed = batch_terms[u] == NULL;
+    }
+    if (failed)
+    {
+        pr_error("failed to allocate memory!\n");
+        for (size_t u = 0; batch_terms && u < n_units; u++)
+        {
+            map_destroy(batch_terms[u], NULL, NULL);
+        }
+        free(batch_terms);
+        free(batch.programs);
+        map_destroy(batch_programs, NULL, NULL);
+        return -1;
+    }
+
+    char errbuf[LINE_MAX];
+    for (size_t i = 0; i < n_queries; i++)
+    {
+        index_batch_query_t *query = &queries[i];
+        program_t **programs = &batch.programs[i * n_units];
+        query->results = NULL;
+        query->errmsg = NULL;
+        memset(&query->stats, 0, sizeof(index_query_stats_t));
+
+        char *text = tokens_join(query->tokens);
+        entry_t *entry = text ? map_get(batch_programs, text) : NULL;
+        if (entry)
+        {
+            program_t **same = entry->val;
+            for (size_t u = 0; u < n_units; u++)
+            {
+                programs[u] = same[u];
+                programs[u]->refs++;
+            }
+            free(text);
+            continue;
+        }
+
+        errbuf[0] = '\0';
+        for (size_t u = 0; u < n_units && (u == 0 || programs[u - 1]); u++)
+        {
+            index_t *unit = index->n_shards > 0 ? index->shards[u] : index;
+            programs[u] = program_get(unit, batch_terms[u], query->tokens, text, errbuf);
+        }
+        if (programs[n_units - 1] == NULL)
+        {
+            // alle programmene til en ugyldig spørring er NULL, slik at batch_worker hopper over den
+            for (size_t u = 0; u < n_units; u++)
+            {
+                program_release(programs[u]);
+                programs[u] = NULL;
+            }
+            query->errmsg = strdup(errbuf[0] ? errbuf : "Failed to compile query");
+            free(text);
+        }
+        else if (text)
+        {
+            map_insert(batch_programs, text, programs);
+        }
+    }
+    map_destroy(batch_programs, free, NULL);
+    for (size_t u = 0; u < n_units; u++)
+    {
+        map_destroy(batch_terms[u], free, NULL);
+    }
+    free(batch_terms);
+
+    threadpool_t *pool = (n_threads > 1) ? threadpool_create(n_threads) : NULL;
+    for (size_t t = 0; pool && t < n_threads; t++)
+    {
+        threadpool_submit(pool, batch_worker, &batch);
+    }
+    // venter på arbeidertrådene. Uten dem, eller dersom noen av spørringene ikke ble tatt, kjøres resten her.
+    threadpool_destroy(pool);
+    batch_worker(&batch);
+
+    for (size_t i = 0; i < n_queries * n_units; i++)
+    {
+        program_release(batch.programs[i]);
+    }
+    free(batch.programs);
+    return 0;
+}
+
+list_t *index_query(index_t *index, list_t *query_tokens, char *errbuf)
+{
+    // returnerer alle resultatene, sortert med det beste først
+    return index_query_topk(index, query_tokens, 0, NULL, errbuf);
+}
+
+void index_stat(index_t *index, size_t *n_docs, size_t *n_terms)
+{
+    // funksjonen er av typen void og returnerer derfor ingenting. Den tar inn tre argumenter en peker til index-strukturen,
+    // og to pekere til variabler der antall dokumenter og antall unike termer skal lagres.
+    // funksjonen begynner med å sjekke om noen av pekerne er NULL. Hvis dette stemmer returneres det direkte uten å gjøre noe mer.
+    // hvis alt er gyldig, settes verdiene til n_docs og n_terms ved å hente tallene direkte fra index-strukturen.
+
+    if (index == NULL || n_docs == NULL || n_terms == NULL)
+    {
+        return;
+    }
+
+    // termene i en index med shards telles når den fryses, siden samme term kan finnes i flere shards
+    if (index->n_shards > 0)
+    {
+        freeze_postings(index);
+    }
+    *n_docs = index->amount_of_docs;
+    *n_terms = index->amount_of_terms;
+}
+
+static void cache_stats_add(index_cache_stats_t *sum, index_cache_stats_t *shard)
+{
+    sum->hits += shard->hits;
+    sum->misses += shard->misses;
+    sum->n_entries += shard->n_entries;
+    sum->n_bytes += shard->n_bytes;
+    sum->budget += shard->budget;
+}
+
+static void sharded_stat_detail(index_t *index, index_stats_t *stats)
+{
+    // summerer statistikken til shardene, som hver har sine egne cacher. En term som finnes i flere shards telles i
+    //  klassen til dokumentlisten sin i hver av dem.
+    freeze_postings(index);
+    stats->compact = index_is_compact(index);
+    for (size_t s = 0; s < index->n_shards; s++)
+    {
+        index_stats_t shard_stats;
+        index_stat_detail(index->shards[s], &shard_stats);
+        for (size_t c = 0; c < INDEX_N_TERM_CLASSES; c++)
+        {
+            stats->term_classes[c].n_terms += shard_stats.term_classes[c].n_terms;
+            stats->term_classes[c].n_postings += shard_stats.term_classes[c].n_postings;
+            stats->term_classes[c].raw_bytes += shard_stats.term_classes[c].raw_bytes;
+            stats->term_classes[c].compressed_bytes += shard_stats.term_classes[c].compressed_bytes;
+        }
+        cache_stats_add(&stats->cache, &shard_stats.cache);
+        cache_stats_add(&stats->subquery_cache, &shard_stats.subquery_cache);
+        cache_stats_add(&stats->program_cache, &shard_stats.program_cache);
+    }
+}
+
+void index_stat_detail(index_t *index, index_stats_t *stats)
+{
+    // fyller inn detaljert statistikk om indexen. Termene deles inn i klasser etter hvor mange dokumenter de finnes i
+    //  (1, 2-15, 16-255, 256-4095, 4096+), og for hver klasse summeres antall termer og postinger, og hvor mange bytes
+    //  postingene tar komprimert og hvor mange de ville tatt som vanlige 32-bits doc id'er og antall. I tillegg kopieres
+    //  tellerne til cachene.
+    static const size_t class_min_docs[INDEX_N_TERM_CLASSES] = {1, 2, 16, 256, 4096};
+
+    memset(stats, 0, sizeof(index_stats_t));
+    stats->codec = index->config.codec;
+    for (size_t c = 0; c < INDEX_N_TERM_CLASSES; c++)
+    {
+        stats->term_classes[c].min_docs = class_min_docs[c];
+        stats->term_classes[c].max_docs = (c + 1 < INDEX_N_TERM_CLASSES) ? class_min_docs[c + 1] - 1 : 0;
+    }
+    if (index->n_shards > 0)
+    {
+        sharded_stat_detail(index, stats);
+        return;
+    }
+
+    query_cache_t *cache = &index->cache;
+    stats->cache.hits = cache->result_hits;
+    stats->cache.misses = cache->result_misses;
+    stats->cache.n_entries = cache->results ? lru_length(cache->results) : 0;
+    stats->cache.n_bytes = cache->results ? lru_bytes(cache->results) : 0;
+    stats->cache.budget = index->config.cache_bytes;
+    stats->subquery_cache.hits = cache->subquery_hits;
+    stats->subquery_cache.misses = cache->subquery_misses;
+    stats->subquery_cache.n_entries = cache->subqueries ? lru_length(cache->subqueries) : 0;
+    stats->subquery_cache.n_bytes = cache->subqueries ? lru_bytes(cache->subqueries) : 0;
+    stats->subquery_cache.budget = index->config.subquery_cache_bytes;
+    stats->program_cache.hits = cache->program_hits;
+    stats->program_cache.misses = cache->program_misses;
+    stats->program_cache.n_entries = cache->programs ? lru_length(cache->programs) : 0;
+    stats->program_cache.n_bytes = cache->programs ? lru_bytes(cache->programs) : 0;
+    stats->program_cache.budget = index->config.program_cache_bytes;
+
+    freeze_postings(index);
+
+    stats->compact = index->compact != NULL;
+    compact_index_t *compact = index->compact;
+    map_iter_t *term_iter = compact ? NULL : map_createiter(index->map);
+    for (size_t i = 0; compact ? i < compact->n_terms : map_hasnext(term_iter); i++)
+    {
+        term_entry_t *term = compact ? &compact->terms[i] : map_next(term_iter)->val;
+        postings_t *postings = term->postings;
+        size_t n_docs = postings_length(postings);
+
+        size_t c = INDEX_N_TERM_CLASSES - 1;
+        while (c > 0 && n_docs < class_min_docs[c])
+        {
+            c--;
+        }
+
+        index_term_class_t *term_class = &stats->term_classes[c];
+        term_class->n_terms++;
+        term_class->n_postings += n_docs;
+        term_class->raw_bytes += postings_raw_bytes(postings);
+        term_class->compressed_bytes += postings_size_bytes(postings);
+    }
+    if (term_iter)
+    {
+        map_destroyiter(term_iter);
+    }
+}
+
+typedef struct file_header
+{
+    // starten av en lagret index. checksum er hash_bytes_wyhash64 av resten av filen etter checksum, slik at en fil som er
+    //  skadet oppdages før den brukes når den lastes med INDEX_VERIFY_FULL. byte_order blir et annet tall på en maskin med en annen
+    //  byte-rekkefølge, der filen ikke kan brukes. Resten er innstillingene og tallene til hele indexen, og etter den
+    //  kommer en file_shard_t for hver shard (én for en index uten shards).
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t checksum;
+    uint64_t file_size;
+    uint32_t codec;
+    uint32_t reserved;
+    double bm25_k1;
+    double bm25_b;
+    uint64_t n_docs;
+    uint64_t n_terms;
+    uint64_t total_length;
+    uint64_t n_shards;
+} file_header_t;
+
+typedef enum file_section_type
+{
+    SECTION_DOC_LENGTHS,
+    SECTION_DOC_NORMS,
+    SECTION_DOC_OFFSETS,
+    SECTION_DOC_CHARS,
+    SECTION_TERM_OFFSETS,
+    SECTION_TERM_CHARS,
+    SECTION_TERM_WEIGHTS,
+    SECTION_TERM_SLOTS,
+    SECTION_BLOCK_MAX_SCORES,
+    SECTION_POSTINGS,
+    N_FILE_SECTIONS
+} file_section_type_t;
+
+typedef struct file_section
+{
+    // hvor i filen et av arrayene til en shard ligger, og hvor mange bytes det er
+    uint64_t offset;
+    uint64_t size;
+} file_section_t;
+
+typedef struct file_shard
+{
+    // tallene til en shard, og hvor arrayene i den kompakte utgaven av shardene ligger i filen
+    uint64_t n_docs;
+    uint64_t total_length;
+    uint64_t n_terms;
+    uint64_t n_slots;
+    uint64_t n_blocks;
+    uint64_t has_bounds;
+    file_section_t sections[N_FILE_SECTIONS];
+} file_shard_t;
+
+static void file_shard_layout(index_t *shard, file_shard_t *fs, uint64_t *offset)
+{
+    // fyller inn tallene til en kompakt shard og plasserer arrayene dens etter hverandre i filen fra offset
+    compact_index_t *compact = shard->compact;
+    fs->n_docs = shard->amount_of_docs;
+    fs->total_length = shard->total_length;
+    fs->n_terms = compact->n_terms;
+    fs->n_slots = compact->n_slots;
+    fs->n_blocks = compact->n_blocks;
+    fs->has_bounds = compact->block_max_scores != NULL;
+
+    fs->sections[SECTION_DOC_LENGTHS].size = fs->n_docs * sizeof(uint32_t);
+    fs->sections[SECTION_DOC_NORMS].size = fs->n_docs * sizeof(float);
+    fs->sections[SECTION_DOC_OFFSETS].size = fs->n_docs * sizeof(uint64_t);
+    fs->sections[SECTION_DOC_CHARS].size = compact->doc_chars_len;
+    fs->sections[SECTION_TERM_OFFSETS].size = (fs->n_terms + 1) * sizeof(uint64_t);
+    fs->sections[SECTION_TERM_CHARS].size = compact->term_chars_len;
+    fs->sections[SECTION_TERM_WEIGHTS].size = fs->n_terms * sizeof(term_weight_t);
+    fs->sections[SECTION_TERM_SLOTS].size = fs->n_slots * sizeof(term_slot_t);
+    fs->sections[SECTION_BLOCK_MAX_SCORES].size = fs->has_bounds ? fs->n_blocks * sizeof(double) : 0;
+    fs->sections[SECTION_POSTINGS].size = postings_pack_file_size(compact->postings);
+    for (size_t i = 0; i < N_FILE_SECTIONS; i++)
+    {
+        fs->sections[i].offset = *offset;
+        *offset += FILE_PAD8(fs->sections[i].size);
+    }
+}
+
+static int file_write_padded(FILE *f, const void *data, size_t size)
+{
+    static const uint8_t zeros[8] = {0};
+    size_t padding = FILE_PAD8(size) - size;
+    return ((size == 0 || fwrite(data, 1, size, f) == size) && fwrite(zeros, 1, padding, f) == padding) ? 0 : -1;
+}
+
+static int file_write_shard(FILE *f, index_t *shard)
+{
+    // skriver arrayene til en kompakt shard i samme rekkefølge som file_shard_layout plasserer dem
+    compact_index_t *compact = shard->compact;
+    size_t n_docs = shard->amount_of_docs;
+    int status = 0;
+    status |= file_write_padded(f, shard->doc_lengths, n_docs * sizeof(uint32_t));
+    status |= file_write_padded(f, shard->doc_norms, n_docs * sizeof(float));
+    status |= file_write_padded(f, compact->doc_offsets, n_docs * sizeof(uint64_t));
+    status |= file_write_padded(f, compact->doc_chars, compact->doc_chars_len);
+    status |= file_write_padded(f, compact->term_offsets, (compact->n_terms + 1) * sizeof(uint64_t));
+    status |= file_write_padded(f, compact->term_chars, compact->term_chars_len);
+    status |= file_write_padded(f, compact->weights, compact->n_terms * sizeof(term_weight_t));
+    status |= file_write_padded(f, compact->slots, compact->n_slots * sizeof(term_slot_t));
+    if (compact->block_max_scores)
+    {
+        status |= file_write_padded(f, compact->block_max_scores, compact->n_blocks * sizeof(double));
+    }
+    status |= postings_pack_write(compact->postings, f);
+    return status ? -1 : 0;
+}
+
+int index_save(index_t *index, const char *path)
+{
+    // fryser indexen med index_freeze og skriver den kompakte utgaven til fil: headeren, en file_shard_t per shard, og så
+    //  arrayene til hver shard. Filen skrives først til path.tmp og får navnet path når den er ferdig, slik at en fil som
+    //  allerede finnes aldri blir halvveis skrevet over.
+    if (index == NULL || path == NULL || index_freeze(index) != 0)
+    {
+        return -1;
+    }
+    index_t **shards = index->n_shards > 0 ? index->shards : &index;
+    size_t n_shards = index->n_shards > 0 ? index->n_shards : 1;
+
+    file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.version = INDEX_FILE_VERSION;
+    header.byte_order = INDEX_FILE_BYTE_ORDER;
+    header.codec = index->config.codec;
+    header.bm25_k1 = index->config.bm25_k1;
+    header.bm25_b = index->config.bm25_b;
+    header.n_docs = index->amount_of_docs;
+    header.n_terms = index->amount_of_terms;
+    header.total_length = index->total_length;
+    header.n_shards = n_shards;
+
+    file_shard_t *table = calloc(n_shards, sizeof(file_shard_t));
+    size_t tmp_len = strlen(path) + sizeof(".tmp");
+    char *tmp_path = malloc(tmp_len);
+    if (table == NULL || tmp_path == NULL)
+    {
+        pr_error("Failed to allocate memory\n");
+        free(table);
+        free(tmp_path);
+        return -1;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    uint64_t offset = sizeof(file_header_t) + n_shards * sizeof(file_shard_t);
+    for (size_t s = 0; s < n_shards; s++)
+    {
+        file_shard_layout(shards[s], &table[s], &offset);
+    }
+    header.file_size = offset;
+
+    FILE *f = fopen(tmp_path, "wb");
+    int status = f ? 0 : -1;
+    status = (status == 0 && fwrite(&header, sizeof(header), 1, f) == 1) ? 0 : -1;
+    status = (status == 0 && fwrite(table, sizeof(file_shard_t), n_shards, f) == n_shards) ? 0 : -1;
+    for (size_t s = 0; status == 0 && s < n_shards; s++)
+    {
+        status = file_write_shard(f, shards[s]);
+    }
+    if (f != NULL && fclose(f) != 0)
+    {
+        status = -1;
+    }
+    if (status == 0 && (file_write_checksum(tmp_path, offsetof(file_header_t, checksum)) != 0 || rename(tmp_path, path) != 0))
+    {
+        status = -1;
+    }
+    if (status != 0)
+    {
+        pr_error("Failed to write index to \"%s\": %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+
+    free(table);
+    free(tmp_path);
+    return status;
+}
+
+static const void *file_section(const uint8_t *base, const file_shard_t *fs, file_section_type_t type, size_t size)
+{
+    // henter et array fra filen, eller NULL dersom det ikke har størrelsen size
+    const file_section_t *section = &fs->sections[type];
+    return section->size == size ? base + section->offset : NULL;
+}
+
+static index_t *file_load_shard(const uint8_t *base, size_t file_size, const file_shard_t *fs,
+                                const index_config_t *config)
+{
+    // lager en kompakt shard der arrayene brukes direkte fra filen. Bare term_entry_t til hver term og listene i
+    //  dokumentlistene allokeres. Alle arrayene sjekkes mot størrelsen til filen, og det må være like mange
+    //  dokumentlister som termer. Med INDEX_VERIFY_FULL sjekkes også alle offsetene inn i term_chars, doc_chars og terms,
+    //  og hver blokk i dokumentlistene med postings_pack_verify, slik at ingen doc id er utenfor dokumenttabellen og
+    //  dekodingen aldri leser utenfor listen sin. Uten det leses ikke resten av filen før spørringene trenger den.
+    for (size_t i = 0; i < N_FILE_SECTIONS; i++)
+    {
+        const file_section_t *section = &fs->sections[i];
+        if (section->offset % 8 != 0 || section->offset > file_size || section->size > file_size - section->offset)
+        {
+            return NULL;
+        }
+    }
+    size_t n_slots = fs->n_slots;
+    if (fs->n_terms >= UINT32_MAX || fs->n_docs > UINT32_MAX || n_slots == 0 || (n_slots & (n_slots - 1)) != 0 ||
+        n_slots <= fs->n_terms || fs->n_terms > file_size || fs->n_docs > file_size || n_slots > file_size)
+    {
+        return NULL;
+    }
+
+    compact_index_t *compact = calloc(1, sizeof(compact_index_t));
+    index_t *index = index_create_with_config(config);
+    if (compact == NULL || index == NULL)
+    {
+        free(compact);
+        index_destroy(index);
+        return NULL;
+    }
+    compact->mapped = 1;
+    compact->n_terms = fs->n_terms;
+    compact->n_slots = n_slots;
+    compact->n_blocks = fs->n_blocks;
+    compact->doc_chars_len = fs->sections[SECTION_DOC_CHARS].size;
+    compact->term_chars_len = fs->sections[SECTION_TERM_CHARS].size;
+    compact->doc_chars = (char *)base + fs->sections[SECTION_DOC_CHARS].offset;
+    compact->term_chars = (char *)base + fs->sections[SECTION_TERM_CHARS].offset;
+    compact->doc_offsets = (uint64_t *)file_section(base, fs, SECTION_DOC_OFFSETS, fs->n_docs * sizeof(uint64_t));
+    compact->term_offsets =
+        (uint64_t *)file_section(base, fs, SECTION_TERM_OFFSETS, (fs->n_terms + 1) * sizeof(uint64_t));
+    compact->weights = (term_weight_t *)file_section(base, fs, SECTION_TERM_WEIGHTS, fs->n_terms * sizeof(term_weight_t));
+    compact->slots = (term_slot_t *)file_section(base, fs, SECTION_TERM_SLOTS, n_slots * sizeof(term_slot_t));
+    if (fs->has_bounds)
+    {
+        compact->block_max_scores =
+            (double *)file_section(base, fs, SECTION_BLOCK_MAX_SCORES, fs->n_blocks * sizeof(double));
+    }
+    const file_section_t *postings = &fs->sections[SECTION_POSTINGS];
+    compact->postings = postings_pack_load(base + postings->offset, postings->size, config->codec);
+
+    const uint32_t *doc_lengths = file_section(base, fs, SECTION_DOC_LENGTHS, fs->n_docs * sizeof(uint32_t));
+    const float *doc_norms = file_section(base, fs, SECTION_DOC_NORMS, fs->n_docs * sizeof(float));
+    int valid = compact->doc_offsets && compact->term_offsets && compact->weights && compact->slots &&
+                compact->postings && doc_lengths && doc_norms && (compact->block_max_scores || !fs->has_bounds);
+    valid = valid && postings_pack_length(compact->postings) == fs->n_terms;
+    int verify = valid && config->verify == INDEX_VERIFY_FULL;
+    valid = valid && (!verify || postings_pack_verify(compact->postings, (uint32_t)fs->n_docs) == 0);
+
+    // alle strengene må slutte med '\0' innenfor sitt array
+    valid = valid && (fs->n_docs == 0 || (compact->doc_chars_len > 0 && compact->doc_chars[compact->doc_chars_len - 1] == '\0'));
+    valid = valid && (fs->n_terms == 0 || (compact->term_chars_len > 0 && compact->term_chars[compact->term_chars_len - 1] == '\0'));
+    for (size_t i = 0; verify && valid && i < fs->n_docs; i++)
+    {
+        valid = compact->doc_offsets[i] < compact->doc_chars_len;
+    }
+    for (size_t i = 0; verify && valid && i < fs->n_terms; i++)
+    {
+        valid = compact->term_offsets[i] < compact->term_chars_len;
+    }
+    for (size_t i = 0; verify && valid && i < n_slots; i++)
+    {
+        valid = compact->slots[i].term_id <= fs->n_terms;
+    }
+    if (!valid || compact_link(compact) != 0)
+    {
+        compact_destroy(compact);
+        index_destroy(index);
+        return NULL;
+    }
+
+    // dokumenttabellen og term-ordboken som index_create_with_config lagde erstattes av filen
+    map_destroy(index->map, NULL, NULL);
+    free(index->doc_names);
+    free(index->doc_lengths);
+    free(index->doc_norms);
+    index->map = NULL;
+    index->doc_names = NULL;
+    index->doc_lengths = (uint32_t *)doc_lengths;
+    index->doc_norms = (float *)doc_norms;
+    index->doc_capacity = fs->n_docs;
+    index->amount_of_docs = fs->n_docs;
+    index->amount_of_terms = fs->n_terms;
+    index->total_length = fs->total_length;
+    index->frozen = 1;
+    index->compact = compact;
+    return index;
+}
+
+index_t *index_load(const char *path, const index_config_t *config)
+{
+    // laster en index som er lagret med index_save. Filen mappes inn i minnet, og etter at headeren (og sjekksummen med
+    //  INDEX_VERIFY_FULL) er sjekket brukes arrayene direkte fra filen. Codec-en og BM25-parametrene hentes fra filen, siden dokumentlistene og
+    //  vektene er laget med dem. Resten av innstillingene hentes fra config.
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        pr_error("Failed to open index file \"%s\": %s\n", path, strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+    size_t file_size = (size_t)st.st_size;
+    uint8_t *base = file_size >= sizeof(file_header_t) ? mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        pr_error("\"%s\" is not an index file\n", path);
+        return NULL;
+    }
+
+    const file_header_t *header = (const file_header_t *)base;
+    size_t checksum_start = offsetof(file_header_t, checksum) + sizeof(uint64_t);
+    const char *problem = NULL;
+    if (memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        problem = "not an index file";
+    }
+    else if (header->version != INDEX_FILE_VERSION)
+    {
+        problem = "unsupported version";
+    }
+    else if (header->byte_order != INDEX_FILE_BYTE_ORDER)
+    {
+        problem = "written on a machine with a different byte order";
+    }
+    else if (header->file_size != file_size || header->n_shards == 0 ||
+             header->n_shards > (file_size - sizeof(file_header_t)) / sizeof(file_shard_t) ||
+             header->codec > CODEC_BITPACK)
+    {
+        problem = "truncated or invalid";
+    }
+    else if (config->verify == INDEX_VERIFY_FULL &&
+             hash_bytes_wyhash64(base + checksum_start, file_size - checksum_start) != header->checksum)
+    {
+        problem = "checksum mismatch";
+    }
+    if (problem)
+    {
+        pr_error("Failed to load index from \"%s\": %s\n", path, problem);
+        munmap(base, file_size);
+        return NULL;
+    }
+
+    index_config_t file_config = *config;
+    file_config.codec = (codec_t)header->codec;
+    file_config.bm25_k1 = header->bm25_k1;
+    file_config.bm25_b = header->bm25_b;
+    const file_shard_t *table = (const file_shard_t *)(base + sizeof(file_header_t));
+    for (size_t s = 0; s < header->n_shards; s++)
+    {
+        if (file_config.pruning != INDEX_PRUNING_NONE && !table[s].has_bounds)
+        {
+            pr_warn("The index was saved without score bounds, so queries are not pruned\n");
+            file_config.pruning = INDEX_PRUNING_NONE;
+        }
+    }
+
+    size_t n_shards = header->n_shards;
+    index_t **shards = calloc(n_shards, sizeof(index_t *));
+    int valid = shards != NULL;
+    for (size_t s = 0; valid && s < n_shards; s++)
+    {
+        shards[s] = file_load_shard(base, file_size, &table[s], &file_config);
+        valid = shards[s] != NULL;
+    }
+    if (!valid)
+    {
+        pr_error("Failed to load index from \"%s\": invalid contents\n", path);
+        for (size_t s = 0; shards && s < n_shards; s++)
+        {
+            index_destroy(shards[s]);
+        }
+        free(shards);
+        munmap(base, file_size);
+        return NULL;
+    }
+
+    // den første sharden eier filen, og frigjør den når den selv frigjøres
+    shards[0]->compact->mapping = base;
+    shards[0]->compact->mapping_size = file_size;
+
+    index_t *index = n_shards > 1 ? index_create_sharded(shards, n_shards) : shards[0];
+    free(shards);
+    if (index != NULL)
+    {
+        index->frozen = 1;
+        index->amount_of_terms = header->n_terms;
+    }
+    return index;
+}
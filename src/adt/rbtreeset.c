@@ -12,6 +12,7 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -39,6 +40,9 @@ struct set {
     tnode_t *root;
     cmp_fn cmpfn;
     size_t length;
+    tnode_t *pool;     // nodes allocated up front by set_reserve, or NULL
+    size_t pool_used;  // nodes of the pool handed out so far
+    size_t pool_size;
 };
 
 static tnode_t sentinel = {.color = BLACK};
@@ -109,10 +113,43 @@ set_t *set_create(cmp_fn cmpfn) {
     set->root = NIL;
     set->cmpfn = cmpfn;
     set->length = 0;
+    set->pool = NULL;
+    set->pool_used = 0;
+    set->pool_size = 0;
 
     return set;
 }
 
+int set_reserve(set_t *set, size_t n) {
+    /* only the first reservation gets a pool. Nodes past the pool are allocated one by one as before */
+    if (set->pool != NULL || n == 0) {
+        return 0;
+    }
+
+    set->pool = malloc(n * sizeof(tnode_t));
+    if (set->pool == NULL) {
+        pr_error("Malloc failed @set_reserve\n");
+        return -1;
+    }
+    set->pool_size = n;
+
+    return 0;
+}
+
+/* take a node from the reserved pool while it lasts, otherwise allocate it on its own */
+static tnode_t *node_alloc(set_t *set) {
+    if (set->pool_used < set->pool_size) {
+        return &set->pool[set->pool_used++];
+    }
+
+    tnode_t *node = malloc(sizeof(tnode_t));
+    if (!node) {
+        PANIC("Out of memory\n");
+    }
+
+    return node;
+}
+
 size_t set_length(set_t *set) {
     return set->length;
 }
@@ -137,7 +174,11 @@ static void rec_postorder_destroy(set_t *set, tnode_t *node, free_fn elem_freefn
     if (elem_freefn) {
         elem_freefn(node->elem);
     }
-    free(node);
+    /* nodes of the pool are freed along with the set. Compared as integers, like freenode in doublylinkedlist.c */
+    uintptr_t offset = (uintptr_t) node - (uintptr_t) set->pool;
+    if (offset >= set->pool_size * sizeof(tnode_t)) {
+        free(node);
+    }
 }
 
 void set_destroy(set_t *set, free_fn elem_freefn) {
@@ -145,6 +186,7 @@ void set_destroy(set_t *set, free_fn elem_freefn) {
         return;
     }
     rec_postorder_destroy(set, set->root, elem_freefn);
+    free(set->pool);
     free(set);
 }
 
@@ -248,10 +290,7 @@ static inline void post_insert_balance(set_t *set, tnode_t *added_node) {
 
 void *set_insert(set_t *set, void *elem) {
     if (set->root == NIL) {
-        set->root = malloc(sizeof(tnode_t));
-        if (!set->root) {
-            PANIC("Out of memory\n");
-        }
+        set->root = node_alloc(set);
 
         /* only time we insert a black node */
         set->root->color = BLACK;
@@ -291,10 +330,7 @@ void *set_insert(set_t *set, void *elem) {
         }
     }
 
-    tnode_t *node = malloc(sizeof(tnode_t));
-    if (!node) {
-        PANIC("Out of memory\n");
-    }
+    tnode_t *node = node_alloc(set);
 
     node->color = RED;
     node->elem = elem;
@@ -0,0 +1,495 @@
+/**
+ * @implements map.h
+ *
+ * @brief Hash map with open addressing, in the style of a swiss table.
+ *
+ * Each slot has a control byte, which is either empty, deleted or the low 7 bits of the hash of its key.
+ * Lookups load a group of 16 control bytes at a time, and compare all of them to the 7 bits of the key at once
+ * (with SSE2 where available), so that keys are only compared for slots that are likely to match. The number
+ * of slots is a power of two, and each slot stores the full hash of its key, so that growing the table never
+ * hashes a key again.
+ *
+ * The slots point to entries, which are allocated in chunks that never move. Entries returned by `map_get`
+ * thus stay valid until their key is removed, as required by map.h, even when the table grows.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "common.h"
+#include "map.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+
+/* number of control bytes probed at a time */
+#define GROUP_WIDTH 16
+
+/* how many slots each map should start with, unless given a larger capacity. A power of two, and >= GROUP_WIDTH */
+#define N_SLOTS_INITIAL 16
+
+/* how many entries the first chunk of entries holds. Each chunk holds as many entries as all the previous ones */
+#define N_ENTRIES_INITIAL 16
+
+/* control bytes of slots without a key. Bytes of full slots have the high bit cleared */
+#define CTRL_EMPTY   ((uint8_t) 0x80)
+#define CTRL_DELETED ((uint8_t) 0xfe)
+
+/* the high 57 bits of a hash selects the first group to probe, and the low 7 bits are kept in the control byte */
+#define HASH_H1(hash) ((hash) >> 7)
+#define HASH_H2(hash) ((uint8_t) ((hash) & 0x7f))
+
+typedef struct slot {
+    uint64_t hash;
+    entry_t *entry;
+} slot_t;
+
+/* a chunk of entries. Freed entries are linked through their key, and reused by later insertions */
+typedef struct entry_chunk entry_chunk_t;
+struct entry_chunk {
+    entry_chunk_t *next;
+    size_t n_used;
+    size_t capacity;
+    entry_t entries[];
+};
+
+struct map {
+    cmp_fn cmpfn;
+    hash64_fn hashfn;
+    uint8_t *ctrl;  // capacity + GROUP_WIDTH bytes, where the last GROUP_WIDTH mirror the first
+    slot_t *slots;
+    size_t capacity;
+    size_t length;
+    size_t growth_left; // how many empty slots may be filled before the table must grow
+    entry_chunk_t *chunks;
+    entry_t *free_entries;
+};
+
+/**
+ * The table grows when more than 7/8 of the slots are full or deleted
+ */
+static inline size_t calc_max_load(size_t capacity) {
+    return capacity - capacity / 8;
+}
+
+/* bitmask of the bytes in the group starting at `ctrl` that are equal to `byte`, lowest bit first */
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t byte) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t) (ctrl[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+/* bitmask of the bytes in the group that are empty or deleted, i.e. that have the high bit set */
+static inline uint32_t group_match_free(const uint8_t *ctrl) {
+#if defined(__SSE2__)
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t) (ctrl[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+/* set the control byte of a slot, and its mirror past the end of the table */
+static inline void set_ctrl(map_t *map, size_t i, uint8_t byte) {
+    map->ctrl[i] = byte;
+    if (i < GROUP_WIDTH) {
+        map->ctrl[map->capacity + i] = byte;
+    }
+}
+
+/**
+ * Find the first empty or deleted slot for `hash`. Groups are probed with a growing stride (16, 32, 48, ...),
+ * which visits every group once when the number of groups is a power of two. The table always has an empty slot.
+ */
+static size_t find_free_slot(map_t *map, uint64_t hash) {
+    size_t mask = map->capacity - 1;
+    size_t pos = HASH_H1(hash) & mask;
+
+    for (size_t stride = GROUP_WIDTH;; stride += GROUP_WIDTH) {
+        uint32_t free_mask = group_match_free(&map->ctrl[pos]);
+        if (free_mask) {
+            return (pos + (size_t) __builtin_ctz(free_mask)) & mask;
+        }
+        pos = (pos + stride) & mask;
+    }
+}
+
+/**
+ * Find the slot holding `key`, which hashes to `hash`
+ * @returns the index of the slot, or `map->capacity` if the key is not present
+ */
+static size_t find_slot(map_t *map, void *key, uint64_t hash) {
+    size_t mask = map->capacity - 1;
+    size_t pos = HASH_H1(hash) & mask;
+    uint8_t h2 = HASH_H2(hash);
+
+    for (size_t stride = GROUP_WIDTH;; stride += GROUP_WIDTH) {
+        const uint8_t *group = &map->ctrl[pos];
+
+        for (uint32_t match = group_match(group, h2); match; match &= match - 1) {
+            size_t i = (pos + (size_t) __builtin_ctz(match)) & mask;
+            slot_t *slot = &map->slots[i];
+
+            if (slot->hash == hash && map->cmpfn(key, slot->entry->key) == 0) {
+                return i;
+            }
+        }
+
+        /* the key would have been placed in the first empty slot of its probe sequence */
+        if (group_match(group, CTRL_EMPTY)) {
+            return map->capacity;
+        }
+        pos = (pos + stride) & mask;
+    }
+}
+
+/**
+ * Move all entries into a table of `new_capacity` slots. Deleted slots are dropped, and the stored hashes are
+ * used to place the entries, so no keys are hashed.
+ */
+static int map_resize(map_t *map, size_t new_capacity) {
+    uint8_t *new_ctrl = malloc(new_capacity + GROUP_WIDTH);
+    slot_t *new_slots = malloc(new_capacity * sizeof(slot_t));
+    if (new_ctrl == NULL || new_slots == NULL) {
+        free(new_ctrl);
+        free(new_slots);
+        return -1;
+    }
+    memset(new_ctrl, CTRL_EMPTY, new_capacity + GROUP_WIDTH);
+
+    uint8_t *old_ctrl = map->ctrl;
+    slot_t *old_slots = map->slots;
+    size_t old_capacity = map->capacity;
+
+    map->ctrl = new_ctrl;
+    map->slots = new_slots;
+    map->capacity = new_capacity;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] & CTRL_EMPTY) {
+            continue; // empty or deleted
+        }
+        size_t i_new = find_free_slot(map, old_slots[i].hash);
+        set_ctrl(map, i_new, HASH_H2(old_slots[i].hash));
+        new_slots[i_new] = old_slots[i];
+    }
+
+    free(old_ctrl);
+    free(old_slots);
+    map->growth_left = calc_max_load(new_capacity) - map->length;
+
+    return 0;
+}
+
+/* take an entry from the free list, or from the newest chunk. A new chunk is allocated when it is full */
+static entry_t *entry_alloc(map_t *map) {
+    entry_t *entry = map->free_entries;
+    if (entry) {
+        map->free_entries = entry->key;
+        return entry;
+    }
+
+    entry_chunk_t *chunk = map->chunks;
+    if (chunk == NULL || chunk->n_used == chunk->capacity) {
+        size_t capacity = chunk ? chunk->capacity * 2 : N_ENTRIES_INITIAL;
+
+        entry_chunk_t *new_chunk = malloc(sizeof(entry_chunk_t) + capacity * sizeof(entry_t));
+        if (new_chunk == NULL) {
+            PANIC("Failed to allocate memory\n");
+        }
+        new_chunk->next = chunk;
+        new_chunk->n_used = 0;
+        new_chunk->capacity = capacity;
+
+        map->chunks = new_chunk;
+        chunk = new_chunk;
+    }
+
+    return &chunk->entries[chunk->n_used++];
+}
+
+/* put an entry back on the free list */
+static inline void entry_release(map_t *map, entry_t *entry) {
+    entry->key = map->free_entries;
+    entry->val = NULL;
+    map->free_entries = entry;
+}
+
+/* copy an entry out of the map, for entries that are returned to the caller to free */
+static entry_t *entry_copy(entry_t *entry) {
+    entry_t *copy = malloc(sizeof(entry_t));
+    if (copy == NULL) {
+        PANIC("Failed to allocate memory\n");
+    }
+    *copy = *entry;
+
+    return copy;
+}
+
+/**
+ * The smallest number of slots (a power of two, at least N_SLOTS_INITIAL) that holds `n` entries without growing
+ */
+static size_t calc_capacity(size_t n) {
+    size_t capacity = N_SLOTS_INITIAL;
+    while (calc_max_load(capacity) < n) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+map_t *map_create(cmp_fn cmpfn, hash64_fn hashfn) {
+    return map_create_with_capacity(cmpfn, hashfn, 0);
+}
+
+map_t *map_create_with_capacity(cmp_fn cmpfn, hash64_fn hashfn, size_t capacity) {
+    map_t *map = malloc(sizeof(map_t));
+    if (map == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    size_t n_slots = calc_capacity(capacity);
+    map->ctrl = malloc(n_slots + GROUP_WIDTH);
+    map->slots = malloc(n_slots * sizeof(slot_t));
+    if (map->ctrl == NULL || map->slots == NULL) {
+        pr_error("Failed to allocate memory\n");
+        free(map->ctrl);
+        free(map->slots);
+        free(map);
+        return NULL;
+    }
+    memset(map->ctrl, CTRL_EMPTY, n_slots + GROUP_WIDTH);
+
+    map->cmpfn = cmpfn;
+    map->hashfn = hashfn;
+    map->capacity = n_slots;
+    map->length = 0;
+    map->growth_left = calc_max_load(n_slots);
+    map->chunks = NULL;
+    map->free_entries = NULL;
+
+    return map;
+}
+
+int map_reserve(map_t *map, size_t n) {
+    size_t new_capacity = calc_capacity(n);
+    if (new_capacity <= map->capacity) {
+        return 0;
+    }
+
+    if (map_resize(map, new_capacity) != 0) {
+        pr_error("Failed to allocate memory\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void map_destroy(map_t *map, free_fn key_freefn, free_fn val_freefn) {
+    if (!map) {
+        return;
+    }
+
+    if (key_freefn || val_freefn) {
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (map->ctrl[i] & CTRL_EMPTY) {
+                continue;
+            }
+            entry_t *entry = map->slots[i].entry;
+
+            if (key_freefn) {
+                key_freefn(entry->key);
+            }
+            if (val_freefn) {
+                val_freefn(entry->val);
+            }
+        }
+    }
+
+    entry_chunk_t *chunk = map->chunks;
+    while (chunk) {
+        entry_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(map->ctrl);
+    free(map->slots);
+    free(map);
+}
+
+size_t map_length(map_t *map) {
+    return map->length;
+}
+
+/**
+ * Add an entry for `key`, which is not in the map, and return it. Grows the table if needed.
+ */
+static entry_t *map_add_entry(map_t *map, void *key, void *val, uint64_t hash) {
+    size_t i = find_free_slot(map, hash);
+
+    /* filling an empty slot (rather than a deleted one) brings the table closer to growing */
+    if (map->ctrl[i] == CTRL_EMPTY && map->growth_left == 0) {
+        /* grow, unless deleted slots make up enough of the table that dropping them is sufficient */
+        size_t new_capacity = (map->length + 1 > calc_max_load(map->capacity) / 2) ? map->capacity * 2 : map->capacity;
+        if (map_resize(map, new_capacity) != 0) {
+            PANIC("Failed to rehash\n");
+        }
+        i = find_free_slot(map, hash);
+    }
+
+    map->growth_left -= (map->ctrl[i] == CTRL_EMPTY);
+
+    entry_t *entry = entry_alloc(map);
+    entry->key = key;
+    entry->val = val;
+
+    set_ctrl(map, i, HASH_H2(hash));
+    map->slots[i].hash = hash;
+    map->slots[i].entry = entry;
+    map->length++;
+
+    return entry;
+}
+
+entry_t *map_insert(map_t *map, void *key, void *val) {
+    return map_insert_hashed(map, key, val, map->hashfn(key));
+}
+
+entry_t *map_insert_hashed(map_t *map, void *key, void *val, uint64_t hash) {
+    size_t i = find_slot(map, key, hash);
+
+    if (i != map->capacity) {
+        /* already present. The old pair is returned in a copy, so that the entry of the key stays where it is */
+        entry_t *entry = map->slots[i].entry;
+        entry_t *old_entry = entry_copy(entry);
+
+        entry->key = key;
+        entry->val = val;
+
+        return old_entry;
+    }
+
+    map_add_entry(map, key, val, hash);
+
+    return NULL;
+}
+
+entry_t *map_upsert(map_t *map, void *key, int *inserted) {
+    return map_upsert_hashed(map, key, map->hashfn(key), inserted);
+}
+
+entry_t *map_upsert_hashed(map_t *map, void *key, uint64_t hash, int *inserted) {
+    size_t i = find_slot(map, key, hash);
+    *inserted = (i == map->capacity);
+
+    return *inserted ? map_add_entry(map, key, NULL, hash) : map->slots[i].entry;
+}
+
+entry_t *map_remove(map_t *map, void *key) {
+    return map_remove_hashed(map, key, map->hashfn(key));
+}
+
+entry_t *map_remove_hashed(map_t *map, void *key, uint64_t hash) {
+    size_t i = find_slot(map, key, hash);
+    if (i == map->capacity) {
+        return NULL;
+    }
+
+    entry_t *entry = map->slots[i].entry;
+    entry_t *removed = entry_copy(entry);
+    entry_release(map, entry);
+
+    /**
+     * A slot can only be marked as empty if no probe sequence has passed over it, which is the case when its
+     * group was never full. Otherwise it is marked as deleted, so that lookups continue past it.
+     */
+    size_t mask = map->capacity - 1;
+    size_t i_before = (i - GROUP_WIDTH) & mask;
+    uint32_t empty_after = group_match(&map->ctrl[i], CTRL_EMPTY);
+    uint32_t empty_before = group_match(&map->ctrl[i_before], CTRL_EMPTY);
+    int was_never_full = empty_after && empty_before &&
+                         (size_t) (__builtin_ctz(empty_after) + __builtin_clz(empty_before << 16)) < GROUP_WIDTH;
+
+    if (was_never_full) {
+        set_ctrl(map, i, CTRL_EMPTY);
+        map->growth_left++;
+    } else {
+        set_ctrl(map, i, CTRL_DELETED);
+    }
+    map->length--;
+
+    return removed;
+}
+
+entry_t *map_get(map_t *map, void *key) {
+    return map_get_hashed(map, key, map->hashfn(key));
+}
+
+entry_t *map_get_hashed(map_t *map, void *key, uint64_t hash) {
+    size_t i = find_slot(map, key, hash);
+
+    return (i == map->capacity) ? NULL : map->slots[i].entry;
+}
+
+
+struct map_iter {
+    map_t *map;
+    size_t i_next_slot;
+    size_t n_remaining;
+};
+
+map_iter_t *map_createiter(map_t *map) {
+    map_iter_t *iter = malloc(sizeof(map_iter_t));
+    if (iter == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    iter->map = map;
+    iter->i_next_slot = 0;
+    iter->n_remaining = map->length;
+
+    return iter;
+}
+
+void map_destroyiter(map_iter_t *iter) {
+    free(iter);
+}
+
+int map_hasnext(map_iter_t *iter) {
+    return (int) (iter->n_remaining > 0);
+}
+
+entry_t *map_next(map_iter_t *iter) {
+    if (iter->n_remaining == 0) {
+        return NULL;
+    }
+
+    map_t *map = iter->map;
+    while (map->ctrl[iter->i_next_slot] & CTRL_EMPTY) {
+        iter->i_next_slot += 1;
+    }
+
+    assert(iter->i_next_slot < map->capacity);
+
+    iter->n_remaining -= 1;
+
+    return map->slots[iter->i_next_slot++].entry;
+}
@@ -0,0 +1,297 @@
+/**
+ * @implements codec.h
+ *
+ * @brief Scalar implementations of the integer codecs. Words are read and written with memcpy, so encoded
+ * data needs no particular alignment.
+ */
+
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "codec.h"
+
+static const char *codec_names[] = {
+    [CODEC_VARINT] = "varint",
+    [CODEC_SIMPLE8B] = "simple8b",
+    [CODEC_BITPACK] = "bitpack",
+};
+
+const char *codec_name(codec_t codec) {
+    return codec_names[codec];
+}
+
+int codec_from_name(const char *name, codec_t *codec) {
+    for (size_t i = 0; i < sizeof(codec_names) / sizeof(codec_names[0]); i++) {
+        if (strcmp(name, codec_names[i]) == 0) {
+            *codec = (codec_t) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* --------------------------Varint-------------------------- */
+
+static size_t varint_encode(const uint32_t *values, size_t n, uint8_t *out) {
+    uint8_t *p = out;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t v = values[i];
+
+        while (v >= 0x80) {
+            *p++ = (uint8_t) (v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t) v;
+    }
+
+    return (size_t) (p - out);
+}
+
+static size_t varint_decode(const uint8_t *in, size_t n, uint32_t *values) {
+    const uint8_t *p = in;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t v = *p & 0x7f;
+        int shift = 7;
+
+        while (*p++ & 0x80) {
+            v |= (uint32_t) (*p & 0x7f) << shift;
+            shift += 7;
+        }
+        values[i] = v;
+    }
+
+    return (size_t) (p - in);
+}
+
+static size_t varint_check(const uint8_t *in, size_t avail, size_t n) {
+    size_t p = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        /* a 32-bit value takes at most 5 bytes */
+        for (int k = 0;; k++) {
+            if (p == avail || k == 5) {
+                return 0;
+            }
+            if (!(in[p++] & 0x80)) {
+                break;
+            }
+        }
+    }
+
+    return p;
+}
+
+/* -------------------------Simple-8b------------------------ */
+
+/**
+ * Number of values and bits per value for each of the 16 selectors. Selectors 0 and 1 hold runs of zeros
+ * and use no data bits at all.
+ */
+static const struct {
+    uint32_t n;
+    uint32_t bits;
+} s8b_selectors[16] = {
+    {240, 0}, {120, 0}, {60, 1}, {30, 2}, {20, 3}, {15, 4}, {12, 5}, {10, 6},
+    {8, 7},   {7, 8},   {6, 10}, {5, 12}, {4, 15}, {3, 20}, {2, 30}, {1, 60},
+};
+
+static size_t simple8b_encode(const uint32_t *values, size_t n, uint8_t *out) {
+    size_t i = 0;
+    size_t n_bytes = 0;
+
+    while (i < n) {
+        size_t remaining = n - i;
+        uint64_t word = 0;
+
+        /* pick the selector that packs the most of the following values. Selector 15 always fits. */
+        for (uint64_t sel = 0; sel < 16; sel++) {
+            uint32_t sel_n = s8b_selectors[sel].n;
+            uint32_t sel_bits = s8b_selectors[sel].bits;
+
+            if (sel_n > remaining) {
+                continue;
+            }
+
+            size_t j = 0;
+            while (j < sel_n && (uint64_t) values[i + j] >> sel_bits == 0) {
+                j++;
+            }
+            if (j < sel_n) {
+                continue;
+            }
+
+            word = sel << 60;
+            for (j = 0; j < sel_n && sel_bits; j++) {
+                word |= (uint64_t) values[i + j] << (j * sel_bits);
+            }
+            i += sel_n;
+            break;
+        }
+
+        memcpy(out + n_bytes, &word, sizeof(word));
+        n_bytes += sizeof(word);
+    }
+
+    return n_bytes;
+}
+
+static size_t simple8b_decode(const uint8_t *in, size_t n, uint32_t *values) {
+    size_t i = 0;
+    size_t n_bytes = 0;
+
+    while (i < n) {
+        uint64_t word;
+        memcpy(&word, in + n_bytes, sizeof(word));
+        n_bytes += sizeof(word);
+
+        uint32_t sel = (uint32_t) (word >> 60);
+        uint32_t sel_n = s8b_selectors[sel].n;
+        uint32_t sel_bits = s8b_selectors[sel].bits;
+
+        assert(i + sel_n <= n);
+
+        if (sel_bits == 0) {
+            memset(&values[i], 0, sel_n * sizeof(uint32_t));
+        } else {
+            uint64_t mask = (UINT64_C(1) << sel_bits) - 1;
+            for (uint32_t j = 0; j < sel_n; j++) {
+                values[i + j] = (uint32_t) ((word >> (j * sel_bits)) & mask);
+            }
+        }
+        i += sel_n;
+    }
+
+    return n_bytes;
+}
+
+static size_t simple8b_check(const uint8_t *in, size_t avail, size_t n) {
+    size_t i = 0;
+    size_t n_bytes = 0;
+
+    while (i < n) {
+        uint64_t word;
+        if (avail - n_bytes < sizeof(word)) {
+            return 0;
+        }
+        memcpy(&word, in + n_bytes, sizeof(word));
+        n_bytes += sizeof(word);
+
+        /* the last word must not hold more values than are left */
+        uint32_t sel_n = s8b_selectors[word >> 60].n;
+        if (sel_n > n - i) {
+            return 0;
+        }
+        i += sel_n;
+    }
+
+    return n_bytes;
+}
+
+/* --------------------------Bitpack------------------------- */
+
+/* the first byte holds the bit width, followed by the values packed back to back */
+static size_t bitpack_encode(const uint32_t *values, size_t n, uint8_t *out) {
+    uint32_t all = 0;
+    for (size_t i = 0; i < n; i++) {
+        all |= values[i];
+    }
+
+    uint32_t bits = all ? 32 - (uint32_t) __builtin_clz(all) : 0;
+    out[0] = (uint8_t) bits;
+
+    uint8_t *p = out + 1;
+    uint64_t acc = 0;
+    uint32_t acc_bits = 0;
+
+    for (size_t i = 0; i < n && bits; i++) {
+        acc |= (uint64_t) values[i] << acc_bits;
+        acc_bits += bits;
+
+        while (acc_bits >= 8) {
+            *p++ = (uint8_t) acc;
+            acc >>= 8;
+            acc_bits -= 8;
+        }
+    }
+    if (acc_bits) {
+        *p++ = (uint8_t) acc;
+    }
+
+    return (size_t) (p - out);
+}
+
+static size_t bitpack_decode(const uint8_t *in, size_t n, uint32_t *values) {
+    uint32_t bits = in[0];
+    const uint8_t *p = in + 1;
+
+    if (bits == 0) {
+        memset(values, 0, n * sizeof(uint32_t));
+        return 1;
+    }
+
+    uint64_t mask = (UINT64_C(1) << bits) - 1;
+    uint64_t acc = 0;
+    uint32_t acc_bits = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        while (acc_bits < bits) {
+            acc |= (uint64_t) *p++ << acc_bits;
+            acc_bits += 8;
+        }
+        values[i] = (uint32_t) (acc & mask);
+        acc >>= bits;
+        acc_bits -= bits;
+    }
+
+    return 1 + (n * bits + 7) / 8;
+}
+
+static size_t bitpack_check(const uint8_t *in, size_t avail, size_t n) {
+    if (avail == 0 || in[0] > 32) {
+        return 0;
+    }
+
+    size_t n_bytes = 1 + (n * in[0] + 7) / 8;
+    return n_bytes <= avail ? n_bytes : 0;
+}
+
+/* -------------------------Dispatch------------------------- */
+
+size_t codec_encode(codec_t codec, const uint32_t *values, size_t n, uint8_t *out) {
+    switch (codec) {
+        case CODEC_VARINT:
+            return varint_encode(values, n, out);
+        case CODEC_SIMPLE8B:
+            return simple8b_encode(values, n, out);
+        case CODEC_BITPACK:
+            return bitpack_encode(values, n, out);
+    }
+    PANIC("Invalid codec %d\n", (int) codec);
+}
+
+size_t codec_decode(codec_t codec, const uint8_t *in, size_t n, uint32_t *values) {
+    switch (codec) {
+        case CODEC_VARINT:
+            return varint_decode(in, n, values);
+        case CODEC_SIMPLE8B:
+            return simple8b_decode(in, n, values);
+        case CODEC_BITPACK:
+            return bitpack_decode(in, n, values);
+    }
+    PANIC("Invalid codec %d\n", (int) codec);
+}
+
+size_t codec_check(codec_t codec, const uint8_t *in, size_t avail, size_t n) {
+    switch (codec) {
+        case CODEC_VARINT:
+            return varint_check(in, avail, n);
+        case CODEC_SIMPLE8B:
+            return simple8b_check(in, avail, n);
+        case CODEC_BITPACK:
+            return bitpack_check(in, avail, n);
+    }
+    return 0;
+}
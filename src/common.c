@@ -16,6 +16,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <limits.h>
 
 #include "printing.h"
@@ -65,6 +66,115 @@ uint64_t hash_string_fnv1a64(const void *str) {
     return hash;
 }
 
+/* the 64 bit product of a and b, folded to 64 bits by xoring the high and the low half */
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t wy_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wy_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t hash_string_wyhash64(const void *str) {
+    return hash_bytes_wyhash64(str, strlen(str));
+}
+
+uint64_t hash_bytes_wyhash64(const void *data, size_t len) {
+    /* as with FNV, these are chosen for their bit patterns. Modifying them will weaken the function */
+    static const uint64_t secret[4] = {
+        0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+    };
+
+    const uint8_t *p = (const uint8_t *) data;
+    uint64_t seed = wy_mix(secret[0], secret[1]) ^ secret[0];
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            /* two overlapping 4 byte reads from each end cover the whole string */
+            size_t mid = (len >> 3) << 2;
+            a = (wy_read32(p) << 32) | wy_read32(p + mid);
+            b = (wy_read32(p + len - 4) << 32) | wy_read32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i = len;
+
+        /* long strings are consumed 48 bytes at a time in three independent lanes */
+        if (i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do {
+                seed = wy_mix(wy_read64(p) ^ secret[1], wy_read64(p + 8) ^ seed);
+                see1 = wy_mix(wy_read64(p + 16) ^ secret[2], wy_read64(p + 24) ^ see1);
+                see2 = wy_mix(wy_read64(p + 32) ^ secret[3], wy_read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_read64(p) ^ secret[1], wy_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        /* the last 16 bytes, overlapping with the ones before if needed */
+        a = wy_read64(p + i - 16);
+        b = wy_read64(p + i - 8);
+    }
+
+    __uint128_t r = (__uint128_t) (a ^ secret[1]) * (b ^ seed);
+    return wy_mix((uint64_t) r ^ secret[0] ^ len, (uint64_t) (r >> 64) ^ secret[1]);
+}
+
+int file_write_checksum(const char *path, size_t offset) {
+    int fd = open(path, O_RDWR);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < offset + sizeof(uint64_t)) {
+        pr_error("Failed to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    /* the file is mapped rather than read, as it may be far larger than what we would like to allocate */
+    size_t size = (size_t) st.st_size;
+    size_t start = offset + sizeof(uint64_t);
+    uint8_t *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        pr_error("Failed to map %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    uint64_t checksum = hash_bytes_wyhash64(base + start, size - start);
+    munmap(base, size);
+
+    int status = 0;
+    if (pwrite(fd, &checksum, sizeof(checksum), (off_t) offset) != sizeof(checksum) || fsync(fd) != 0) {
+        pr_error("Failed to write checksum to %s: %s\n", path, strerror(errno));
+        status = -1;
+    }
+    close(fd);
+    return status;
+}
+
 /* -- character control -- */
 
 int is_newline(int c) {
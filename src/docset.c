@@ -0,0 +1,786 @@
+/**
+ * @implements docset.h
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "docset.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define DOCSET_X86
+#  include <immintrin.h>
+#endif
+
+docset_t *docset_create(size_t capacity) {
+    docset_t *docset = malloc(sizeof(docset_t));
+    if (docset == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    /* always allocate at least one id, so that a NULL array means failure */
+    docset->doc_ids = malloc((capacity ? capacity : 1) * sizeof(uint32_t));
+    if (docset->doc_ids == NULL) {
+        pr_error("Failed to allocate memory\n");
+        free(docset);
+        return NULL;
+    }
+    docset->length = 0;
+
+    return docset;
+}
+
+docset_t *docset_copy(const docset_t *docset) {
+    docset_t *copy = docset_create(docset->length);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy->doc_ids, docset->doc_ids, docset->length * sizeof(uint32_t));
+    copy->length = docset->length;
+    return copy;
+}
+
+void docset_destroy(docset_t *docset) {
+    if (!docset) {
+        return;
+    }
+    free(docset->doc_ids);
+    free(docset);
+}
+
+size_t docset_gallop(const uint32_t *doc_ids, size_t length, size_t from, uint32_t target) {
+    if (from >= length || doc_ids[from] >= target) {
+        return from;
+    }
+
+    /* double the step until we pass target, so that target is within (lo, hi] */
+    size_t lo = from;
+    size_t step = 1;
+    size_t hi = from + step;
+
+    while (hi < length && doc_ids[hi] < target) {
+        lo = hi;
+        step *= 2;
+        hi = from + step;
+    }
+    if (hi > length) {
+        hi = length;
+    }
+
+    /* binary search for the first id >= target. doc_ids[lo] < target, and doc_ids[hi] >= target if in range */
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (doc_ids[mid] < target) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return hi;
+}
+
+/* true if one of the inputs is small enough that galloping through the other pays off */
+static inline int should_gallop(size_t small_len, size_t large_len) {
+    return small_len * DOCSET_GALLOP_RATIO < large_len;
+}
+
+/* --------------------------Kernels------------------------- */
+
+/**
+ * The linear merges below are the scalar kernels. SIMD kernels do the same merges a vector at a time: for
+ * intersection and difference each vector of `a` is compared against every rotation of a vector of `b`, and
+ * for union two vectors are merged with a min/max network. The selected lanes are then moved to the front
+ * with a shuffle from a lookup table and stored unaligned. The vector with the lower last id is advanced,
+ * and the remaining tails are finished by the scalar kernels.
+ */
+
+static size_t intersect_merge(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out);
+static size_t union_merge(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out);
+static size_t difference_merge(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out);
+
+/* merge the sorted tails of the union kernels, skipping ids equal to `last`, the last id written */
+static size_t union_tail(
+    const uint32_t *rest,
+    size_t rest_len,
+    const uint32_t *a,
+    size_t a_len,
+    const uint32_t *b,
+    size_t b_len,
+    uint32_t last,
+    uint32_t *out
+) {
+    size_t k = 0, i = 0, j = 0, n = 0;
+
+    while (k < rest_len || i < a_len || j < b_len) {
+        uint32_t id = UINT32_MAX;
+        if (k < rest_len && rest[k] <= id) {
+            id = rest[k];
+        }
+        if (i < a_len && a[i] <= id) {
+            id = a[i];
+        }
+        if (j < b_len && b[j] <= id) {
+            id = b[j];
+        }
+
+        if (k < rest_len && rest[k] == id) {
+            k++;
+        } else if (i < a_len && a[i] == id) {
+            i++;
+        } else {
+            j++;
+        }
+
+        if (id != last) {
+            out[n++] = last = id;
+        }
+    }
+
+    return n;
+}
+
+#ifdef DOCSET_X86
+
+/* byte shuffles for _mm_shuffle_epi8, moving the lanes selected by a 4-bit mask to the front */
+static uint8_t sse_compact_table[1 << 4][16];
+
+/* lane indices for _mm256_permutevar8x32_epi32, moving the lanes selected by an 8-bit mask to the front */
+static uint8_t avx2_compact_table[1 << 8][8];
+
+static void init_compact_tables(void) {
+    for (int mask = 0; mask < (1 << 4); mask++) {
+        int n = 0;
+        memset(sse_compact_table[mask], 0x80, 16); /* 0x80 zeroes the byte */
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane)) {
+                for (int byte = 0; byte < 4; byte++) {
+                    sse_compact_table[mask][n * 4 + byte] = (uint8_t) (lane * 4 + byte);
+                }
+                n++;
+            }
+        }
+    }
+
+    for (int mask = 0; mask < (1 << 8); mask++) {
+        int n = 0;
+        memset(avx2_compact_table[mask], 0, 8);
+        for (int lane = 0; lane < 8; lane++) {
+            if (mask & (1 << lane)) {
+                avx2_compact_table[mask][n++] = (uint8_t) lane;
+            }
+        }
+    }
+}
+
+/* ---- SSE4.2, 4 ids per vector ---- */
+
+#  define SSE_TARGET __attribute__((target("sse4.2")))
+
+SSE_TARGET static inline __m128i sse_load(const uint32_t *src) {
+    return _mm_loadu_si128((const __m128i *) src);
+}
+
+SSE_TARGET static inline void sse_store_lanes(uint32_t *dst, __m128i v, int mask) {
+    __m128i shuffle = _mm_loadu_si128((const __m128i *) sse_compact_table[mask]);
+    _mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(v, shuffle));
+}
+
+/* bitmask of the lanes of `va` that are equal to any lane of `vb` */
+SSE_TARGET static inline int sse_match_mask(__m128i va, __m128i vb) {
+    __m128i eq = _mm_cmpeq_epi32(va, vb);
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+    return _mm_movemask_ps(_mm_castsi128_ps(eq));
+}
+
+/* merge two sorted vectors, such that `lo` holds the 4 smallest and `hi` the 4 largest ids, both sorted */
+SSE_TARGET static inline void sse_merge(__m128i *lo, __m128i *hi) {
+    __m128i min = _mm_min_epu32(*lo, *hi);
+    __m128i max = _mm_max_epu32(*lo, *hi);
+
+    for (int round = 0; round < 3; round++) {
+        __m128i rotated = _mm_alignr_epi8(min, min, 4);
+        min = _mm_min_epu32(rotated, max);
+        max = _mm_max_epu32(rotated, max);
+    }
+
+    *lo = _mm_alignr_epi8(min, min, 4);
+    *hi = max;
+}
+
+/* store the lanes of the sorted vector `v` that differ from the lane before them, where `prev` was stored last */
+SSE_TARGET static inline size_t sse_store_unique(uint32_t *dst, __m128i prev, __m128i v) {
+    __m128i shifted = _mm_alignr_epi8(v, prev, 12);
+    int keep = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(shifted, v))) & 0xF;
+    sse_store_lanes(dst, v, keep);
+    return (size_t) __builtin_popcount(keep);
+}
+
+SSE_TARGET static size_t
+intersect_sse42(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    const size_t capacity = (a_len < b_len) ? a_len : b_len;
+    size_t i = 0, j = 0, n = 0;
+
+    while (i + 4 <= a_len && j + 4 <= b_len) {
+        __m128i va = sse_load(&a[i]);
+        int mask = sse_match_mask(va, sse_load(&b[j]));
+
+        if (n + 4 <= capacity) {
+            sse_store_lanes(&out[n], va, mask);
+        } else {
+            /* a full store could write past the end of `out` */
+            uint32_t lanes[4];
+            sse_store_lanes(lanes, va, mask);
+            memcpy(&out[n], lanes, (size_t) __builtin_popcount(mask) * sizeof(uint32_t));
+        }
+        n += (size_t) __builtin_popcount(mask);
+
+        uint32_t a_last = a[i + 3], b_last = b[j + 3];
+        i += (a_last <= b_last) ? 4 : 0;
+        j += (b_last <= a_last) ? 4 : 0;
+    }
+
+    return n + intersect_merge(&a[i], a_len - i, &b[j], b_len - j, &out[n]);
+}
+
+SSE_TARGET static size_t union_sse42(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    if (a_len < 4 || b_len < 4) {
+        return union_merge(a, a_len, b, b_len, out);
+    }
+
+    __m128i lo = sse_load(a);
+    __m128i hi = sse_load(b);
+    sse_merge(&lo, &hi);
+
+    /* nothing has been stored yet, so use a previous vector that can not equal the first id */
+    __m128i prev = _mm_set1_epi32((int) ((uint32_t) _mm_cvtsi128_si32(lo) - 1));
+    size_t i = 4, j = 4, n = 0;
+
+    n += sse_store_unique(&out[n], prev, lo);
+    prev = lo;
+
+    while (i + 4 <= a_len && j + 4 <= b_len) {
+        /* load from the input with the lowest next id, so that all ids that are left are >= those in `lo` */
+        if (a[i] <= b[j]) {
+            lo = sse_load(&a[i]);
+            i += 4;
+        } else {
+            lo = sse_load(&b[j]);
+            j += 4;
+        }
+        sse_merge(&lo, &hi);
+        n += sse_store_unique(&out[n], prev, lo);
+        prev = lo;
+    }
+
+    uint32_t rest[4];
+    _mm_storeu_si128((__m128i *) rest, hi);
+    uint32_t last = (uint32_t) _mm_extract_epi32(prev, 3);
+
+    return n + union_tail(rest, 4, &a[i], a_len - i, &b[j], b_len - j, last, &out[n]);
+}
+
+SSE_TARGET static size_t
+difference_sse42(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+
+    if (a_len < 4 || b_len < 4) {
+        return difference_merge(a, a_len, b, b_len, out);
+    }
+
+    __m128i va = sse_load(a);
+    __m128i vb = sse_load(b);
+    int matched = 0; /* lanes of `va` found in `b` so far */
+
+    for (;;) {
+        matched |= sse_match_mask(va, vb);
+
+        uint32_t a_last = a[i + 3], b_last = b[j + 3];
+        if (a_last <= b_last) {
+            /* the rest of `b` is greater than `va`, so lanes that have not matched are not in `b` */
+            int keep = ~matched & 0xF;
+            sse_store_lanes(&out[n], va, keep);
+            n += (size_t) __builtin_popcount(keep);
+            matched = 0;
+
+            i += 4;
+            if (i + 4 > a_len) {
+                break;
+            }
+            va = sse_load(&a[i]);
+        }
+        if (b_last <= a_last) {
+            j += 4;
+            if (j + 4 > b_len) {
+                break;
+            }
+            vb = sse_load(&b[j]);
+        }
+    }
+
+    if (i + 4 <= a_len) {
+        /* `b` ran out while `va` was partially compared, finish its lanes against the tail of `b` */
+        for (size_t lane = 0; lane < 4; lane++) {
+            uint32_t id = a[i + lane];
+            if (matched & (1 << lane)) {
+                continue;
+            }
+            while (j < b_len && b[j] < id) {
+                j++;
+            }
+            if (j == b_len || b[j] != id) {
+                out[n++] = id;
+            }
+        }
+        i += 4;
+    }
+
+    return n + difference_merge(&a[i], a_len - i, &b[j], b_len - j, &out[n]);
+}
+
+/* ---- AVX2, 8 ids per vector ---- */
+
+#  define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i avx2_load(const uint32_t *src) {
+    return _mm256_loadu_si256((const __m256i *) src);
+}
+
+/* rotate the lanes one step down, such that lane 0 gets lane 1 and lane 7 gets lane 0 */
+AVX2_TARGET static inline __m256i avx2_rotate(__m256i v) {
+    return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0));
+}
+
+AVX2_TARGET static inline void avx2_store_lanes(uint32_t *dst, __m256i v, int mask) {
+    __m256i permute = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) avx2_compact_table[mask]));
+    _mm256_storeu_si256((__m256i *) dst, _mm256_permutevar8x32_epi32(v, permute));
+}
+
+/* bitmask of the lanes of `va` that are equal to any lane of `vb` */
+AVX2_TARGET static inline int avx2_match_mask(__m256i va, __m256i vb) {
+    __m256i eq = _mm256_cmpeq_epi32(va, vb);
+
+    for (int rotation = 1; rotation < 8; rotation++) {
+        vb = avx2_rotate(vb);
+        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));
+    }
+
+    return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+}
+
+/* merge two sorted vectors, such that `lo` holds the 8 smallest and `hi` the 8 largest ids, both sorted */
+AVX2_TARGET static inline void avx2_merge(__m256i *lo, __m256i *hi) {
+    __m256i min = _mm256_min_epu32(*lo, *hi);
+    __m256i max = _mm256_max_epu32(*lo, *hi);
+
+    for (int round = 0; round < 7; round++) {
+        __m256i rotated = avx2_rotate(min);
+        min = _mm256_min_epu32(rotated, max);
+        max = _mm256_max_epu32(rotated, max);
+    }
+
+    *lo = avx2_rotate(min);
+    *hi = max;
+}
+
+/* store the lanes of the sorted vector `v` that differ from the lane before them, where `prev` was stored last */
+AVX2_TARGET static inline size_t avx2_store_unique(uint32_t *dst, __m256i prev, __m256i v) {
+    const __m256i up = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+    __m256i shifted = _mm256_blend_epi32(
+        _mm256_permutevar8x32_epi32(v, up),
+        _mm256_permutevar8x32_epi32(prev, up),
+        0x01
+    );
+    int keep = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(shifted, v))) & 0xFF;
+    avx2_store_lanes(dst, v, keep);
+    return (size_t) __builtin_popcount(keep);
+}
+
+AVX2_TARGET static size_t
+intersect_avx2(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    const size_t capacity = (a_len < b_len) ? a_len : b_len;
+    size_t i = 0, j = 0, n = 0;
+
+    while (i + 8 <= a_len && j + 8 <= b_len) {
+        __m256i va = avx2_load(&a[i]);
+        int mask = avx2_match_mask(va, avx2_load(&b[j]));
+
+        if (n + 8 <= capacity) {
+            avx2_store_lanes(&out[n], va, mask);
+        } else {
+            /* a full store could write past the end of `out` */
+            uint32_t lanes[8];
+            avx2_store_lanes(lanes, va, mask);
+            memcpy(&out[n], lanes, (size_t) __builtin_popcount(mask) * sizeof(uint32_t));
+        }
+        n += (size_t) __builtin_popcount(mask);
+
+        uint32_t a_last = a[i + 7], b_last = b[j + 7];
+        i += (a_last <= b_last) ? 8 : 0;
+        j += (b_last <= a_last) ? 8 : 0;
+    }
+
+    return n + intersect_merge(&a[i], a_len - i, &b[j], b_len - j, &out[n]);
+}
+
+AVX2_TARGET static size_t union_avx2(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    if (a_len < 8 || b_len < 8) {
+        return union_merge(a, a_len, b, b_len, out);
+    }
+
+    __m256i lo = avx2_load(a);
+    __m256i hi = avx2_load(b);
+    avx2_merge(&lo, &hi);
+
+    /* nothing has been stored yet, so use a previous vector that can not equal the first id */
+    __m256i prev = _mm256_set1_epi32((int) ((uint32_t) _mm256_cvtsi256_si32(lo) - 1));
+    size_t i = 8, j = 8, n = 0;
+
+    n += avx2_store_unique(&out[n], prev, lo);
+    prev = lo;
+
+    while (i + 8 <= a_len && j + 8 <= b_len) {
+        /* load from the input with the lowest next id, so that all ids that are left are >= those in `lo` */
+        if (a[i] <= b[j]) {
+            lo = avx2_load(&a[i]);
+            i += 8;
+        } else {
+            lo = avx2_load(&b[j]);
+            j += 8;
+        }
+        avx2_merge(&lo, &hi);
+        n += avx2_store_unique(&out[n], prev, lo);
+        prev = lo;
+    }
+
+    uint32_t rest[8];
+    _mm256_storeu_si256((__m256i *) rest, hi);
+    uint32_t last = (uint32_t) _mm256_extract_epi32(prev, 7);
+
+    return n + union_tail(rest, 8, &a[i], a_len - i, &b[j], b_len - j, last, &out[n]);
+}
+
+AVX2_TARGET static size_t
+difference_avx2(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+
+    if (a_len < 8 || b_len < 8) {
+        return difference_merge(a, a_len, b, b_len, out);
+    }
+
+    __m256i va = avx2_load(a);
+    __m256i vb = avx2_load(b);
+    int matched = 0; /* lanes of `va` found in `b` so far */
+
+    for (;;) {
+        matched |= avx2_match_mask(va, vb);
+
+        uint32_t a_last = a[i + 7], b_last = b[j + 7];
+        if (a_last <= b_last) {
+            /* the rest of `b` is greater than `va`, so lanes that have not matched are not in `b` */
+            int keep = ~matched & 0xFF;
+            avx2_store_lanes(&out[n], va, keep);
+            n += (size_t) __builtin_popcount(keep);
+            matched = 0;
+
+            i += 8;
+            if (i + 8 > a_len) {
+                break;
+            }
+            va = avx2_load(&a[i]);
+        }
+        if (b_last <= a_last) {
+            j += 8;
+            if (j + 8 > b_len) {
+                break;
+            }
+            vb = avx2_load(&b[j]);
+        }
+    }
+
+    if (i + 8 <= a_len) {
+        /* `b` ran out while `va` was partially compared, finish its lanes against the tail of `b` */
+        for (size_t lane = 0; lane < 8; lane++) {
+            uint32_t id = a[i + lane];
+            if (matched & (1 << lane)) {
+                continue;
+            }
+            while (j < b_len && b[j] < id) {
+                j++;
+            }
+            if (j == b_len || b[j] != id) {
+                out[n++] = id;
+            }
+        }
+        i += 8;
+    }
+
+    return n + difference_merge(&a[i], a_len - i, &b[j], b_len - j, &out[n]);
+}
+
+#endif /* DOCSET_X86 */
+
+/* ------------------------Dispatch-------------------------- */
+
+typedef size_t (*docset_op_fn)(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out);
+
+typedef struct docset_ops {
+    docset_op_fn intersect;
+    docset_op_fn unite;
+    docset_op_fn difference;
+} docset_ops_t;
+
+static const docset_ops_t kernel_ops[DOCSET_N_KERNELS] = {
+    [DOCSET_KERNEL_SCALAR] = {intersect_merge, union_merge, difference_merge},
+#ifdef DOCSET_X86
+    [DOCSET_KERNEL_SSE42] = {intersect_sse42, union_sse42, difference_sse42},
+    [DOCSET_KERNEL_AVX2] = {intersect_avx2, union_avx2, difference_avx2},
+#endif
+};
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static atomic_int active_kernel = DOCSET_KERNEL_SCALAR;
+
+int docset_kernel_supported(docset_kernel_t kernel) {
+    switch (kernel) {
+    case DOCSET_KERNEL_SCALAR:
+        return 1;
+#ifdef DOCSET_X86
+    case DOCSET_KERNEL_SSE42:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") != 0;
+    case DOCSET_KERNEL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* pick the widest kernel the cpu supports */
+static void init_kernels(void) {
+#ifdef DOCSET_X86
+    init_compact_tables();
+#endif
+    for (int kernel = DOCSET_N_KERNELS - 1; kernel >= 0; kernel--) {
+        if (docset_kernel_supported(kernel)) {
+            atomic_store(&active_kernel, kernel);
+            break;
+        }
+    }
+}
+
+static inline const docset_ops_t *active_ops(void) {
+    pthread_once(&kernel_once, init_kernels);
+    return &kernel_ops[atomic_load_explicit(&active_kernel, memory_order_relaxed)];
+}
+
+docset_kernel_t docset_kernel(void) {
+    pthread_once(&kernel_once, init_kernels);
+    return atomic_load(&active_kernel);
+}
+
+int docset_use_kernel(docset_kernel_t kernel) {
+    pthread_once(&kernel_once, init_kernels);
+    if (!docset_kernel_supported(kernel)) {
+        return -1;
+    }
+    atomic_store(&active_kernel, kernel);
+    return 0;
+}
+
+const char *docset_kernel_name(docset_kernel_t kernel) {
+    switch (kernel) {
+    case DOCSET_KERNEL_SCALAR:
+        return "scalar";
+    case DOCSET_KERNEL_SSE42:
+        return "sse4.2";
+    case DOCSET_KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "unknown";
+    }
+}
+
+/* -----------------------Intersection----------------------- */
+
+static size_t intersect_merge(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+
+    while (i < a_len && j < b_len) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+
+    return n;
+}
+
+/* look up each id of the smaller array in the larger one */
+static size_t
+intersect_gallop(const uint32_t *small, size_t small_len, const uint32_t *large, size_t large_len, uint32_t *out) {
+    size_t j = 0, n = 0;
+
+    for (size_t i = 0; i < small_len && j < large_len; i++) {
+        j = docset_gallop(large, large_len, j, small[i]);
+        if (j < large_len && large[j] == small[i]) {
+            out[n++] = small[i];
+            j++;
+        }
+    }
+
+    return n;
+}
+
+size_t docset_intersect(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    if (should_gallop(a_len, b_len)) {
+        return intersect_gallop(a, a_len, b, b_len, out);
+    }
+    if (should_gallop(b_len, a_len)) {
+        return intersect_gallop(b, b_len, a, a_len, out);
+    }
+    return active_ops()->intersect(a, a_len, b, b_len, out);
+}
+
+/* --------------------------Union--------------------------- */
+
+static size_t union_merge(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+
+    while (i < a_len && j < b_len) {
+        if (a[i] < b[j]) {
+            out[n++] = a[i++];
+        } else if (a[i] > b[j]) {
+            out[n++] = b[j++];
+        } else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+
+    memcpy(&out[n], &a[i], (a_len - i) * sizeof(uint32_t));
+    n += a_len - i;
+    memcpy(&out[n], &b[j], (b_len - j) * sizeof(uint32_t));
+    n += b_len - j;
+
+    return n;
+}
+
+/* copy the runs of the larger array between the ids of the smaller one */
+static size_t
+union_gallop(const uint32_t *small, size_t small_len, const uint32_t *large, size_t large_len, uint32_t *out) {
+    size_t j = 0, n = 0;
+
+    for (size_t i = 0; i < small_len; i++) {
+        size_t run_end = docset_gallop(large, large_len, j, small[i]);
+
+        memcpy(&out[n], &large[j], (run_end - j) * sizeof(uint32_t));
+        n += run_end - j;
+        j = run_end;
+
+        out[n++] = small[i];
+        if (j < large_len && large[j] == small[i]) {
+            j++;
+        }
+    }
+
+    memcpy(&out[n], &large[j], (large_len - j) * sizeof(uint32_t));
+    n += large_len - j;
+
+    return n;
+}
+
+size_t docset_union(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    if (should_gallop(a_len, b_len)) {
+        return union_gallop(a, a_len, b, b_len, out);
+    }
+    if (should_gallop(b_len, a_len)) {
+        return union_gallop(b, b_len, a, a_len, out);
+    }
+    return active_ops()->unite(a, a_len, b, b_len, out);
+}
+
+/* ------------------------Difference------------------------ */
+
+static size_t difference_merge(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    size_t i = 0, j = 0, n = 0;
+
+    while (i < a_len && j < b_len) {
+        if (a[i] < b[j]) {
+            out[n++] = a[i++];
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+
+    memcpy(&out[n], &a[i], (a_len - i) * sizeof(uint32_t));
+    n += a_len - i;
+
+    return n;
+}
+
+/* `a` is small: look up each of its ids in `b` */
+static size_t difference_gallop_b(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    size_t j = 0, n = 0;
+
+    for (size_t i = 0; i < a_len; i++) {
+        j = docset_gallop(b, b_len, j, a[i]);
+        if (j < b_len && b[j] == a[i]) {
+            j++;
+        } else {
+            out[n++] = a[i];
+        }
+    }
+
+    return n;
+}
+
+/* `b` is small: copy the runs of `a` between the ids of `b` */
+static size_t difference_gallop_a(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    size_t i = 0, n = 0;
+
+    for (size_t j = 0; j < b_len && i < a_len; j++) {
+        size_t run_end = docset_gallop(a, a_len, i, b[j]);
+
+        memcpy(&out[n], &a[i], (run_end - i) * sizeof(uint32_t));
+        n += run_end - i;
+        i = run_end;
+
+        if (i < a_len && a[i] == b[j]) {
+            i++;
+        }
+    }
+
+    memcpy(&out[n], &a[i], (a_len - i) * sizeof(uint32_t));
+    n += a_len - i;
+
+    return n;
+}
+
+size_t docset_difference(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len, uint32_t *out) {
+    if (should_gallop(a_len, b_len)) {
+        return difference_gallop_b(a, a_len, b, b_len, out);
+    }
+    if (should_gallop(b_len, a_len)) {
+        return difference_gallop_a(a, a_len, b, b_len, out);
+    }
+    return active_ops()->difference(a, a_len, b, b_len, out);
+}
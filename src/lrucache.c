@@ -0,0 +1,155 @@
+/**
+ * @implements lrucache.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "printing.h"
+#include "common.h"
+#include "map.h"
+#include "lrucache.h"
+
+/* a cached value, linked from the most to the least recently used */
+typedef struct lru_node {
+    char *key;
+    void *val;
+    size_t n_bytes;
+    struct lru_node *prev;
+    struct lru_node *next;
+} lru_node_t;
+
+struct lru_cache {
+    map_t *map; // key -> lru_node_t
+    lru_node_t *newest;
+    lru_node_t *oldest;
+    size_t n_bytes;
+    size_t budget;
+    free_fn val_freefn;
+};
+
+lru_cache_t *lru_create(size_t budget, free_fn val_freefn) {
+    lru_cache_t *cache = malloc(sizeof(lru_cache_t));
+    if (cache == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    cache->map = map_create((cmp_fn) strcmp, (hash64_fn) hash_string_wyhash64);
+    if (cache->map == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->n_bytes = 0;
+    cache->budget = budget;
+    cache->val_freefn = val_freefn;
+    return cache;
+}
+
+void lru_destroy(lru_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    lru_clear(cache);
+    map_destroy(cache->map, NULL, NULL);
+    free(cache);
+}
+
+static void unlink_node(lru_cache_t *cache, lru_node_t *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        cache->newest = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        cache->oldest = node->prev;
+    }
+}
+
+static void push_newest(lru_cache_t *cache, lru_node_t *node) {
+    node->prev = NULL;
+    node->next = cache->newest;
+    if (cache->newest) {
+        cache->newest->prev = node;
+    } else {
+        cache->oldest = node;
+    }
+    cache->newest = node;
+}
+
+static void evict(lru_cache_t *cache, lru_node_t *node) {
+    free(map_remove(cache->map, node->key));
+    unlink_node(cache, node);
+    cache->n_bytes -= node->n_bytes;
+
+    if (cache->val_freefn) {
+        cache->val_freefn(node->val);
+    }
+    free(node->key);
+    free(node);
+}
+
+void *lru_get(lru_cache_t *cache, const char *key) {
+    entry_t *entry = map_get(cache->map, (void *) key);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    lru_node_t *node = entry->val;
+    unlink_node(cache, node);
+    push_newest(cache, node);
+    return node->val;
+}
+
+int lru_put(lru_cache_t *cache, const char *key, void *val, size_t n_bytes) {
+    /* the key is accounted for along with the value */
+    n_bytes += sizeof(lru_node_t) + strlen(key) + 1;
+    if (n_bytes > cache->budget) {
+        return -1;
+    }
+
+    lru_node_t *node = malloc(sizeof(lru_node_t));
+    char *key_copy = strdup(key);
+    if (node == NULL || key_copy == NULL) {
+        pr_error("Failed to allocate memory\n");
+        free(node);
+        free(key_copy);
+        return -1;
+    }
+
+    /* the key is hashed once for both the lookup and the insertion (the map hashes with hash_string_wyhash64) */
+    uint64_t hash = hash_string_wyhash64(key);
+    entry_t *entry = map_get_hashed(cache->map, (void *) key, hash);
+    if (entry) {
+        evict(cache, entry->val);
+    }
+    while (cache->n_bytes + n_bytes > cache->budget) {
+        evict(cache, cache->oldest);
+    }
+
+    node->key = key_copy;
+    node->val = val;
+    node->n_bytes = n_bytes;
+    map_insert_hashed(cache->map, node->key, node, hash);
+    push_newest(cache, node);
+    cache->n_bytes += n_bytes;
+    return 0;
+}
+
+void lru_clear(lru_cache_t *cache) {
+    while (cache->oldest) {
+        evict(cache, cache->oldest);
+    }
+}
+
+size_t lru_length(lru_cache_t *cache) {
+    return map_length(cache->map);
+}
+
+size_t lru_bytes(lru_cache_t *cache) {
+    return cache->n_bytes;
+}
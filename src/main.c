@@ -14,10 +14,13 @@
 #include <errno.h>
 #include <ctype.h>
 #include <limits.h>
+#include <math.h>
 #include <unistd.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #include "printing.h"
 #include "findfiles.h"
@@ -28,14 +31,26 @@
 #include "index.h"
 #include "set.h"
 #include "logger.h"
+#include "threadpool.h"
+#include "docset.h"
+#include "manifest.h"
 
 
-/* SETTING: limit the maximum number of results printed for queries. 0=unlimited. */
+/* SETTING: limit the maximum number of results printed for queries. 0=unlimited. Can be changed with --top */
 #define MAX_RESULT_TABLE_ROWS 20
 
 /* SETTING: Update 'Processing document # n / N' output every 'x' files. 0=disable */
 #define PRINT_PROGRESS_INTERVAL 100
 
+/**
+ * SETTING: used to estimate the size of the index from the size of the files, so it can be allocated up front.
+ * Average bytes per token (word and delimiter), and the parameters of Heaps' law for the number of unique terms
+ * in n tokens, V = K * n^BETA. The defaults are typical of english text (K = 44, BETA = 0.49 for Reuters RCV1).
+ */
+#define ESTIMATE_BYTES_PER_TOKEN 6
+#define ESTIMATE_HEAPS_K         44.0
+#define ESTIMATE_HEAPS_BETA      0.49
+
 #define CLI_COMMAND_EXIT      ".exit"
 #define CLI_COMMAND_CLEAR     ".clear"
 #define CLI_COMMAND_AUTOCLEAR ".autoclear"
@@ -48,10 +63,52 @@ static const char *limit_arg = "--limit";
 static const char *stderr_arg = "--stderr";
 static const char *outfile_arg = "--outfile";
 static const char *help_arg = "--help";
+static const char *threads_arg = "--threads";
+static const char *codec_arg = "--codec";
+static const char *engine_arg = "--engine";
+static const char *top_arg = "--top";
+static const char *bm25_arg = "--bm25";
+static const char *pruning_arg = "--pruning";
+static const char *cache_arg = "--cache";
+static const char *subquery_cache_arg = "--subquery-cache";
+static const char *program_cache_arg = "--program-cache";
+static const char *batch_arg = "--batch";
+static const char *shards_arg = "--shards";
+static const char *save_index_arg = "--save-index";
+static const char *load_index_arg = "--load-index";
+static const char *verify_index_arg = "--verify-index";
+static const char *manifest_arg = "--manifest";
 
 /* will be set to a logger if the optional --outfile argument is present */
 static logger_t *result_logger = NULL;
 
+/* number of threads used to build the index. Set by the optional --threads argument */
+static size_t n_build_threads = 1;
+
+/* number of threads piped queries are run on, in batches. Set by the optional --batch argument, 0=one by one */
+static size_t n_batch_threads = 0;
+
+/* number of shards the documents are partitioned into. Set by the optional --shards argument, 1=a single index */
+static size_t n_shards = 1;
+
+/* path the index is saved to once built. Set by the optional --save-index argument */
+static const char *save_index_path = NULL;
+
+/* path of a saved index to load instead of building one. Set by the optional --load-index argument */
+static const char *load_index_path = NULL;
+
+/* path of the build manifest, used to skip unchanged files when rebuilding. Set by the optional --manifest argument */
+static const char *manifest_path = NULL;
+
+/* the manifest the index is built through, if there is a manifest_path. Shared by the build workers. */
+static manifest_t *build_manifest = NULL;
+
+/* number of best results fetched and printed for each query, 0=all. Set by the optional --top argument */
+static size_t n_top_results = MAX_RESULT_TABLE_ROWS;
+
+/* config used to create the index (and any partial indexes). Modified by optional arguments such as --codec */
+static index_config_t index_config;
+
 /* write to the result logger, if it exists */
 static void log_result(const char *buf) {
     if (result_logger) {
@@ -88,26 +145,60 @@ static void print_command_list() {
     printf("%-*s - %s\n", col_w, CLI_COMMAND_EXIT, "Exit the application");
     printf("%-*s - %s\n", col_w, CLI_COMMAND_CLEAR, "Clear the terminal once");
     printf("%-*s - %s\n", col_w, CLI_COMMAND_AUTOCLEAR, "Toggle clearing the terminal on each new query");
-    printf("%-*s - %s\n", col_w, CLI_COMMAND_STAT, "Print the number indexed documents and unique terms");
+    printf("%-*s - %s\n", col_w, CLI_COMMAND_STAT, "Print the number indexed documents, unique terms and postings size");
     printf("%-*s - %s\n", col_w, CLI_COMMAND_INFO, "Print this message");
     printf("Note: Clearing the terminal only works in ANSI/POSIX terminal emulators\n");
 }
 
+typedef struct arg_usage {
+    const char *arg;
+    const char *val;
+    const char *descr;
+} arg_usage_t;
+
 static void print_arg_usage(int col_w, const char *arg, const char *val, const char *descr) {
-    int whitespace_w = (int) col_w - (strlen(arg) + strlen(val));
+    int whitespace_w = col_w - (int) (strlen(arg) + strlen(val));
     fprintf(stderr, "%s %s %*s - %s\n", arg, val, whitespace_w, "", descr);
 }
 
 static void print_usage(char **argv) {
-    static const int col_w = 22;
+    const arg_usage_t args[] = {
+        {type_arg, "<1...n>", "Filter included data files by extension"},
+        {limit_arg, "<n>", "Limit number of included data files"},
+        {outfile_arg, "<fpath>", "Log succesful queries / results to a file"},
+        {stderr_arg, "<fpath | tty>", "Redirect stderr to file or terminal"},
+        {threads_arg, "<n>", "Build the index with n worker threads"},
+        {codec_arg, "<varint | simple8b | bitpack>", "Codec used to compress postings"},
+        {engine_arg, "<iterators | sets>", "How queries are evaluated"},
+        {top_arg, "<k>", "Print the k best results of each query (0 = all)"},
+        {bm25_arg, "<k1,b>", "BM25 parameters used to score results (default 1.2,0.75)"},
+        {pruning_arg, "<none | wand | block-max>", "Skip documents of || queries that cannot make the top k"},
+        {cache_arg, "<bytes>", "Memory budget of the query result cache (0 = disabled)"},
+        {subquery_cache_arg, "<bytes>", "Memory budget of the cache of subquery results (0 = disabled)"},
+        {program_cache_arg, "<bytes>", "Memory budget of the cache of compiled queries (0 = disabled)"},
+        {batch_arg, "<n>", "Run piped queries in batches on n worker threads"},
+        {shards_arg, "<n>", "Partition the documents into n shards, queried concurrently"},
+        {save_index_arg, "<fpath>", "Save the index to a file once built"},
+        {load_index_arg, "<fpath>", "Load a saved index instead of building one"},
+        {verify_index_arg, "<none | full>", "Check the whole file of a loaded index before using it"},
+        {manifest_arg, "<fpath>", "Rebuild only the files that changed since the manifest was saved"},
+    };
+    size_t n_args = sizeof(args) / sizeof(args[0]);
+
+    /* the descriptions line up after the longest flag and value */
+    int col_w = (int) strlen("<data-dir>") - 2;
+    for (size_t i = 0; i < n_args; i++) {
+        int w = (int) (strlen(args[i].arg) + strlen(args[i].val));
+        col_w = (w > col_w) ? w : col_w;
+    }
+
     fprintf(stderr, "\nUsage: \"%s <data-dir> [...optional args>]\"\n", basename(argv[0]));
     fprintf(stderr, "Required Arguments:\n");
     fprintf(stderr, "%-*s - %s\n", col_w + 2, "<data-dir>", "Path to directory of files to index");
     fprintf(stderr, "Optional Arguments:\n");
-    print_arg_usage(col_w, type_arg, "<1...n>", "Filter included data files by extension");
-    print_arg_usage(col_w, limit_arg, "<n>", "Limit number of included data files");
-    print_arg_usage(col_w, outfile_arg, "<fpath>", "Log succesful queries / results to a file");
-    print_arg_usage(col_w, stderr_arg, "<fpath | tty>", "Redirect stderr to file or terminal");
+    for (size_t i = 0; i < n_args; i++) {
+        print_arg_usage(col_w, args[i].arg, args[i].val, args[i].descr);
+    }
 }
 
 /**
@@ -146,9 +237,8 @@ int is_valid_query_char(int c) {
     return is_ascii_alnum(c);
 }
 
-static void process_query_results(list_t *results, const char *input, long double t_secs) {
+static void process_query_results(list_t *results, index_query_stats_t *stats, const char *input, long double t_secs) {
     char result_buf[LINE_MAX];
-    size_t n_results = list_length(results);
     int n_decimals = (t_secs > 1.0E-3) ? 4 : 6; // 6 decimals if less than 1ms, otherwise 4
 
     if (result_logger) {
@@ -157,15 +247,20 @@ static void process_query_results(list_t *results, const char *input, long doubl
         log_result(result_buf);
     }
 
-    snprintf(
-        result_buf,
-        LINE_MAX,
-        "=== Found %zu result%s in %.*Lfs ===\n",
-        n_results,
-        (n_results == 1) ? "" : "s",
-        n_decimals,
-        t_secs
+    /* with pruning, documents that cannot make the top results are skipped, and only a lower bound is known */
+    size_t n_results = stats->n_hits;
+    const char *at_least = stats->n_hits_exact ? "" : "at least ";
+    int len = snprintf(
+        result_buf, LINE_MAX, "=== Found %s%zu result%s", at_least, n_results, (n_results == 1) ? "" : "s"
     );
+    /* queries run in a batch are not timed one by one */
+    if (t_secs >= 0.0) {
+        len += snprintf(&result_buf[len], LINE_MAX - len, " in %.*Lfs", n_decimals, t_secs);
+    }
+    if (!stats->n_hits_exact) {
+        len += snprintf(&result_buf[len], LINE_MAX - len, " (%zu scored)", stats->n_scored);
+    }
+    snprintf(&result_buf[len], LINE_MAX - len, " ===\n");
     output_result(result_buf);
 
     if (!results) {
@@ -190,14 +285,12 @@ static void process_query_results(list_t *results, const char *input, long doubl
 
         n_printed += 1;
         free(res); // free the result we just popped
+    }
 
-        if (MAX_RESULT_TABLE_ROWS) {
-            if (n_printed >= MAX_RESULT_TABLE_ROWS && list_length(results)) {
-                snprintf(result_buf, LINE_MAX, " ... and %zu more\n", list_length(results));
-                output_result(result_buf);
-                break;
-            }
-        }
+    /* the index only returns the best n_top_results of the results */
+    if (n_results > n_printed) {
+        snprintf(result_buf, LINE_MAX, " ... and %s%zu more\n", at_least, n_results - n_printed);
+        output_result(result_buf);
     }
 
     if (result_logger) {
@@ -227,6 +320,22 @@ static list_t *tokenize_query(char *query) {
     return tokens;
 }
 
+/* print the results of a query, which are then destroyed, or its error message if it failed */
+static void print_query_outcome(
+    list_t *results, index_query_stats_t *stats, const char *errmsg, const char *input, long double t_secs
+) {
+    if (results) {
+        process_query_results(results, stats, input, t_secs);
+
+        /* destroy the list of results and any result_t objects in it */
+        list_destroy(results, free);
+    } else if (errmsg && *errmsg) {
+        cli_pr_error("Invalid query", "%s\n", errmsg);
+    } else {
+        cli_pr_error("Index error", "Index returned no results or error message\n");
+    }
+}
+
 /* execute a query with the index and print results (if any) or error message */
 static void execute_query(index_t *idx, list_t *tokens, const char *input) {
     pr_debug("input = \"%s\"\n", input);
@@ -237,24 +346,161 @@ static void execute_query(index_t *idx, list_t *tokens, const char *input) {
 
     /* run the query, timing the time it takes */
     gettimeofday(&t_start, NULL);
-    list_t *results = index_query(idx, tokens, errmsg_buf);
+    index_query_stats_t stats;
+    list_t *results = index_query_topk(idx, tokens, n_top_results, &stats, errmsg_buf);
     gettimeofday(&t_end, NULL);
 
     long double t_secs = (long double) (t_end.tv_sec - t_start.tv_sec);    // difference in seconds
     t_secs += (long double) (t_end.tv_usec - t_start.tv_usec) / 1000000.0; // convert µs part to secs & add
 
-    if (results) {
-        process_query_results(results, input, t_secs);
+    print_query_outcome(results, &stats, errmsg_buf, input, t_secs);
+}
 
-        /* destroy the list of results and any result_t objects in it */
-        list_destroy(results, free);
-    } else if (*errmsg_buf) {
-        cli_pr_error("Invalid query", "%s\n", errmsg_buf);
-    } else {
-        cli_pr_error("Index error", "Index returned no results or error message\n");
+/**
+ * @brief Run the piped queries up to the next command (or the end) as one batch with `index_query_batch`, on
+ * `n_batch_threads` workers. The results are then printed in the order the queries were piped.
+ * @param piped_input: list of remaining piped lines. The queries of the batch are popped from it.
+ */
+static void execute_batch(index_t *idx, list_t *piped_input) {
+    list_t *inputs = list_create(NULL);
+    if (!inputs) {
+        cli_pr_error("Query error", "Likely out of memory\n");
+        return;
+    }
+
+    while (list_length(piped_input)) {
+        char *line = list_popfirst(piped_input);
+        if (*trim(line) == '.') {
+            list_addfirst(piped_input, line); // commands are handled by the interpreter, between batches
+            break;
+        }
+        if (*line == '\0') {
+            free(line);
+        } else {
+            list_addlast(inputs, line);
+        }
+    }
+
+    size_t n_queries = list_length(inputs);
+    index_batch_query_t *queries = calloc(n_queries + 1, sizeof(index_batch_query_t));
+    char **lines = calloc(n_queries + 1, sizeof(char *));
+    if (!queries || !lines) {
+        cli_pr_error("Query error", "Likely out of memory\n");
+        free(queries);
+        free(lines);
+        list_destroy(inputs, free);
+        return;
+    }
+
+    for (size_t i = 0; i < n_queries; i++) {
+        lines[i] = list_popfirst(inputs);
+        queries[i].tokens = tokenize_query(lines[i]);
+        if (!queries[i].tokens) {
+            PANIC("Failed to tokenize query\n");
+        }
     }
+    list_destroy(inputs, NULL);
+
+    struct timeval t_start, t_end;
+    gettimeofday(&t_start, NULL);
+    int status = index_query_batch(idx, queries, n_queries, n_top_results, n_batch_threads);
+    gettimeofday(&t_end, NULL);
+
+    long double t_secs = (long double) (t_end.tv_sec - t_start.tv_sec);
+    t_secs += (long double) (t_end.tv_usec - t_start.tv_usec) / 1000000.0;
+
+    for (size_t i = 0; i < n_queries; i++) {
+        cli_pr_input(lines[i]);
+
+        if (status != 0) {
+            cli_pr_error("Index error", "Failed to run the batch of queries\n");
+        } else if (list_length(queries[i].tokens) == 0) {
+            printf("Found no usable characters in the query\n");
+        } else {
+            print_query_outcome(queries[i].results, &queries[i].stats, queries[i].errmsg, lines[i], -1.0);
+            queries[i].results = NULL;
+        }
+
+        list_destroy(queries[i].results, free);
+        list_destroy(queries[i].tokens, free);
+        free(queries[i].errmsg);
+        free(lines[i]);
+    }
+    printf("=== Ran %zu queries in %.4Lfs on %zu threads ===\n", n_queries, t_secs, n_batch_threads);
+
+    free(queries);
+    free(lines);
+}
+
+
+/* print the hit rate and size of one of the caches of the index */
+static void print_cache_stats(const char *name, index_cache_stats_t *cache) {
+    if (cache->budget == 0) {
+        printf("%s: disabled\n", name);
+        return;
+    }
+
+    size_t n_lookups = cache->hits + cache->misses;
+    double hit_rate = n_lookups ? 100.0 * (double) cache->hits / (double) n_lookups : 0.0;
+    printf(
+        "%s: %zu hits, %zu misses (%.1f%% hit rate), %zu entries in %zu / %zu bytes\n",
+        name,
+        cache->hits,
+        cache->misses,
+        hit_rate,
+        cache->n_entries,
+        cache->n_bytes,
+        cache->budget
+    );
 }
 
+/* print the postings size per term class, as given by index_stat_detail */
+static void print_index_stats(index_t *idx) {
+    index_stats_t stats;
+    index_stat_detail(idx, &stats);
+
+    size_t raw_total = 0, compressed_total = 0;
+    char range_buf[64];
+
+    printf("Postings compressed with %s:\n", codec_name(stats.codec));
+    printf("%-14s %10s %12s %14s %14s %7s\n", "Docs/term", "Terms", "Postings", "Raw bytes", "Compressed", "Ratio");
+
+    for (size_t c = 0; c < INDEX_N_TERM_CLASSES; c++) {
+        index_term_class_t *tc = &stats.term_classes[c];
+
+        if (tc->max_docs == 0) {
+            snprintf(range_buf, sizeof(range_buf), "%zu+", tc->min_docs);
+        } else if (tc->max_docs == tc->min_docs) {
+            snprintf(range_buf, sizeof(range_buf), "%zu", tc->min_docs);
+        } else {
+            snprintf(range_buf, sizeof(range_buf), "%zu-%zu", tc->min_docs, tc->max_docs);
+        }
+
+        double ratio = tc->compressed_bytes ? (double) tc->raw_bytes / (double) tc->compressed_bytes : 0.0;
+        printf(
+            "%-14s %10zu %12zu %14zu %14zu %6.2fx\n",
+            range_buf,
+            tc->n_terms,
+            tc->n_postings,
+            tc->raw_bytes,
+            tc->compressed_bytes,
+            ratio
+        );
+
+        raw_total += tc->raw_bytes;
+        compressed_total += tc->compressed_bytes;
+    }
+
+    double ratio = compressed_total ? (double) raw_total / (double) compressed_total : 0.0;
+    printf("%-14s %10s %12s %14zu %14zu %6.2fx\n", "Total", "", "", raw_total, compressed_total, ratio);
+
+    printf("Set operations use the %s kernels\n", docset_kernel_name(docset_kernel()));
+    printf("Index layout: %s\n", stats.compact ? "compact (frozen)" : "mutable");
+
+    print_cache_stats("Result cache", &stats.cache);
+    print_cache_stats("Subquery cache", &stats.subquery_cache);
+    print_cache_stats("Program cache", &stats.program_cache);
+}
 
 /**
  * @brief Run the interpreter
@@ -276,6 +522,10 @@ static int run_interpreter(index_t *idx, list_t *piped_input) {
     while (1) {
         memset(input, 0, LINE_MAX);
 
+        if (piped_input && n_batch_threads > 0) {
+            execute_batch(idx, piped_input);
+        }
+
         if (piped_input) {
             if (!list_length(piped_input)) {
                 pr_info("Executed all piped queries\n");
@@ -314,6 +564,7 @@ static int run_interpreter(index_t *idx, list_t *piped_input) {
                 size_t n_docs, n_terms;
                 index_stat(idx, &n_docs, &n_terms);
                 printf("Index consists of %zu documents and %zu unique terms\n", n_docs, n_terms);
+                print_index_stats(idx);
             } else if (strcmp(input, CLI_COMMAND_INFO) == 0) {
                 print_command_list();
             } else {
@@ -346,6 +597,17 @@ static int run_interpreter(index_t *idx, list_t *piped_input) {
     }
 }
 
+/**
+ * tokenize file:
+ * - tokens must be min. 1 char
+ * - split at whitespace,
+ * - include only alphanumeric ascii chars,
+ * - convert to lowercase
+ */
+static int tokenize_terms(FILE *f, list_t *terms) {
+    return tokenize_file(f, terms, 1, isspace, is_ascii_alnum, tolower);
+}
+
 /**
  * Process an individual file, reading it anc converting to tokens (words)
  */
@@ -363,14 +625,7 @@ static list_t *read_file_terms(char *fpath) {
         return NULL;
     }
 
-    /**
-     * tokenize file:
-     * - tokens must be min. 1 char
-     * - split at whitespace,
-     * - include only alphanumeric ascii chars,
-     * - convert to lowercase
-     */
-    int status = tokenize_file(infile, terms, 1, isspace, is_ascii_alnum, tolower);
+    int status = tokenize_terms(infile, terms);
     fclose(infile);
 
     if (status < 0) {
@@ -382,6 +637,173 @@ static list_t *read_file_terms(char *fpath) {
     return terms;
 }
 
+/* print the 'Processing document # n / N' output, if this is one of the files it should be updated for */
+static void print_progress(size_t i, size_t files_total) {
+    if (PRINT_PROGRESS_INTERVAL && (i % PRINT_PROGRESS_INTERVAL == 0 || i == 1 || i == files_total)) {
+        printf("\rProcessing document # %zu / %zu", i, files_total);
+        fflush(stdout);
+    }
+}
+
+/* read and index a single file. Path is owned by the index (or freed) from this point */
+static void index_file(index_t *idx, char *path) {
+    /* with a manifest, the file is only tokenized if it has changed since the manifest was saved */
+    if (build_manifest) {
+        const manifest_doc_t *doc = manifest_update(build_manifest, path, tokenize_terms);
+
+        if (doc == NULL) {
+            pr_error("\nFailed to process document.. Ignoring this path and continuing.");
+            free(path);
+        } else if (index_document_counts(idx, path, doc->terms, doc->counts, doc->n_terms) != 0) {
+            PANIC("\nindex_document_counts failed!\n");
+        }
+        return;
+    }
+
+    list_t *terms = read_file_terms(path);
+
+    if (terms == NULL) {
+        pr_error("\nFailed to process document.. Ignoring this path and continuing.");
+        free(path);
+    } else {
+        /**
+         * Process document with the index.
+         * index owns 'path' and 'terms' from this point, regardless of status
+         */
+        int status = index_document(idx, path, terms);
+
+        if (status != 0) {
+            PANIC("\nindex_document failed!\n");
+        }
+    }
+}
+
+/* size of the file at `path` in bytes, or 0 if it cannot be stat'ed */
+static size_t file_bytes(const char *path) {
+    struct stat st;
+    return (stat(path, &st) == 0 && st.st_size > 0) ? (size_t) st.st_size : 0;
+}
+
+/* reserve room in `idx` for `n_docs` documents of `n_bytes` in total, estimating their unique terms by Heaps' law */
+static void reserve_index(index_t *idx, size_t n_docs, size_t n_bytes) {
+    size_t n_tokens = n_bytes / ESTIMATE_BYTES_PER_TOKEN;
+    size_t n_terms = (size_t) (ESTIMATE_HEAPS_K * pow((double) n_tokens, ESTIMATE_HEAPS_BETA));
+
+    if (n_terms > n_tokens) {
+        n_terms = n_tokens;
+    }
+
+    pr_debug("Reserving room for %zu documents and about %zu terms\n", n_docs, n_terms);
+    if (index_reserve(idx, n_docs, n_terms) != 0) {
+        pr_warn("Failed to reserve room in the index, growing it as needed instead\n");
+    }
+}
+
+/* number of files processed so far by the parallel build, across all workers */
+static atomic_size_t n_files_processed;
+
+/* a consecutive share of the paths, indexed into its own partial index by one worker */
+typedef struct build_task {
+    char **paths;
+    size_t n_paths;
+    size_t files_total;
+    index_t *partial;
+} build_task_t;
+
+static void build_partial_index(void *arg) {
+    build_task_t *task = arg;
+
+    for (size_t i = 0; i < task->n_paths; i++) {
+        print_progress(atomic_fetch_add(&n_files_processed, 1) + 1, task->files_total);
+        index_file(task->partial, task->paths[i]);
+    }
+}
+
+/**
+ * @brief Build the index on `n_threads` workers. The paths are split into consecutive shares, each worker
+ * reads, tokenizes and indexes its share into a partial index, and the partials are merged in order.
+ * Documents thus get the same ids as they would in a serial build.
+ *
+ * With `n_shards` > 1 there is one share per shard, and the partials become the shards of the index instead
+ * of being merged.
+ */
+static index_t *build_index_parallel(list_t *fpaths, size_t n_threads, size_t n_shards) {
+    const size_t files_total = list_length(fpaths);
+    const size_t n_shares = (n_shards > 1) ? n_shards : n_threads;
+    const size_t n_tasks = (n_shares < files_total) ? n_shares : files_total;
+    const size_t n_workers = (n_threads < n_tasks) ? n_threads : n_tasks;
+
+    build_task_t *tasks = calloc(n_tasks, sizeof(build_task_t));
+    if (tasks == NULL) {
+        pr_error("Malloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    threadpool_t *pool = threadpool_create(n_workers);
+    if (pool == NULL) {
+        free(tasks);
+        return NULL;
+    }
+
+    atomic_store(&n_files_processed, 0);
+
+    for (size_t t = 0; t < n_tasks; t++) {
+        build_task_t *task = &tasks[t];
+
+        /* spread the remainder over the first shares */
+        task->n_paths = files_total / n_tasks + ((t < files_total % n_tasks) ? 1 : 0);
+        task->files_total = files_total;
+        task->paths = malloc(task->n_paths * sizeof(char *));
+        task->partial = index_create_with_config(&index_config);
+
+        if (task->paths == NULL || task->partial == NULL) {
+            PANIC("Failed to create partial index\n");
+        }
+
+        size_t n_bytes = 0;
+        for (size_t i = 0; i < task->n_paths; i++) {
+            task->paths[i] = list_popfirst(fpaths);
+            n_bytes += file_bytes(task->paths[i]);
+        }
+        reserve_index(task->partial, task->n_paths, n_bytes);
+
+        if (threadpool_submit(pool, build_partial_index, task) != 0) {
+            PANIC("Failed to submit build task\n");
+        }
+    }
+
+    /* waits for all shares to be indexed */
+    threadpool_destroy(pool);
+
+    if (n_shards > 1) {
+        index_t **partials = malloc(n_tasks * sizeof(index_t *));
+        if (partials == NULL) {
+            PANIC("Failed to create shards\n");
+        }
+        for (size_t t = 0; t < n_tasks; t++) {
+            partials[t] = tasks[t].partial;
+            free(tasks[t].paths);
+        }
+
+        index_t *idx = index_create_sharded(partials, n_tasks);
+        free(partials);
+        free(tasks);
+        return idx;
+    }
+
+    index_t *idx = tasks[0].partial;
+    for (size_t t = 0; t < n_tasks; t++) {
+        free(tasks[t].paths);
+
+        if (t > 0 && index_merge(idx, tasks[t].partial) != 0) {
+            PANIC("\nindex_merge failed!\n");
+        }
+    }
+
+    free(tasks);
+    return idx;
+}
+
 /**
  * @param fpaths: list of 1..n paths
  * @returns the created index if succesful, otherwise NULL
@@ -389,51 +811,130 @@ static list_t *read_file_terms(char *fpath) {
 static index_t *build_index(list_t *fpaths) {
     pr_debug("Building index\n");
 
-    index_t *idx = index_create();
-    if (idx == NULL) {
-        pr_error("Failed to create index\n");
-        return NULL;
-    }
-
     const size_t files_total = list_length(fpaths);
-    size_t i = 0;
+    index_t *idx = NULL;
 
-    while (list_length(fpaths)) {
-        i++;
-        if (PRINT_PROGRESS_INTERVAL && (i % PRINT_PROGRESS_INTERVAL == 0 || i == 1 || i == files_total)) {
-            printf("\rProcessing document # %zu / %zu", i, files_total);
-            fflush(stdout);
-        }
+    if (n_build_threads > 1 || n_shards > 1) {
+        pr_debug("Building with %zu threads and %zu shards\n", n_build_threads, n_shards);
+        idx = build_index_parallel(fpaths, n_build_threads, n_shards);
+    } else {
+        idx = index_create_with_config(&index_config);
+        if (idx) {
+            size_t i = 0, n_bytes = 0;
 
-        char *path = list_popfirst(fpaths);
-        assert(path);
+            list_iter_t *iter = list_createiter(fpaths);
+            while (iter && list_hasnext(iter)) {
+                n_bytes += file_bytes(list_next(iter));
+            }
+            list_destroyiter(iter);
+            reserve_index(idx, files_total, n_bytes);
 
-        list_t *terms = read_file_terms(path);
+            while (list_length(fpaths)) {
+                print_progress(++i, files_total);
 
-        if (terms == NULL) {
-            pr_error("\nFailed to process document.. Ignoring this path and continuing.");
-            free(path);
-        } else {
-            /**
-             * Process document with the index.
-             * index owns 'path' and 'terms' from this point, regardless of status
-             */
-            int status = index_document(idx, path, terms);
-
-            if (status != 0) {
-                PANIC("\nindex_document failed!\n");
+                char *path = list_popfirst(fpaths);
+                assert(path);
+
+                index_file(idx, path);
             }
         }
     }
 
+    if (idx == NULL) {
+        pr_error("Failed to create index\n");
+        return NULL;
+    }
+
     /* send a newline as the progress print uses carriage return printing */
     if (PRINT_PROGRESS_INTERVAL) {
         printf("\n");
     }
 
+    /* no more documents are added, so the index is compacted into its read-only layout before the first query */
+    pr_debug("Freezing index\n");
+    if (index_freeze(idx) != 0) {
+        pr_warn("Failed to freeze index, querying it as it is\n");
+    }
+
+    return idx;
+}
+
+/**
+ * @param path: path of a file written by `save_index`
+ * @returns the loaded index if succesful, otherwise NULL
+ */
+static index_t *load_index(const char *path) {
+    pr_debug("Loading index from \"%s\"\n", path);
+
+    struct timeval t_start, t_end;
+    gettimeofday(&t_start, NULL);
+    index_t *idx = index_load(path, &index_config);
+    gettimeofday(&t_end, NULL);
+
+    long double t_secs = (long double) (t_end.tv_sec - t_start.tv_sec);
+    t_secs += (long double) (t_end.tv_usec - t_start.tv_usec) / 1000000.0;
+
+    if (idx == NULL) {
+        pr_error("Failed to load index\n");
+        return NULL;
+    }
+    pr_info("Loaded index from \"%s\" in %.3Lf seconds\n", path, t_secs);
     return idx;
 }
 
+/* save the index so later runs can load it with --load-index. Failing to save is not fatal. */
+static void save_index(index_t *idx, const char *path) {
+    pr_debug("Saving index to \"%s\"\n", path);
+
+    struct timeval t_start, t_end;
+    gettimeofday(&t_start, NULL);
+    int status = index_save(idx, path);
+    gettimeofday(&t_end, NULL);
+
+    long double t_secs = (long double) (t_end.tv_sec - t_start.tv_sec);
+    t_secs += (long double) (t_end.tv_usec - t_start.tv_usec) / 1000000.0;
+
+    if (status != 0) {
+        pr_warn("Failed to save index to \"%s\"\n", path);
+    } else {
+        pr_info("Saved index to \"%s\" in %.3Lf seconds\n", path, t_secs);
+    }
+}
+
+/* load the manifest at `path` to rebuild from, or start a new one if there is none */
+static manifest_t *open_manifest(const char *path) {
+    if (access(path, F_OK) != 0) {
+        pr_info("No manifest at \"%s\", indexing all files\n", path);
+        return manifest_create();
+    }
+
+    manifest_t *manifest = manifest_load(path);
+    if (manifest == NULL) {
+        pr_warn("Ignoring the manifest at \"%s\", indexing all files\n", path);
+        return manifest_create();
+    }
+    pr_debug("Loaded manifest of %zu files from \"%s\"\n", manifest_length(manifest), path);
+    return manifest;
+}
+
+/* drop the files that were not found from the manifest, and save it for the next build. Failing to save is not fatal. */
+static void close_manifest(manifest_t *manifest, const char *path) {
+    manifest_prune(manifest);
+
+    manifest_stats_t stats;
+    manifest_stats(manifest, &stats);
+    pr_info("Manifest: %zu unchanged, %zu touched, %zu modified, %zu added and %zu removed files\n", stats.unchanged,
+            stats.touched, stats.modified, stats.added, stats.removed);
+
+    /* a manifest of files that have not changed at all is left as it is */
+    if (stats.touched + stats.modified + stats.added + stats.removed == 0) {
+        pr_debug("No files have changed, so the manifest is not saved\n");
+    } else if (manifest_save(manifest, path) != 0) {
+        pr_warn("Failed to save manifest to \"%s\"\n", path);
+    }
+    manifest_destroy(manifest);
+}
+
 /* helper for process_args */
 static int insert_valid_ext(char *arg, set_t *valid_exts) {
     if (!is_ascii_alpha_string(arg)) {
@@ -503,7 +1004,9 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
     set_t *valid_exts = NULL;                       // temporary set of file extensions to include
     set_t *completed = set_create((cmp_fn) strcmp); // arguments that are already parsed
 
-    if (!completed) {
+    /* at most every other argument is a flag */
+    if (!completed || set_reserve(completed, (size_t) argc / 2) != 0) {
+        set_destroy(completed, NULL);
         return -1; // failed to create set
     }
 
@@ -535,6 +1038,36 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
                 parsing = type_arg;
             } else if (!strcmp(arg, limit_arg)) {
                 parsing = limit_arg;
+            } else if (!strcmp(arg, threads_arg)) {
+                parsing = threads_arg;
+            } else if (!strcmp(arg, codec_arg)) {
+                parsing = codec_arg;
+            } else if (!strcmp(arg, engine_arg)) {
+                parsing = engine_arg;
+            } else if (!strcmp(arg, top_arg)) {
+                parsing = top_arg;
+            } else if (!strcmp(arg, bm25_arg)) {
+                parsing = bm25_arg;
+            } else if (!strcmp(arg, pruning_arg)) {
+                parsing = pruning_arg;
+            } else if (!strcmp(arg, cache_arg)) {
+                parsing = cache_arg;
+            } else if (!strcmp(arg, subquery_cache_arg)) {
+                parsing = subquery_cache_arg;
+            } else if (!strcmp(arg, program_cache_arg)) {
+                parsing = program_cache_arg;
+            } else if (!strcmp(arg, batch_arg)) {
+                parsing = batch_arg;
+            } else if (!strcmp(arg, shards_arg)) {
+                parsing = shards_arg;
+            } else if (!strcmp(arg, save_index_arg)) {
+                parsing = save_index_arg;
+            } else if (!strcmp(arg, load_index_arg)) {
+                parsing = load_index_arg;
+            } else if (!strcmp(arg, verify_index_arg)) {
+                parsing = verify_index_arg;
+            } else if (!strcmp(arg, manifest_arg)) {
+                parsing = manifest_arg;
             } else {
                 pr_error("Unrecognized argument: \"%s\"\n", arg);
                 goto end;
@@ -580,6 +1113,97 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
                 goto end;
             }
             max_n_files = strtoul(arg, NULL, 10);
+        } else if (parsing == threads_arg) {
+            if (!is_digit_string(arg) || strtoul(arg, NULL, 10) == 0) {
+                pr_error("Expected positive integer value following %s, found \"%s\"\n", threads_arg, arg);
+                goto end;
+            }
+            n_build_threads = strtoul(arg, NULL, 10);
+        } else if (parsing == batch_arg) {
+            if (!is_digit_string(arg) || strtoul(arg, NULL, 10) == 0) {
+                pr_error("Expected positive integer value following %s, found \"%s\"\n", batch_arg, arg);
+                goto end;
+            }
+            n_batch_threads = strtoul(arg, NULL, 10);
+        } else if (parsing == shards_arg) {
+            if (!is_digit_string(arg) || strtoul(arg, NULL, 10) == 0) {
+                pr_error("Expected positive integer value following %s, found \"%s\"\n", shards_arg, arg);
+                goto end;
+            }
+            n_shards = strtoul(arg, NULL, 10);
+        } else if (parsing == save_index_arg) {
+            save_index_path = arg;
+        } else if (parsing == load_index_arg) {
+            load_index_path = arg;
+        } else if (parsing == manifest_arg) {
+            manifest_path = arg;
+        } else if (parsing == codec_arg) {
+            if (codec_from_name(arg, &index_config.codec) != 0) {
+                pr_error("Unrecognized codec following %s: \"%s\"\n", codec_arg, arg);
+                goto end;
+            }
+        } else if (parsing == top_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", top_arg, arg);
+                goto end;
+            }
+            n_top_results = strtoul(arg, NULL, 10);
+        } else if (parsing == engine_arg) {
+            if (!strcmp(arg, "iterators")) {
+                index_config.engine = INDEX_ENGINE_ITERATORS;
+            } else if (!strcmp(arg, "sets")) {
+                index_config.engine = INDEX_ENGINE_SETS;
+            } else {
+                pr_error("Unrecognized engine following %s: \"%s\"\n", engine_arg, arg);
+                goto end;
+            }
+        } else if (parsing == bm25_arg) {
+            double k1, b;
+            char trailing;
+            if (sscanf(arg, "%lf,%lf%c", &k1, &b, &trailing) != 2 || k1 < 0.0 || b < 0.0 || b > 1.0) {
+                pr_error("Expected k1,b with k1 >= 0 and 0 <= b <= 1 following %s, found \"%s\"\n", bm25_arg, arg);
+                goto end;
+            }
+            index_config.bm25_k1 = k1;
+            index_config.bm25_b = b;
+        } else if (parsing == pruning_arg) {
+            if (!strcmp(arg, "none")) {
+                index_config.pruning = INDEX_PRUNING_NONE;
+            } else if (!strcmp(arg, "wand")) {
+                index_config.pruning = INDEX_PRUNING_WAND;
+            } else if (!strcmp(arg, "block-max")) {
+                index_config.pruning = INDEX_PRUNING_BLOCK_MAX;
+            } else {
+                pr_error("Unrecognized pruning following %s: \"%s\"\n", pruning_arg, arg);
+                goto end;
+            }
+        } else if (parsing == verify_index_arg) {
+            if (!strcmp(arg, "none")) {
+                index_config.verify = INDEX_VERIFY_NONE;
+            } else if (!strcmp(arg, "full")) {
+                index_config.verify = INDEX_VERIFY_FULL;
+            } else {
+                pr_error("Unrecognized verification following %s: \"%s\"\n", verify_index_arg, arg);
+                goto end;
+            }
+        } else if (parsing == cache_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", cache_arg, arg);
+                goto end;
+            }
+            index_config.cache_bytes = strtoul(arg, NULL, 10);
+        } else if (parsing == subquery_cache_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", subquery_cache_arg, arg);
+                goto end;
+            }
+            index_config.subquery_cache_bytes = strtoul(arg, NULL, 10);
+        } else if (parsing == program_cache_arg) {
+            if (!is_digit_string(arg)) {
+                pr_error("Expected integer value following %s, found \"%s\"\n", program_cache_arg, arg);
+                goto end;
+            }
+            index_config.program_cache_bytes = strtoul(arg, NULL, 10);
         } else {
             pr_error("Unrecognized or misplaced argument: \"%s\"\n", arg);
             goto end;
@@ -595,6 +1219,12 @@ static int process_args(int argc, char **argv, list_t *fpaths) {
         goto end;
     }
 
+    /* a loaded index already holds its documents, so the data files are not needed */
+    if (load_index_path) {
+        status = 0;
+        goto end;
+    }
+
     /* find the files at dir_path */
     if (find_files(dir_path, fpaths, valid_exts, max_n_files) < 0) {
         pr_error("<data-dir>: Failed to find files at \"%s\"\n", dir_path);
@@ -708,10 +1338,28 @@ int main(int argc, char **argv) {
     /* create a list to populate with paths */
     list_t *fpaths = list_create((cmp_fn) strcmp);
 
+    index_config_default(&index_config);
     int arg_status = process_args(argc, argv, fpaths);
 
     if (fpaths != NULL && arg_status == 0) {
-        idx = build_index(fpaths);
+        if (load_index_path) {
+            idx = load_index(load_index_path);
+        } else {
+            build_manifest = manifest_path ? open_manifest(manifest_path) : NULL;
+            idx = build_index(fpaths);
+
+            /* the manifest is only saved along with a complete index */
+            if (build_manifest && idx) {
+                close_manifest(build_manifest, manifest_path);
+            } else {
+                manifest_destroy(build_manifest);
+            }
+            build_manifest = NULL;
+        }
+
+        if (idx && save_index_path) {
+            save_index(idx, save_index_path);
+        }
 
         /* hand over control to the interpreter */
         if (idx && run_interpreter(idx, piped_input) == 0) {
@@ -723,11 +1371,11 @@ int main(int argc, char **argv) {
     if (idx) {
         pr_debug("Destroying index\n");
         index_destroy(idx);
-    } else {
-        /* if there is an index, this list will have been destroyed by it */
-        list_destroy(fpaths, free);
     }
 
+    /* if there is an index, the paths are owned by it and this list is empty */
+    list_destroy(fpaths, free);
+
     list_destroy(piped_input, free); // empty list if interpreting went ok
     logger_destroy(result_logger);
 
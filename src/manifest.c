@@ -0,0 +1,622 @@
+/**
+ * @implements manifest.h
+ *
+ * @brief The documents are kept in a map by path, and their terms are interned in a second map, so that each
+ * distinct term is stored once however many documents contain it. The id a term is saved with is kept in front of
+ * its string, so documents can be saved without looking up their terms. Both maps are guarded by a single mutex, which is
+ * only held to look up and insert documents. Files are read, hashed and tokenized outside of it.
+ *
+ * A saved manifest starts with a header holding a format version and a checksum of the rest of the file. The
+ * documents follow, each as a record, its path, and a (term id, count) pair per term. The terms come last, as
+ * null-terminated strings in the order of their ids.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "printing.h"
+#include "common.h"
+#include "map.h"
+#include "manifest.h"
+
+/* the version is increased whenever the format changes, as older files can then no longer be read */
+#define MANIFEST_MAGIC "MANIFEST"
+#define MANIFEST_VERSION 1
+
+/* a different number on a machine with another byte order, where the file cannot be used */
+#define MANIFEST_BYTE_ORDER 0x01020304u
+
+/* every part of the file is padded to a multiple of 8 bytes, so that the records stay aligned */
+#define PAD8(n) (((n) + 7) & ~(size_t) 7)
+
+typedef struct manifest_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t checksum; // hash_bytes_wyhash64 of everything after this field
+    uint64_t file_size;
+    uint64_t n_docs;
+    uint64_t n_terms;
+    uint64_t terms_offset; // the documents lie between the header and the terms
+    uint64_t terms_bytes;
+} manifest_header_t;
+
+/* followed by the path and its null byte, padded to 8 bytes, and then n_terms term_count_t */
+typedef struct doc_record {
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+    uint32_t path_len; // not counting the null byte
+    uint32_t n_terms;
+} doc_record_t;
+
+typedef struct term_count {
+    uint32_t term_id;
+    uint32_t count;
+} term_count_t;
+
+/* an interned term. Documents point to `term`, so that its id is found without a lookup while saving. */
+typedef struct interned_term {
+    uint32_t id; // the id + 1 once the term has been given one while saving, otherwise 0
+    char term[];
+} interned_term_t;
+
+#define TERM_HEADER(str) ((interned_term_t *) ((char *) (str) - offsetof(interned_term_t, term)))
+
+struct manifest {
+    map_t *docs;  // path -> manifest_doc_t
+    map_t *terms; // the `term` of each interned_term_t
+    manifest_stats_t stats;
+    pthread_mutex_t lock;
+};
+
+/* store the number `n` directly in the value pointer of an entry, and retrieve it */
+#define ID_TO_VAL(n) ((void *) (uintptr_t) ((n) + 1))
+#define VAL_TO_ID(v) ((uint32_t) ((uintptr_t) (v) - 1))
+
+manifest_t *manifest_create(void) {
+    manifest_t *manifest = calloc(1, sizeof(manifest_t));
+    if (manifest == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    manifest->docs = map_create((cmp_fn) strcmp, (hash64_fn) hash_string_wyhash64);
+    manifest->terms = map_create((cmp_fn) strcmp, (hash64_fn) hash_string_wyhash64);
+    if (manifest->docs == NULL || manifest->terms == NULL) {
+        pr_error("Failed to create manifest\n");
+        map_destroy(manifest->docs, NULL, NULL);
+        map_destroy(manifest->terms, NULL, NULL);
+        free(manifest);
+        return NULL;
+    }
+    pthread_mutex_init(&manifest->lock, NULL);
+
+    return manifest;
+}
+
+static void term_destroy(char *term) {
+    free(TERM_HEADER(term));
+}
+
+static void doc_destroy(manifest_doc_t *doc) {
+    free(doc->path);
+    free(doc->terms);
+    free(doc->counts);
+    free(doc);
+}
+
+void manifest_destroy(manifest_t *manifest) {
+    if (manifest == NULL) {
+        return;
+    }
+    /* the paths are the keys of the documents, and freed along with them */
+    map_destroy(manifest->docs, NULL, (free_fn) doc_destroy);
+    map_destroy(manifest->terms, (free_fn) term_destroy, NULL);
+    pthread_mutex_destroy(&manifest->lock);
+    free(manifest);
+}
+
+size_t manifest_length(manifest_t *manifest) {
+    return map_length(manifest->docs);
+}
+
+void manifest_stats(manifest_t *manifest, manifest_stats_t *stats) {
+    pthread_mutex_lock(&manifest->lock);
+    *stats = manifest->stats;
+    pthread_mutex_unlock(&manifest->lock);
+}
+
+/**
+ * @brief Intern a term. Must be called with the lock held.
+ * @param term: copied by the manifest if it is not already interned
+ * @returns the interned term, or NULL on failure
+ */
+static const char *intern_term(manifest_t *manifest, const char *term) {
+    uint64_t hash = hash_string_wyhash64(term);
+    entry_t *entry = map_get_hashed(manifest->terms, (void *) term, hash);
+    if (entry) {
+        return entry->key;
+    }
+
+    size_t len = strlen(term);
+    interned_term_t *interned = malloc(sizeof(interned_term_t) + len + 1);
+    if (interned == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+    interned->id = 0;
+    memcpy(interned->term, term, len + 1);
+    map_insert_hashed(manifest->terms, interned->term, NULL, hash);
+
+    return interned->term;
+}
+
+/* read the entire file at `path`, and store its size in `size` */
+static char *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        pr_error("Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    long file_size = fsize(f);
+    char *content = (file_size >= 0) ? malloc((size_t) file_size + 1) : NULL;
+    if (content == NULL) {
+        fclose(f);
+        return NULL;
+    }
+
+    *size = fread(content, 1, (size_t) file_size, f);
+    if (ferror(f)) {
+        pr_error("Failed to read %s\n", path);
+        free(content);
+        content = NULL;
+    }
+    fclose(f);
+
+    return content;
+}
+
+/**
+ * @brief Tokenize the contents of a file, and count the occurrences of each distinct term
+ * @returns 0 on success, otherwise -1. On success, `terms` and `counts` hold `n_terms` terms and their counts,
+ * and the terms are owned by the caller.
+ */
+static int count_terms(char *content, size_t size, manifest_tokenize_fn tokenize, char ***terms, uint32_t **counts,
+                       uint32_t *n_terms) {
+    list_t *tokens = list_create((cmp_fn) strcmp);
+    if (tokens == NULL) {
+        return -1;
+    }
+
+    /* the contents are tokenized exactly as the file would be, through a stream over the buffer */
+    if (size > 0) {
+        FILE *f = fmemopen(content, size, "r");
+        int status = (f != NULL) ? tokenize(f, tokens) : -1;
+
+        if (f != NULL) {
+            fclose(f);
+        }
+        if (status != 0) {
+            list_destroy(tokens, free);
+            return -1;
+        }
+    }
+
+    size_t n_tokens = list_length(tokens);
+    map_t *seen = map_create_with_capacity((cmp_fn) strcmp, (hash64_fn) hash_string_wyhash64, n_tokens);
+    *terms = malloc((n_tokens + 1) * sizeof(char *));
+    *counts = malloc((n_tokens + 1) * sizeof(uint32_t));
+    if (seen == NULL || *terms == NULL || *counts == NULL) {
+        pr_error("Failed to allocate memory\n");
+        map_destroy(seen, NULL, NULL);
+        free(*terms);
+        free(*counts);
+        list_destroy(tokens, free);
+        return -1;
+    }
+
+    *n_terms = 0;
+    while (list_length(tokens)) {
+        char *token = list_popfirst(tokens);
+        int inserted;
+        entry_t *entry = map_upsert(seen, token, &inserted);
+
+        if (inserted) {
+            entry->val = ID_TO_VAL(*n_terms);
+            (*terms)[*n_terms] = token;
+            (*counts)[*n_terms] = 1;
+            (*n_terms)++;
+        } else {
+            (*counts)[VAL_TO_ID(entry->val)]++;
+            free(token);
+        }
+    }
+    map_destroy(seen, NULL, NULL);
+    list_destroy(tokens, NULL);
+
+    return 0;
+}
+
+const manifest_doc_t *manifest_update(manifest_t *manifest, const char *path, manifest_tokenize_fn tokenize) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        pr_error("Failed to stat %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    int64_t mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    /* the document of a path is only updated by the one call for it, so it can be used without the lock */
+    pthread_mutex_lock(&manifest->lock);
+    entry_t *entry = map_get(manifest->docs, (void *) path);
+    manifest_doc_t *doc = entry ? entry->val : NULL;
+
+    if (doc && doc->size == (uint64_t) st.st_size && doc->mtime_ns == mtime_ns) {
+        if (!doc->seen) {
+            doc->seen = 1;
+            manifest->stats.unchanged++;
+        }
+        pthread_mutex_unlock(&manifest->lock);
+        return doc;
+    }
+    pthread_mutex_unlock(&manifest->lock);
+
+    size_t size;
+    char *content = read_file(path, &size);
+    if (content == NULL) {
+        return NULL;
+    }
+    uint64_t hash = hash_bytes_wyhash64(content, size);
+
+    if (doc && doc->size == size && doc->hash == hash) {
+        free(content);
+        pthread_mutex_lock(&manifest->lock);
+        doc->mtime_ns = mtime_ns;
+        doc->seen = 1;
+        manifest->stats.touched++;
+        pthread_mutex_unlock(&manifest->lock);
+        return doc;
+    }
+
+    char **terms;
+    uint32_t *counts, n_terms;
+    int status = count_terms(content, size, tokenize, &terms, &counts, &n_terms);
+    free(content);
+    if (status != 0) {
+        pr_error("Failed to tokenize %s\n", path);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&manifest->lock);
+
+    /* the terms are replaced by their interned copies in place */
+    for (uint32_t i = 0; i < n_terms; i++) {
+        const char *interned = (status == 0) ? intern_term(manifest, terms[i]) : NULL;
+        status = (interned != NULL) ? 0 : -1;
+        free(terms[i]);
+        terms[i] = (char *) interned;
+    }
+
+    if (status == 0 && doc == NULL) {
+        doc = calloc(1, sizeof(manifest_doc_t));
+        char *path_copy = strdup(path);
+
+        if (doc == NULL || path_copy == NULL) {
+            pr_error("Failed to allocate memory\n");
+            free(doc);
+            free(path_copy);
+            doc = NULL;
+            status = -1;
+        } else {
+            doc->path = path_copy;
+            map_insert(manifest->docs, path_copy, doc);
+            manifest->stats.added++;
+        }
+    } else if (status == 0) {
+        free(doc->terms);
+        free(doc->counts);
+        manifest->stats.modified++;
+    }
+
+    if (status != 0) {
+        pthread_mutex_unlock(&manifest->lock);
+        free(terms);
+        free(counts);
+        return NULL;
+    }
+
+    doc->size = size;
+    doc->mtime_ns = mtime_ns;
+    doc->hash = hash;
+    doc->n_terms = n_terms;
+    doc->terms = (const char **) terms;
+    doc->counts = counts;
+    doc->seen = 1;
+    pthread_mutex_unlock(&manifest->lock);
+
+    return doc;
+}
+
+size_t manifest_prune(manifest_t *manifest) {
+    pthread_mutex_lock(&manifest->lock);
+
+    /* entries cannot be removed while iterating, so the documents to remove are collected first */
+    size_t n_removed = 0;
+    manifest_doc_t **removed = malloc((map_length(manifest->docs) + 1) * sizeof(manifest_doc_t *));
+    map_iter_t *iter = removed ? map_createiter(manifest->docs) : NULL;
+
+    while (iter && map_hasnext(iter)) {
+        manifest_doc_t *doc = map_next(iter)->val;
+        if (!doc->seen) {
+            removed[n_removed++] = doc;
+        }
+    }
+    map_destroyiter(iter);
+
+    for (size_t i = 0; i < n_removed; i++) {
+        free(map_remove(manifest->docs, removed[i]->path));
+        doc_destroy(removed[i]);
+    }
+    free(removed);
+
+    manifest->stats.removed += n_removed;
+    pthread_mutex_unlock(&manifest->lock);
+
+    return n_removed;
+}
+
+/* pad a part of `size` bytes that has been written to a multiple of 8 bytes */
+static int write_padding(FILE *f, size_t size) {
+    static const uint8_t zeros[8] = {0};
+    size_t padding = PAD8(size) - size;
+    return (fwrite(zeros, 1, padding, f) == padding) ? 0 : -1;
+}
+
+/**
+ * @brief Write the documents, and then the terms they contain. Each term is given an id the first time a document
+ * containing it is written, so terms that are no longer in any document are left out. Must be called with the lock
+ * held.
+ */
+static int write_contents(manifest_t *manifest, FILE *f, manifest_header_t *header) {
+    size_t n_terms = 0;
+    const char **order = malloc((map_length(manifest->terms) + 1) * sizeof(char *));
+    term_count_t *pairs = NULL;
+    size_t pairs_capacity = 0;
+    int status = (order != NULL) ? 0 : -1;
+
+    map_iter_t *iter = (status == 0) ? map_createiter(manifest->terms) : NULL;
+    while (iter && map_hasnext(iter)) {
+        TERM_HEADER(map_next(iter)->key)->id = 0;
+    }
+    map_destroyiter(iter);
+
+    iter = (status == 0) ? map_createiter(manifest->docs) : NULL;
+    while (iter && status == 0 && map_hasnext(iter)) {
+        manifest_doc_t *doc = map_next(iter)->val;
+
+        if (doc->n_terms > pairs_capacity) {
+            free(pairs);
+            pairs_capacity = doc->n_terms;
+            pairs = malloc(pairs_capacity * sizeof(term_count_t));
+            if (pairs == NULL) {
+                status = -1;
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < doc->n_terms; i++) {
+            interned_term_t *term = TERM_HEADER(doc->terms[i]);
+            if (term->id == 0) {
+                order[n_terms++] = doc->terms[i];
+                term->id = (uint32_t) n_terms;
+            }
+            pairs[i] = (term_count_t) {term->id - 1, doc->counts[i]};
+        }
+
+        doc_record_t record = {doc->size, doc->mtime_ns, doc->hash, (uint32_t) strlen(doc->path), doc->n_terms};
+        if (fwrite(&record, sizeof(record), 1, f) != 1 || fwrite(doc->path, 1, record.path_len + 1, f) != record.path_len + 1 ||
+            write_padding(f, record.path_len + 1) != 0 ||
+            (doc->n_terms > 0 && fwrite(pairs, sizeof(term_count_t), doc->n_terms, f) != doc->n_terms)) {
+            status = -1;
+        }
+    }
+    map_destroyiter(iter);
+    free(pairs);
+
+    header->n_terms = n_terms;
+    header->terms_offset = (status == 0) ? (uint64_t) ftell(f) : 0;
+    header->terms_bytes = 0;
+    for (size_t i = 0; status == 0 && i < n_terms; i++) {
+        size_t len = strlen(order[i]) + 1;
+        status = (fwrite(order[i], 1, len, f) == len) ? 0 : -1;
+        header->terms_bytes += len;
+    }
+    if (status == 0) {
+        status = write_padding(f, header->terms_bytes);
+    }
+    free(order);
+
+    return status;
+}
+
+int manifest_save(manifest_t *manifest, const char *path) {
+    size_t tmp_len = strlen(path) + sizeof(".tmp");
+    char *tmp_path = malloc(tmp_len);
+    if (tmp_path == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return -1;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = MANIFEST_VERSION;
+    header.byte_order = MANIFEST_BYTE_ORDER;
+
+    pthread_mutex_lock(&manifest->lock);
+    header.n_docs = map_length(manifest->docs);
+
+    /* the header is written again once the number of terms and the size of the file are known */
+    FILE *f = fopen(tmp_path, "wb");
+    int status = (f != NULL && fwrite(&header, sizeof(header), 1, f) == 1) ? 0 : -1;
+    status = (status == 0) ? write_contents(manifest, f, &header) : -1;
+    pthread_mutex_unlock(&manifest->lock);
+
+    if (status == 0) {
+        header.file_size = (uint64_t) ftell(f);
+        status = (fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1) ? 0 : -1;
+    }
+    if (f != NULL && fclose(f) != 0) {
+        status = -1;
+    }
+    if (status == 0 && (file_write_checksum(tmp_path, offsetof(manifest_header_t, checksum)) != 0 ||
+                        rename(tmp_path, path) != 0)) {
+        status = -1;
+    }
+    if (status != 0) {
+        pr_error("Failed to write manifest to \"%s\": %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    return status;
+}
+
+/**
+ * @brief Read the documents of a loaded file into the manifest, with bounds checks on every record
+ * @param terms: the interned terms, by id
+ * @returns 0 on success, otherwise -1
+ */
+static int read_docs(manifest_t *manifest, const char *content, const manifest_header_t *header,
+                     const char **terms) {
+    size_t pos = sizeof(manifest_header_t);
+    const size_t end = header->terms_offset;
+
+    for (size_t d = 0; d < header->n_docs; d++) {
+        if (end - pos < sizeof(doc_record_t)) {
+            return -1;
+        }
+        const doc_record_t *record = (const doc_record_t *) (content + pos);
+        pos += sizeof(doc_record_t);
+
+        const char *path = content + pos;
+        if (record->path_len == 0 || end - pos < PAD8((size_t) record->path_len + 1) ||
+            path[record->path_len] != '\0' || strlen(path) != record->path_len) {
+            return -1;
+        }
+        pos += PAD8((size_t) record->path_len + 1);
+
+        const term_count_t *pairs = (const term_count_t *) (content + pos);
+        if ((end - pos) / sizeof(term_count_t) < record->n_terms) {
+            return -1;
+        }
+        pos += record->n_terms * sizeof(term_count_t);
+
+        manifest_doc_t *doc = calloc(1, sizeof(manifest_doc_t));
+        if (doc == NULL) {
+            return -1;
+        }
+        doc->path = strdup(path);
+        doc->terms = malloc((record->n_terms + 1) * sizeof(char *));
+        doc->counts = malloc((record->n_terms + 1) * sizeof(uint32_t));
+        if (doc->path == NULL || doc->terms == NULL || doc->counts == NULL) {
+            doc_destroy(doc);
+            return -1;
+        }
+
+        doc->size = record->size;
+        doc->mtime_ns = record->mtime_ns;
+        doc->hash = record->hash;
+        doc->n_terms = record->n_terms;
+        for (uint32_t i = 0; i < record->n_terms; i++) {
+            if (pairs[i].term_id >= header->n_terms || pairs[i].count == 0) {
+                doc_destroy(doc);
+                return -1;
+            }
+            doc->terms[i] = terms[pairs[i].term_id];
+            doc->counts[i] = pairs[i].count;
+        }
+
+        /* each path must only be listed once */
+        int inserted;
+        entry_t *entry = map_upsert(manifest->docs, doc->path, &inserted);
+        if (entry == NULL || !inserted) {
+            doc_destroy(doc);
+            return -1;
+        }
+        entry->val = doc;
+    }
+
+    return (pos == end) ? 0 : -1;
+}
+
+/**
+ * @brief Intern the terms of a loaded file, and store them by id in `terms`
+ * @returns 0 on success, otherwise -1
+ */
+static int read_terms(manifest_t *manifest, const char *content, const manifest_header_t *header,
+                      const char **terms) {
+    const char *p = content + header->terms_offset;
+    const char *end = p + header->terms_bytes;
+
+    for (size_t i = 0; i < header->n_terms; i++) {
+        const char *nul = (p < end) ? memchr(p, '\0', (size_t) (end - p)) : NULL;
+        if (nul == NULL || (terms[i] = intern_term(manifest, p)) == NULL) {
+            return -1;
+        }
+        p = nul + 1;
+    }
+
+    return (p == end) ? 0 : -1;
+}
+
+manifest_t *manifest_load(const char *path) {
+    size_t size;
+    char *content = read_file(path, &size);
+    if (content == NULL) {
+        return NULL;
+    }
+
+    const manifest_header_t *header = (const manifest_header_t *) content;
+    const size_t checksum_start = offsetof(manifest_header_t, checksum) + sizeof(uint64_t);
+    const char *problem = NULL;
+
+    if (size < sizeof(manifest_header_t) || memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0) {
+        problem = "not a manifest";
+    } else if (header->version != MANIFEST_VERSION) {
+        problem = "unsupported version";
+    } else if (header->byte_order != MANIFEST_BYTE_ORDER) {
+        problem = "written on a machine with a different byte order";
+    } else if (header->file_size != size || header->terms_offset < sizeof(manifest_header_t) ||
+               header->terms_offset > size || header->terms_bytes > size - header->terms_offset ||
+               PAD8(header->terms_bytes) != size - header->terms_offset ||
+               header->n_terms > header->terms_bytes || header->n_docs > size) {
+        problem = "truncated or invalid";
+    } else if (hash_bytes_wyhash64(content + checksum_start, size - checksum_start) != header->checksum) {
+        problem = "checksum mismatch";
+    }
+    if (problem) {
+        pr_error("Failed to load manifest from \"%s\": %s\n", path, problem);
+        free(content);
+        return NULL;
+    }
+
+    manifest_t *manifest = manifest_create();
+    const char **terms = malloc((header->n_terms + 1) * sizeof(char *));
+    if (manifest == NULL || terms == NULL || read_terms(manifest, content, header, terms) != 0 ||
+        read_docs(manifest, content, header, terms) != 0) {
+        pr_error("Failed to load manifest from \"%s\": invalid contents\n", path);
+        manifest_destroy(manifest);
+        manifest = NULL;
+    }
+
+    free(terms);
+    free(content);
+    return manifest;
+}
@@ -0,0 +1,759 @@
+/**
+ * @implements postings.h
+ *
+ * @brief Posting lists as a sequence of compressed blocks plus an uncompressed tail. Block headers and
+ * compressed data live in two arrays that are doubled in size when full.
+ *
+ * Ids are stored as `id - previous_id - 1` and counts as `count - 1`, so both streams are as small as
+ * possible. The previous id of the first block is `doc_base - 1`, which is what makes offsetting a list cheap.
+ *
+ * A pack holds frozen lists whose block headers and data point into two arrays shared by all the lists of the
+ * pack. Block offsets are relative to the data of their own list, so lists are packed by copying them as is.
+ * A pack is written to a file as a header, a record per list, the block headers and the data, and can be used
+ * in place from a memory mapping of the file. Only the lists themselves are then allocated, and the blocks are only
+ * read when they are decoded, unless the pack is checked with `postings_pack_verify`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "codec.h"
+#include "docset.h"
+#include "postings.h"
+
+typedef struct block {
+    uint32_t last_doc_id;
+    uint32_t offset; // byte offset of the block in `data`
+    uint32_t length; // number of documents in the block
+} block_t;
+
+struct postings {
+    block_t *blocks;
+    uint8_t *data;
+    uint32_t *tail_doc_ids;
+    uint32_t *tail_counts;
+    uint32_t length;
+    uint32_t n_blocks;
+    uint32_t blocks_capacity;
+    uint32_t data_len;
+    uint32_t data_capacity;
+    uint32_t tail_len;
+    uint32_t tail_capacity;
+    uint32_t doc_base;
+    codec_t codec;
+};
+
+struct postings_pack {
+    postings_t *lists;
+    block_t *blocks;
+    uint8_t *data;
+    size_t n_lists;
+    size_t n_blocks;
+    size_t data_len;
+    int borrowed; // blocks and data are owned by the caller of postings_pack_load
+};
+
+/* a pack in a file starts with this header */
+typedef struct pack_header {
+    uint64_t n_lists;
+    uint64_t n_blocks;
+    uint64_t data_len;
+} pack_header_t;
+
+/* ... followed by one of these per list */
+typedef struct packed_list {
+    uint64_t block_start; // index of the first block header of the list
+    uint64_t data_start;  // byte offset of the data of the list
+    uint32_t length;
+    uint32_t n_blocks;
+    uint32_t data_len;
+    uint32_t doc_base;
+} packed_list_t;
+
+/* sections of a pack in a file are padded to a multiple of 8 bytes, so that all of them are aligned */
+#define PAD8(n) (((n) + 7) & ~(size_t) 7)
+
+postings_t *postings_create(codec_t codec) {
+    postings_t *postings = calloc(1, sizeof(postings_t));
+    if (postings == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    /* most terms occur in very few documents, so all arrays are allocated on demand */
+    postings->codec = codec;
+
+    return postings;
+}
+
+static void free_tail(postings_t *postings) {
+    free(postings->tail_doc_ids);
+    free(postings->tail_counts);
+    postings->tail_doc_ids = NULL;
+    postings->tail_counts = NULL;
+    postings->tail_capacity = 0;
+}
+
+void postings_destroy(postings_t *postings) {
+    if (!postings) {
+        return;
+    }
+    free(postings->blocks);
+    free(postings->data);
+    free_tail(postings);
+    free(postings);
+}
+
+size_t postings_length(postings_t *postings) {
+    return postings->length;
+}
+
+/* grow an array to hold at least `required` elements, doubling its capacity */
+static int grow_array(void **array, uint32_t *capacity, size_t required, size_t elem_size) {
+    if (required <= *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity ? *capacity : 1;
+    while (new_capacity < required) {
+        new_capacity *= 2;
+    }
+    if (new_capacity > UINT32_MAX) {
+        pr_error("Posting list is too large\n");
+        return -1;
+    }
+
+    void *new_array = realloc(*array, new_capacity * elem_size);
+    if (new_array == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return -1;
+    }
+
+    *array = new_array;
+    *capacity = (uint32_t) new_capacity;
+    return 0;
+}
+
+/* id preceding the first document of a block */
+static inline uint32_t block_prev_doc_id(postings_t *postings, size_t block_i) {
+    return block_i ? postings->blocks[block_i - 1].last_doc_id : postings->doc_base - 1;
+}
+
+/* compress the tail into a new block */
+static int flush_tail(postings_t *postings) {
+    uint32_t n = postings->tail_len;
+    if (n == 0) {
+        return 0;
+    }
+
+    size_t max_bytes = 2 * codec_max_bytes(n);
+    if (grow_array((void **) &postings->data, &postings->data_capacity, postings->data_len + max_bytes, 1) != 0 ||
+        grow_array((void **) &postings->blocks, &postings->blocks_capacity, postings->n_blocks + 1, sizeof(block_t)) != 0) {
+        return -1;
+    }
+
+    uint32_t gaps[POSTINGS_BLOCK_LEN];
+    uint32_t counts[POSTINGS_BLOCK_LEN];
+    uint32_t prev = block_prev_doc_id(postings, postings->n_blocks);
+
+    for (uint32_t i = 0; i < n; i++) {
+        gaps[i] = postings->tail_doc_ids[i] - prev - 1;
+        counts[i] = postings->tail_counts[i] - 1;
+        prev = postings->tail_doc_ids[i];
+    }
+
+    block_t *block = &postings->blocks[postings->n_blocks++];
+    block->last_doc_id = prev;
+    block->offset = postings->data_len;
+    block->length = n;
+
+    uint8_t *out = postings->data + postings->data_len;
+    size_t n_bytes = codec_encode(postings->codec, gaps, n, out);
+    n_bytes += codec_encode(postings->codec, counts, n, out + n_bytes);
+    postings->data_len += (uint32_t) n_bytes;
+
+    postings->tail_len = 0;
+    return 0;
+}
+
+/* decompress a partial last block back into the tail, so that more documents can be added to it */
+static int reopen_last_block(postings_t *postings) {
+    block_t *last = &postings->blocks[postings->n_blocks - 1];
+
+    /* both tail arrays always have at least tail_capacity elements, so the counts are grown first */
+    uint32_t counts_capacity = postings->tail_capacity;
+    if (grow_array((void **) &postings->tail_counts, &counts_capacity, POSTINGS_BLOCK_LEN, sizeof(uint32_t)) != 0 ||
+        grow_array((void **) &postings->tail_doc_ids, &postings->tail_capacity, POSTINGS_BLOCK_LEN, sizeof(uint32_t)) != 0) {
+        return -1;
+    }
+
+    postings->tail_len = (uint32_t) postings_decode_block(
+        postings,
+        postings->n_blocks - 1,
+        postings->tail_doc_ids,
+        postings->tail_counts
+    );
+    postings->data_len = last->offset;
+    postings->n_blocks--;
+
+    return 0;
+}
+
+int postings_append(postings_t *postings, uint32_t doc_id, uint32_t count) {
+    assert(count > 0);
+
+    if (postings->tail_len == 0 && postings->n_blocks &&
+        postings->blocks[postings->n_blocks - 1].length < POSTINGS_BLOCK_LEN) {
+        if (reopen_last_block(postings) != 0) {
+            return -1;
+        }
+    }
+
+    assert(postings->length == 0 ||
+           (postings->tail_len ? postings->tail_doc_ids[postings->tail_len - 1]
+                               : postings->blocks[postings->n_blocks - 1].last_doc_id) < doc_id);
+
+    if (postings->tail_len == postings->tail_capacity) {
+        /* both tail arrays always have at least tail_capacity elements, so the counts are grown first */
+        uint32_t counts_capacity = postings->tail_capacity;
+        if (grow_array((void **) &postings->tail_counts, &counts_capacity, postings->tail_len + 1, sizeof(uint32_t)) != 0 ||
+            grow_array((void **) &postings->tail_doc_ids, &postings->tail_capacity, postings->tail_len + 1, sizeof(uint32_t)) != 0) {
+            return -1;
+        }
+    }
+
+    postings->tail_doc_ids[postings->tail_len] = doc_id;
+    postings->tail_counts[postings->tail_len] = count;
+    postings->tail_len++;
+    postings->length++;
+
+    /* the list is left as it was if the full tail cannot be compressed */
+    if (postings->tail_len == POSTINGS_BLOCK_LEN && flush_tail(postings) != 0) {
+        postings->tail_len--;
+        postings->length--;
+        return -1;
+    }
+
+    return 0;
+}
+
+int postings_remove_last(postings_t *postings, uint32_t doc_id) {
+    if (postings->tail_len == 0 && postings->n_blocks && reopen_last_block(postings) != 0) {
+        return -1;
+    }
+    if (postings->tail_len == 0 || postings->tail_doc_ids[postings->tail_len - 1] != doc_id) {
+        return -1;
+    }
+
+    postings->tail_len--;
+    postings->length--;
+    return 0;
+}
+
+int postings_append_all(postings_t *dst, postings_t *src, uint32_t doc_offset) {
+    uint32_t doc_ids[POSTINGS_BLOCK_LEN];
+    uint32_t counts[POSTINGS_BLOCK_LEN];
+
+    size_t n_blocks = postings_n_blocks(src);
+    for (size_t block_i = 0; block_i < n_blocks; block_i++) {
+        size_t n = postings_decode_block(src, block_i, doc_ids, counts);
+
+        for (size_t i = 0; i < n; i++) {
+            if (postings_append(dst, doc_ids[i] + doc_offset, counts[i]) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void postings_offset(postings_t *postings, uint32_t doc_offset) {
+    postings->doc_base += doc_offset;
+
+    for (uint32_t i = 0; i < postings->n_blocks; i++) {
+        postings->blocks[i].last_doc_id += doc_offset;
+    }
+    for (uint32_t i = 0; i < postings->tail_len; i++) {
+        postings->tail_doc_ids[i] += doc_offset;
+    }
+}
+
+void postings_freeze(postings_t *postings) {
+    if (flush_tail(postings) != 0) {
+        return; // keep the tail as it is. Decoding still works.
+    }
+    free_tail(postings);
+
+    /* shrinking never fails in practice, and if it does the arrays are simply left as they are */
+    if (postings->blocks_capacity != postings->n_blocks) {
+        block_t *blocks = realloc(postings->blocks, postings->n_blocks * sizeof(block_t));
+        if (blocks) {
+            postings->blocks = blocks;
+            postings->blocks_capacity = postings->n_blocks;
+        }
+    }
+    if (postings->data_capacity != postings->data_len) {
+        uint8_t *data = realloc(postings->data, postings->data_len);
+        if (data) {
+            postings->data = data;
+            postings->data_capacity = postings->data_len;
+        }
+    }
+}
+
+postings_pack_t *postings_pack(postings_t **lists, size_t n_lists) {
+    size_t n_blocks = 0, data_len = 0;
+
+    for (size_t i = 0; i < n_lists; i++) {
+        if (lists[i]->tail_len > 0) {
+            pr_error("Posting list must be frozen to be packed\n");
+            return NULL;
+        }
+        n_blocks += lists[i]->n_blocks;
+        data_len += lists[i]->data_len;
+    }
+
+    /* one extra element each, as malloc(0) may return NULL */
+    postings_pack_t *pack = malloc(sizeof(postings_pack_t));
+    postings_t *packed = calloc(n_lists + 1, sizeof(postings_t));
+    block_t *blocks = malloc((n_blocks + 1) * sizeof(block_t));
+    uint8_t *data = malloc(data_len + 1);
+
+    if (pack == NULL || packed == NULL || blocks == NULL || data == NULL) {
+        pr_error("Failed to allocate memory\n");
+        free(pack);
+        free(packed);
+        free(blocks);
+        free(data);
+        return NULL;
+    }
+
+    size_t block_pos = 0, data_pos = 0;
+    for (size_t i = 0; i < n_lists; i++) {
+        postings_t *src = lists[i];
+        postings_t *dst = &packed[i];
+
+        if (src->n_blocks > 0) {
+            memcpy(&blocks[block_pos], src->blocks, src->n_blocks * sizeof(block_t));
+            memcpy(&data[data_pos], src->data, src->data_len);
+        }
+
+        /* no capacity, so that nothing is ever reallocated or freed through a packed list */
+        dst->blocks = &blocks[block_pos];
+        dst->data = &data[data_pos];
+        dst->length = src->length;
+        dst->n_blocks = src->n_blocks;
+        dst->data_len = src->data_len;
+        dst->doc_base = src->doc_base;
+        dst->codec = src->codec;
+
+        block_pos += src->n_blocks;
+        data_pos += src->data_len;
+    }
+
+    pack->lists = packed;
+    pack->blocks = blocks;
+    pack->data = data;
+    pack->n_lists = n_lists;
+    pack->n_blocks = n_blocks;
+    pack->data_len = data_len;
+    pack->borrowed = 0;
+
+    return pack;
+}
+
+size_t postings_pack_file_size(postings_pack_t *pack) {
+    return sizeof(pack_header_t) + pack->n_lists * sizeof(packed_list_t) + PAD8(pack->n_blocks * sizeof(block_t)) +
+           PAD8(pack->data_len);
+}
+
+/* write `n` bytes followed by zeros up to the next multiple of 8 */
+static int write_padded(const void *buf, size_t n, FILE *f) {
+    static const uint8_t zeros[8] = {0};
+
+    if ((n > 0 && fwrite(buf, 1, n, f) != n) || fwrite(zeros, 1, PAD8(n) - n, f) != PAD8(n) - n) {
+        pr_error("Failed to write posting lists\n");
+        return -1;
+    }
+    return 0;
+}
+
+int postings_pack_write(postings_pack_t *pack, FILE *f) {
+    pack_header_t header = {pack->n_lists, pack->n_blocks, pack->data_len};
+    if (write_padded(&header, sizeof(header), f) != 0) {
+        return -1;
+    }
+
+    /* the records are written a chunk at a time */
+    packed_list_t records[256];
+    size_t n_records = 0;
+
+    for (size_t i = 0; i < pack->n_lists; i++) {
+        postings_t *postings = &pack->lists[i];
+        packed_list_t *record = &records[n_records++];
+
+        record->block_start = (uint64_t) (postings->blocks - pack->blocks);
+        record->data_start = (uint64_t) (postings->data - pack->data);
+        record->length = postings->length;
+        record->n_blocks = postings->n_blocks;
+        record->data_len = postings->data_len;
+        record->doc_base = postings->doc_base;
+
+        if (n_records == sizeof(records) / sizeof(records[0]) || i + 1 == pack->n_lists) {
+            if (write_padded(records, n_records * sizeof(packed_list_t), f) != 0) {
+                return -1;
+            }
+            n_records = 0;
+        }
+    }
+
+    if (write_padded(pack->blocks, pack->n_blocks * sizeof(block_t), f) != 0 ||
+        write_padded(pack->data, pack->data_len, f) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+postings_pack_t *postings_pack_load(const void *mem, size_t size, codec_t codec) {
+    const pack_header_t *header = mem;
+
+    if ((uintptr_t) mem % 8 != 0 || size < sizeof(pack_header_t) ||
+        header->n_lists > (size - sizeof(pack_header_t)) / sizeof(packed_list_t) ||
+        header->n_blocks > size / sizeof(block_t) || header->data_len > size) {
+        pr_error("Invalid posting lists\n");
+        return NULL;
+    }
+
+    size_t records_bytes = header->n_lists * sizeof(packed_list_t);
+    size_t blocks_bytes = PAD8(header->n_blocks * sizeof(block_t));
+    if (sizeof(pack_header_t) + records_bytes + blocks_bytes + PAD8(header->data_len) != size) {
+        pr_error("Invalid posting lists\n");
+        return NULL;
+    }
+
+    const uint8_t *base = mem;
+    const packed_list_t *records = (const packed_list_t *) (base + sizeof(pack_header_t));
+
+    postings_pack_t *pack = malloc(sizeof(postings_pack_t));
+    postings_t *lists = calloc(header->n_lists + 1, sizeof(postings_t));
+    if (pack == NULL || lists == NULL) {
+        pr_error("Failed to allocate memory\n");
+        free(pack);
+        free(lists);
+        return NULL;
+    }
+
+    /* the lists are used in place, as in postings_pack. They are never written to. */
+    pack->lists = lists;
+    pack->blocks = (block_t *) (base + sizeof(pack_header_t) + records_bytes);
+    pack->data = (uint8_t *) (base + sizeof(pack_header_t) + records_bytes + blocks_bytes);
+    pack->n_lists = header->n_lists;
+    pack->n_blocks = header->n_blocks;
+    pack->data_len = header->data_len;
+    pack->borrowed = 1;
+
+    for (size_t i = 0; i < pack->n_lists; i++) {
+        const packed_list_t *record = &records[i];
+
+        if (record->block_start > pack->n_blocks || record->n_blocks > pack->n_blocks - record->block_start ||
+            record->data_start > pack->data_len || record->data_len > pack->data_len - record->data_start ||
+            record->length > (uint64_t) record->n_blocks * POSTINGS_BLOCK_LEN) {
+            pr_error("Invalid posting list\n");
+            postings_pack_destroy(pack);
+            return NULL;
+        }
+
+        lists[i].blocks = &pack->blocks[record->block_start];
+        lists[i].data = &pack->data[record->data_start];
+        lists[i].length = record->length;
+        lists[i].n_blocks = record->n_blocks;
+        lists[i].data_len = record->data_len;
+        lists[i].doc_base = record->doc_base;
+        lists[i].codec = codec;
+    }
+
+    return pack;
+}
+
+/* check a list of a loaded pack, see postings_pack_verify */
+static int verify_list(postings_t *postings, uint32_t n_docs) {
+    uint32_t gaps[POSTINGS_BLOCK_LEN];
+    uint64_t length = 0;
+    int64_t prev = (int64_t) postings->doc_base - 1;
+
+    for (size_t b = 0; b < postings->n_blocks; b++) {
+        block_t *block = &postings->blocks[b];
+        uint32_t end = (b + 1 < postings->n_blocks) ? postings->blocks[b + 1].offset : postings->data_len;
+        if (block->length == 0 || block->length > POSTINGS_BLOCK_LEN || block->offset >= end || end > postings->data_len) {
+            return -1;
+        }
+
+        /* both streams of the block must be decodable without reading into the next block */
+        const uint8_t *in = postings->data + block->offset;
+        size_t avail = end - block->offset;
+        size_t ids_bytes = codec_check(postings->codec, in, avail, block->length);
+        if (ids_bytes == 0 || codec_check(postings->codec, in + ids_bytes, avail - ids_bytes, block->length) == 0) {
+            return -1;
+        }
+
+        /* the ids are increasing, end at the last id of the block, and are all less than n_docs */
+        codec_decode(postings->codec, in, block->length, gaps);
+        for (size_t i = 0; i < block->length; i++) {
+            prev += (int64_t) gaps[i] + 1;
+        }
+        if (prev != block->last_doc_id || prev >= n_docs) {
+            return -1;
+        }
+        length += block->length;
+    }
+
+    return length == postings->length ? 0 : -1;
+}
+
+int postings_pack_verify(postings_pack_t *pack, uint32_t n_docs) {
+    for (size_t i = 0; i < pack->n_lists; i++) {
+        if (verify_list(&pack->lists[i], n_docs) != 0) {
+            pr_error("Invalid posting list\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+size_t postings_pack_length(postings_pack_t *pack) {
+    return pack->n_lists;
+}
+
+postings_t *postings_pack_get(postings_pack_t *pack, size_t i) {
+    assert(i < pack->n_lists);
+    return &pack->lists[i];
+}
+
+void postings_pack_destroy(postings_pack_t *pack) {
+    if (!pack) {
+        return;
+    }
+    free(pack->lists);
+    if (!pack->borrowed) {
+        free(pack->blocks);
+        free(pack->data);
+    }
+    free(pack);
+}
+
+size_t postings_n_blocks(postings_t *postings) {
+    return postings->n_blocks + (postings->tail_len ? 1 : 0);
+}
+
+uint32_t postings_block_last(postings_t *postings, size_t block_i) {
+    if (block_i == postings->n_blocks) {
+        return postings->tail_doc_ids[postings->tail_len - 1];
+    }
+    return postings->blocks[block_i].last_doc_id;
+}
+
+/* decode the ids of a compressed block, returning the number of bytes they take up */
+static size_t decode_block_ids(postings_t *postings, size_t block_i, uint32_t *doc_ids) {
+    block_t *block = &postings->blocks[block_i];
+    size_t n = block->length;
+
+    size_t n_bytes = codec_decode(postings->codec, postings->data + block->offset, n, doc_ids);
+
+    /* turn gaps back into ids */
+    uint32_t prev = block_prev_doc_id(postings, block_i);
+    for (size_t i = 0; i < n; i++) {
+        prev += doc_ids[i] + 1;
+        doc_ids[i] = prev;
+    }
+
+    return n_bytes;
+}
+
+/* decode the counts of a compressed block, which start `ids_bytes` into the block */
+static void decode_block_counts(postings_t *postings, size_t block_i, size_t ids_bytes, uint32_t *counts) {
+    block_t *block = &postings->blocks[block_i];
+    size_t n = block->length;
+
+    codec_decode(postings->codec, postings->data + block->offset + ids_bytes, n, counts);
+    for (size_t i = 0; i < n; i++) {
+        counts[i] += 1;
+    }
+}
+
+size_t postings_decode_block(postings_t *postings, size_t block_i, uint32_t *doc_ids, uint32_t *counts) {
+    if (block_i == postings->n_blocks) {
+        /* the uncompressed tail */
+        memcpy(doc_ids, postings->tail_doc_ids, postings->tail_len * sizeof(uint32_t));
+        if (counts) {
+            memcpy(counts, postings->tail_counts, postings->tail_len * sizeof(uint32_t));
+        }
+        return postings->tail_len;
+    }
+
+    size_t ids_bytes = decode_block_ids(postings, block_i, doc_ids);
+    if (counts) {
+        decode_block_counts(postings, block_i, ids_bytes, counts);
+    }
+
+    return postings->blocks[block_i].length;
+}
+
+/* find the first block at or after `from` whose last id is >= target, galloping over the block headers */
+static size_t skip_blocks(postings_t *postings, size_t from, uint32_t target) {
+    size_t n_blocks = postings_n_blocks(postings);
+
+    if (from >= n_blocks || postings_block_last(postings, from) >= target) {
+        return from;
+    }
+
+    size_t lo = from;
+    size_t step = 1;
+    size_t hi = from + step;
+
+    while (hi < n_blocks && postings_block_last(postings, hi) < target) {
+        lo = hi;
+        step *= 2;
+        hi = from + step;
+    }
+    if (hi > n_blocks) {
+        hi = n_blocks;
+    }
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (postings_block_last(postings, mid) < target) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return hi;
+}
+
+/* shared by postings_intersect and postings_subtract. Keeps the ids that are in the list if `keep_present` */
+static size_t
+filter_doc_ids(postings_t *postings, const uint32_t *doc_ids, size_t n, uint32_t *out, int keep_present) {
+    uint32_t block_ids[POSTINGS_BLOCK_LEN];
+    size_t n_blocks = postings_n_blocks(postings);
+    size_t block_i = 0, i = 0, n_out = 0;
+
+    while (i < n) {
+        block_i = skip_blocks(postings, block_i, doc_ids[i]);
+
+        if (block_i == n_blocks) {
+            /* the remaining ids are past the end of the list */
+            if (!keep_present) {
+                memcpy(&out[n_out], &doc_ids[i], (n - i) * sizeof(uint32_t));
+                n_out += n - i;
+            }
+            break;
+        }
+
+        /* the ids from i up to range_end are all within this block (or between it and the previous one) */
+        uint32_t last = postings_block_last(postings, block_i);
+        size_t range_end = (last == UINT32_MAX) ? n : docset_gallop(doc_ids, n, i, last + 1);
+        size_t block_len = postings_decode_block(postings, block_i, block_ids, NULL);
+
+        if (keep_present) {
+            n_out += docset_intersect(&doc_ids[i], range_end - i, block_ids, block_len, &out[n_out]);
+        } else {
+            n_out += docset_difference(&doc_ids[i], range_end - i, block_ids, block_len, &out[n_out]);
+        }
+
+        i = range_end;
+        block_i++;
+    }
+
+    return n_out;
+}
+
+size_t postings_intersect(postings_t *postings, const uint32_t *doc_ids, size_t n, uint32_t *out) {
+    return filter_doc_ids(postings, doc_ids, n, out, 1);
+}
+
+size_t postings_subtract(postings_t *postings, const uint32_t *doc_ids, size_t n, uint32_t *out) {
+    return filter_doc_ids(postings, doc_ids, n, out, 0);
+}
+
+/* decode block `block_i` into the cursor and move to its first document, or to the end if there are no more */
+static uint32_t cursor_load_block(postings_cursor_t *cursor, size_t block_i) {
+    postings_t *postings = cursor->postings;
+
+    cursor->block_i = block_i;
+    cursor->pos = 0;
+    cursor->counts_decoded = 0;
+
+    if (block_i >= postings_n_blocks(postings)) {
+        cursor->block_len = 0;
+        cursor->doc_id = POSTINGS_END;
+        return POSTINGS_END;
+    }
+
+    if (block_i == postings->n_blocks) {
+        cursor->block_len = postings_decode_block(postings, block_i, cursor->doc_ids, cursor->counts);
+        cursor->counts_decoded = 1;
+    } else {
+        cursor->ids_bytes = decode_block_ids(postings, block_i, cursor->doc_ids);
+        cursor->block_len = postings->blocks[block_i].length;
+    }
+
+    cursor->doc_id = cursor->doc_ids[0];
+    return cursor->doc_id;
+}
+
+void postings_cursor_init(postings_cursor_t *cursor, postings_t *postings) {
+    cursor->postings = postings;
+    cursor_load_block(cursor, 0);
+}
+
+uint32_t postings_cursor_next(postings_cursor_t *cursor) {
+    if (cursor->doc_id == POSTINGS_END) {
+        return POSTINGS_END;
+    }
+    if (++cursor->pos == cursor->block_len) {
+        return cursor_load_block(cursor, cursor->block_i + 1);
+    }
+    cursor->doc_id = cursor->doc_ids[cursor->pos];
+    return cursor->doc_id;
+}
+
+uint32_t postings_cursor_advance(postings_cursor_t *cursor, uint32_t target) {
+    if (cursor->doc_id >= target) {
+        return cursor->doc_id;
+    }
+
+    if (cursor->doc_ids[cursor->block_len - 1] < target) {
+        /* skip to the block holding target, using the block headers */
+        size_t block_i = skip_blocks(cursor->postings, cursor->block_i + 1, target);
+        if (cursor_load_block(cursor, block_i) >= target) {
+            return cursor->doc_id;
+        }
+    }
+
+    /* target is within the current block */
+    cursor->pos = docset_gallop(cursor->doc_ids, cursor->block_len, cursor->pos, target);
+    cursor->doc_id = cursor->doc_ids[cursor->pos];
+    return cursor->doc_id;
+}
+
+uint32_t postings_cursor_count(postings_cursor_t *cursor) {
+    if (!cursor->counts_decoded) {
+        decode_block_counts(cursor->postings, cursor->block_i, cursor->ids_bytes, cursor->counts);
+        cursor->counts_decoded = 1;
+    }
+    return cursor->counts[cursor->pos];
+}
+
+size_t postings_size_bytes(postings_t *postings) {
+    return postings->data_len + postings->n_blocks * sizeof(block_t) +
+           postings->tail_len * 2 * sizeof(uint32_t);
+}
+
+size_t postings_raw_bytes(postings_t *postings) {
+    return (size_t) postings->length * 2 * sizeof(uint32_t);
+}
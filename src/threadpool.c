@@ -0,0 +1,165 @@
+/**
+ * @implements threadpool.h
+ *
+ * @brief Thread pool on top of pthreads. Tasks are kept in a list guarded by a single mutex, which is more
+ * than fast enough as long as each task does a meaningful amount of work (e.g. a file, or a query).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "printing.h"
+#include "defs.h"
+#include "list.h"
+#include "threadpool.h"
+
+typedef struct task {
+    task_fn fn;
+    void *arg;
+} task_t;
+
+struct threadpool {
+    pthread_t *threads;
+    size_t n_threads;
+    list_t *queue;        // pending tasks, in submission order
+    size_t n_active;      // tasks currently executing
+    int shutdown;         // set when the workers should exit
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready; // signalled on submission and shutdown
+    pthread_cond_t idle;       // signalled when the queue is drained and no task is executing
+};
+
+static void *worker_main(void *arg) {
+    threadpool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (1) {
+        while (!list_length(pool->queue) && !pool->shutdown) {
+            pthread_cond_wait(&pool->task_ready, &pool->lock);
+        }
+
+        if (!list_length(pool->queue)) {
+            break; // shutdown, and nothing left to do
+        }
+
+        task_t *task = list_popfirst(pool->queue);
+        pool->n_active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->n_active--;
+
+        if (!pool->n_active && !list_length(pool->queue)) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+threadpool_t *threadpool_create(size_t n_threads) {
+    assert(n_threads > 0);
+
+    threadpool_t *pool = malloc(sizeof(threadpool_t));
+    if (pool == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return NULL;
+    }
+
+    pool->threads = malloc(n_threads * sizeof(pthread_t));
+    pool->queue = list_create(NULL);
+    if (pool->threads == NULL || pool->queue == NULL) {
+        pr_error("Failed to allocate memory\n");
+        free(pool->threads);
+        list_destroy(pool->queue, NULL);
+        free(pool);
+        return NULL;
+    }
+
+    pool->n_threads = 0;
+    pool->n_active = 0;
+    pool->shutdown = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (size_t i = 0; i < n_threads; i++) {
+        int err = pthread_create(&pool->threads[i], NULL, worker_main, pool);
+        if (err != 0) {
+            pr_error("Failed to create worker thread: %s\n", strerror(err));
+            threadpool_destroy(pool);
+            return NULL;
+        }
+        pool->n_threads++;
+    }
+
+    return pool;
+}
+
+void threadpool_destroy(threadpool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* workers drain the queue before they exit */
+    for (size_t i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_cond_destroy(&pool->idle);
+
+    list_destroy(pool->queue, free);
+    free(pool->threads);
+    free(pool);
+}
+
+size_t threadpool_size(threadpool_t *pool) {
+    return pool->n_threads;
+}
+
+int threadpool_submit(threadpool_t *pool, task_fn fn, void *arg) {
+    task_t *task = malloc(sizeof(task_t));
+    if (task == NULL) {
+        pr_error("Failed to allocate memory\n");
+        return -1;
+    }
+
+    task->fn = fn;
+    task->arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    int status = list_addlast(pool->queue, task);
+    if (status == 0) {
+        pthread_cond_signal(&pool->task_ready);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (status != 0) {
+        free(task);
+    }
+
+    return status;
+}
+
+void threadpool_wait(threadpool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->n_active || list_length(pool->queue)) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
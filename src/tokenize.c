@@ -146,6 +146,9 @@ int tokenize_file(
 
     content[read_bytes - 1] = '\0';
 
+    /* hint the number of tokens, assuming words of about 5 letters and a delimiter */
+    list_reserve(list, file_size / 6);
+
     /* run tokenize on the buffer */
     int rv = tokenize_string(content, list, min_token_len, delimitfn, filterfn, transformfn);
 